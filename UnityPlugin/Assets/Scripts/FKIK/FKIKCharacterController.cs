@@ -47,7 +47,8 @@ public class FKIKCharacterController : MonoBehaviour
 
     // Containers
     private List<GameObject> m_joints = new List<GameObject>();
-    private FKIKPlugin.JointData[] m_jointDataArray;
+    private System.IntPtr m_posePtr = System.IntPtr.Zero;   // Pose buffer of the actor in the plugin
+    private int m_poseFloatNum = 0;
     private SortedDictionary<int, GameObject> m_idJointMap = new SortedDictionary<int, GameObject>();   // <Joint ID, Joint object>
 
     // States
@@ -76,7 +77,7 @@ public class FKIKCharacterController : MonoBehaviour
         TraverseJoints(m_root.transform);   // Add joints to the m_joints and m_idJointMap
         LinkJoints();   // Set the parent child relationship
         m_jointPainter.InitVirtualJoints(this.name + "joints", m_joints);       
-        ConstructJointDataArray();  // Initialize the joint data array  
+        FKIKPlugin.GetPoseBuffer(m_id, ref m_poseFloatNum, ref m_posePtr);
         ConstructIKChains();    // Construct IK chains for hands and feet
         GameObject[] endJoints = new GameObject[] { m_root, m_leftHand, m_rightHand, m_leftFoot, m_rightFoot };
         m_jointPainter.InitializeTargetJoints(endJoints);
@@ -90,7 +91,13 @@ public class FKIKCharacterController : MonoBehaviour
             LoadBVHFile(filename);
             StartMove();         
         }
-        
+
+        FKIKPluginManager.Register(this);   // Updates the actor every fixed step
+    }
+
+    private void OnDestroy()
+    {
+        FKIKPluginManager.Unregister(this);
     }
 
     private void Update()
@@ -99,31 +106,52 @@ public class FKIKCharacterController : MonoBehaviour
         m_jointPainter.DrawJointsAndSkeletons();
     }
 
-    private void FixedUpdate()
+    // Called by FKIKPluginManager before its UpdateAll, which advances and wraps the clip time of every character.
+    // Returns false if this character is not to be updated.
+    public bool GetActorUpdate(float dt, ref FKIKPlugin.ActorUpdate update)
     {
-        if (!m_bvhNotMatch) { return; }
-          
-        if (m_canMove)
+        if (!m_bvhNotMatch) { return false; }
+
+        float speedScale = m_canMove ? m_speedScale : 0;
+        float t = m_t + dt * speedScale;
+        if (m_canMove && (t >= m_maxt || t < 0))
         {
-            m_t += Time.fixedDeltaTime * m_speedScale;
-            if (m_t >= m_maxt)
+            // The clip wraps in this step: move the guide while the root is still at the end of the cycle
+            switch(m_controlMode)
             {
-                m_t -= m_maxt;
-                switch(m_controlMode)
-                {
-                    case ControlMode.TARGET:
-                        UpdateGuideByTarget(true);  // Update Guide to the new root position
-                        break;
-                    case ControlMode.KEYBOARD:
-                        UpdateGuideToRoot();
-                        break;
-                    case ControlMode.BEHAVIOR:
-                        break;
-                }
+                case ControlMode.TARGET:
+                    UpdateGuideByTarget(true);  // Update Guide to the new root position
+                    break;
+                case ControlMode.KEYBOARD:
+                    UpdateGuideToRoot();
+                    break;
+                case ControlMode.BEHAVIOR:
+                    break;
             }
-            
         }
-        UpdateJointTransform(m_t);   
+
+        update.id = m_id;
+        update.time = m_t;
+        update.speedScale = speedScale;
+        update.solveFootIK = 0;
+        return true;
+    }
+
+    // Called by FKIKPluginManager after its UpdateAll. Returns true if the foot IK is to be solved.
+    public bool ApplyActorUpdate(FKIKPlugin.ActorUpdate update)
+    {
+        m_t = update.time;
+        ApplyPoseBuffer();
+
+        // Check foot-ground contact
+        CheckFootGroundContact();
+        return m_enableFootIK;
+    }
+
+    // Called by FKIKPluginManager after its SolveFootIKBatch
+    public void ApplyFootIK()
+    {
+        ApplyPoseBuffer();
     }
 
     private void InputProcess()
@@ -175,15 +203,20 @@ public class FKIKCharacterController : MonoBehaviour
         }
     }
 
-    // Set joints' localRotation and localPosition with JointData
-    private void ApplyJointDataArray()
+    // Set joints' localRotation and localPosition from the pose buffer of the plugin, read in place.
+    // The buffer holds 7 floats per joint ID, so joints are looked up by ID, whatever IDs the plugin gave them.
+    private unsafe void ApplyPoseBuffer()
     {
-        for (int i = 0; i < m_joints.Count; ++i)
+        float* buffer = (float*)m_posePtr;
+        foreach (KeyValuePair<int, GameObject> pair in m_idJointMap)
         {
-            FKIKPlugin.JointData data = m_jointDataArray[i];
-            GameObject joint = m_idJointMap[data.id];
-            joint.transform.localPosition = FKIKPlugin.BVHToUnityTranslation(data.localTranslation);
-            joint.transform.localRotation = FKIKPlugin.BVHToUnityQuaternion(data.localRotation);
+            if (pair.Key < 0 || (pair.Key + 1) * 7 > m_poseFloatNum) continue;
+            float* pose = buffer + pair.Key * 7;
+
+            // Right-hand to left-hand, as in BVHToUnityTranslation and BVHToUnityQuaternion
+            GameObject joint = pair.Value;
+            joint.transform.localPosition = new Vector3(-pose[4], pose[5], pose[6]);
+            joint.transform.localRotation = new Quaternion(-pose[1], pose[2], pose[3], -pose[0]);
         }
 
         if (m_fixedRoot)
@@ -193,7 +226,8 @@ public class FKIKCharacterController : MonoBehaviour
         }
     }
 
-    private void FootIK()
+    // Fills entry i of the SolveFootIKBatch arguments, as SolveFootIK takes them, and returns the actor ID
+    public int GetFootIKParams(float[] heights, float[] normals, bool[] rotate, int i)
     {
         // Get foot position in world space
         Vector3 leftFootPos = m_leftFoot.transform.position;
@@ -201,11 +235,18 @@ public class FKIKCharacterController : MonoBehaviour
         /// C++ Implementation
         RaycastFootHeight(leftFootPos, out float leftHeight, out Vector3 leftNormal);
         RaycastFootHeight(rightFootPos, out float rightHeight, out Vector3 rightNormal);
-        FKIKPlugin.SolveFootIK(m_id, leftHeight, rightHeight, m_leftFootGroundContact, m_rightFootGroundContact,
-            FKIKPlugin.UnityToBVHTranslation(leftNormal), FKIKPlugin.UnityToBVHTranslation(rightNormal));
-
-        FKIKPlugin.GetJointData(m_id, m_jointDataArray, m_joints.Count);
-        ApplyJointDataArray();
+        heights[2 * i] = leftHeight;
+        heights[2 * i + 1] = rightHeight;
+        // Right-hand, as in UnityToBVHTranslation
+        normals[6 * i] = -leftNormal.x;
+        normals[6 * i + 1] = leftNormal.y;
+        normals[6 * i + 2] = leftNormal.z;
+        normals[6 * i + 3] = -rightNormal.x;
+        normals[6 * i + 4] = rightNormal.y;
+        normals[6 * i + 5] = rightNormal.z;
+        rotate[2 * i] = m_leftFootGroundContact;
+        rotate[2 * i + 1] = m_rightFootGroundContact;
+        return m_id;
 
         /// Unity Implementation
 
@@ -235,9 +276,7 @@ public class FKIKCharacterController : MonoBehaviour
         //FKIKPlugin.UpdateSkeleton(m_id);
         //FKIKPlugin.SolveLimbIK(m_id, FindIdByJoint(m_leftFoot), FKIKPlugin.UnityToBVHTranslation(leftFootPos));
         //FKIKPlugin.SolveLimbIK(m_id, FindIdByJoint(m_rightFoot), FKIKPlugin.UnityToBVHTranslation(rightFootPos));
-        //FKIKPlugin.GetJointData(m_id, m_jointDataArray, m_joints.Count);
-
-        //ApplyJointDataArray();
+        //ApplyPoseBuffer();
 
         //// Foot rotation 
         //if (m_leftFootGroundContact)
@@ -274,42 +313,7 @@ public class FKIKCharacterController : MonoBehaviour
         }
     }
 
-   private void UpdateJointTransform(float t)
-    {
-        // FK
-        if (m_bvhLoaded)
-        {
-            FKIKPlugin.UpdateBVHSkeleton(m_id, t);
-            FKIKPlugin.GetJointData(m_id, m_jointDataArray, m_joints.Count);
-        }
-        else
-        {
-            FKIKPlugin.UpdateSkeleton(m_id);
-            FKIKPlugin.GetJointData(m_id, m_jointDataArray, m_joints.Count);
-        }
-        ApplyJointDataArray();
-
-        // Check foot-ground contact
-        CheckFootGroundContact();
-
-        // IK
-        if (m_enableFootIK)
-        {
-            FootIK();
-        }
-    }
-
     #region Initialization
-    // Construct the jointData array to transfer data between C# and C++
-    void ConstructJointDataArray()
-    {
-        m_jointDataArray = new FKIKPlugin.JointData[m_joints.Count];
-        for (int i = 0; i < m_joints.Count; ++i)
-        {
-            m_jointDataArray[i] = new FKIKPlugin.JointData(i);
-        }
-    }
-
     // Construct a map between joints and indices
     bool ConstructIdJointMap()
     {
@@ -412,6 +416,7 @@ public class FKIKCharacterController : MonoBehaviour
         m_bvhNotMatch = true;
         if (FKIKPlugin.LoadBVH(m_id, filepath))
         {
+            FKIKPlugin.GetPoseBuffer(m_id, ref m_poseFloatNum, ref m_posePtr);
             // Reconstrcut idJoint Map. If files do not match, return false
             if (!ConstructIdJointMap())
             {
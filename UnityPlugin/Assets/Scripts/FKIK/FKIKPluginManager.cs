@@ -53,6 +53,12 @@ public class FKIKPlugin
     [DllImport("FKIKPlugin", CallingConvention = CallingConvention.Cdecl)]
     public static extern int GetJointData(int id, [In, Out] JointData[] jointDataArray, int size);
 
+    // Get the pose buffer of the actor: 7 floats per joint ID, local rotation (w, x, y, z) then local translation.
+    // The plugin updates it in place whenever the skeleton is updated, so it can be read each frame without a call.
+    // The pointer only changes when the joints change (CreateJoint, LoadBVH)
+    [DllImport("FKIKPlugin", CallingConvention = CallingConvention.Cdecl)]
+    public static extern void GetPoseBuffer(int id, ref int floatNum, ref IntPtr posePtr);
+
     // Update BVH at time t
     [DllImport("FKIKPlugin", CallingConvention = CallingConvention.Cdecl)]
     public static extern int UpdateBVHSkeleton(int id, float t);
@@ -106,6 +112,21 @@ public class FKIKPlugin
     public static extern void SolveFootIK(int id, float leftHeight, float rightHeight, 
         bool leftRotate, bool rightRotate, float[] leftNormal, float[] rightNormal);
 
+    // Solve the foot IK of n actors in one call, as SolveFootIK does for each. heights holds the left and right height
+    // of every actor, normals the left and right normal (right-handed), rotate the left and right flags
+    [DllImport("FKIKPlugin", CallingConvention = CallingConvention.Cdecl)]
+    public static extern void SolveFootIKBatch(int[] ids, float[] heights, float[] normals,
+        [MarshalAs(UnmanagedType.LPArray, ArraySubType = UnmanagedType.I1)] bool[] rotate, int n);
+
+    // Threads SolveFootIKBatch and UpdateAll use, 0 for one per hardware thread and 1 to run on the caller only
+    [DllImport("FKIKPlugin", CallingConvention = CallingConvention.Cdecl)]
+    public static extern void SetBatchThreads(int numThreads);
+
+    // Update many actors in one call: advance each clip time by dt * speedScale, play the clip,
+    // solve the foot IK if asked and refresh the pose buffer. time and wrapped are written back to the array
+    [DllImport("FKIKPlugin", CallingConvention = CallingConvention.Cdecl)]
+    public static extern void UpdateAll(float dt, [In, Out] ActorUpdate[] updates, int n);
+
     [DllImport("FKIKPlugin", CallingConvention = CallingConvention.Cdecl)]
     public static extern void UpdateGuideJointByTarget(int id, float[] targetPos, float[] newPos, float[] newQuat);
 
@@ -126,6 +147,24 @@ public class FKIKPlugin
     }
 
 
+    // Blittable (ints and floats only), so UpdateAll reads and writes the managed array in place
+    [StructLayout(LayoutKind.Sequential)]
+    public unsafe struct ActorUpdate
+    {
+        public int id;
+        public float time;          // Clip time, advanced by UpdateAll and wrapped into [0, duration)
+        public float speedScale;
+        public int wrapped;         // 1 if time went past either end of the clip in the last UpdateAll
+        public int solveFootIK;     // Foot IK as in SolveFootIK, normals right-handed like UnityToBVHTranslation
+        public int rotateLeft;
+        public int rotateRight;
+        public float leftHeight;
+        public float rightHeight;
+        public fixed float leftNormal[3];
+        public fixed float rightNormal[3];
+    }
+
+
     // Convert between the right-hand coordinate system (BVH) and the left-hand coordinate system (Unity)
     public static Vector3 BVHToUnityTranslation(float[] vec3)
     {
@@ -159,16 +198,103 @@ public class FKIKPlugin
 
 }
 
-//public class FKIKPluginManager : MonoBehaviour
-//{
-//    // Start is called before the first frame update
-//    void Start()
-//    {
-//    }
-
-//    // Update is called once per frame
-//    void Update()
-//    {
-        
-//    }
-//}
+// Updates every FKIKCharacterController of the scene with one UpdateAll call per fixed step, instead of a plugin
+// call per character, then solves the foot IK of those that want it with one SolveFootIKBatch.
+// The foot heights are raycast from the pose UpdateAll leaves, so the foot IK is a second batch rather than part
+// of UpdateAll. Created on first use if the scene has none.
+public class FKIKPluginManager : MonoBehaviour
+{
+    private static FKIKPluginManager s_instance;
+
+    private List<FKIKCharacterController> m_characters = new List<FKIKCharacterController>();
+    private List<FKIKCharacterController> m_updated = new List<FKIKCharacterController>();   // In m_updates order
+    private FKIKPlugin.ActorUpdate[] m_updates = new FKIKPlugin.ActorUpdate[0];
+
+    // SolveFootIKBatch arguments
+    private List<FKIKCharacterController> m_footIKCharacters = new List<FKIKCharacterController>();
+    private int[] m_footIKIds = new int[0];
+    private float[] m_footHeights = new float[0];
+    private float[] m_footNormals = new float[0];
+    private bool[] m_footRotate = new bool[0];
+
+    public static void Register(FKIKCharacterController character)
+    {
+        if (!s_instance)
+        {
+            s_instance = FindObjectOfType<FKIKPluginManager>();
+            if (!s_instance)
+            {
+                s_instance = new GameObject("FKIKPluginManager").AddComponent<FKIKPluginManager>();
+            }
+        }
+        if (!s_instance.m_characters.Contains(character))
+        {
+            s_instance.m_characters.Add(character);
+        }
+    }
+
+    public static void Unregister(FKIKCharacterController character)
+    {
+        if (s_instance)
+        {
+            s_instance.m_characters.Remove(character);
+        }
+    }
+
+    private void OnDestroy()
+    {
+        if (s_instance == this)
+        {
+            s_instance = null;
+        }
+    }
+
+    private void FixedUpdate()
+    {
+        float dt = Time.fixedDeltaTime;
+
+        // Clips
+        m_updated.Clear();
+        if (m_updates.Length < m_characters.Count)
+        {
+            Array.Resize(ref m_updates, m_characters.Count);
+        }
+        foreach (FKIKCharacterController character in m_characters)
+        {
+            if (character.isActiveAndEnabled && character.GetActorUpdate(dt, ref m_updates[m_updated.Count]))
+            {
+                m_updated.Add(character);
+            }
+        }
+        if (m_updated.Count == 0) { return; }
+        FKIKPlugin.UpdateAll(dt, m_updates, m_updated.Count);
+
+        // Foot IK
+        m_footIKCharacters.Clear();
+        for (int i = 0; i < m_updated.Count; ++i)
+        {
+            if (m_updated[i].ApplyActorUpdate(m_updates[i]))
+            {
+                m_footIKCharacters.Add(m_updated[i]);
+            }
+        }
+        int n = m_footIKCharacters.Count;
+        if (n == 0) { return; }
+        if (m_footIKIds.Length < n)
+        {
+            Array.Resize(ref m_footIKIds, n);
+            Array.Resize(ref m_footHeights, 2 * n);
+            Array.Resize(ref m_footNormals, 6 * n);
+            Array.Resize(ref m_footRotate, 2 * n);
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            m_footIKIds[i] = m_footIKCharacters[i].GetFootIKParams(m_footHeights, m_footNormals, m_footRotate, i);
+        }
+        FKIKPlugin.SolveFootIKBatch(m_footIKIds, m_footHeights, m_footNormals, m_footRotate, n);
+        foreach (FKIKCharacterController character in m_footIKCharacters)
+        {
+            character.ApplyFootIK();
+        }
+    }
+}
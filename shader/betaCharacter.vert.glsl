@@ -1,32 +1,48 @@
 #version 330 core
 layout (location = 0) in vec3 vPos;
 layout (location = 1) in vec3 vNor;
-layout (location = 2) in int vJointNum;  // The number of joints that influence this vertex
-layout (location = 3) in vec2 vJointWeights[6];   // The array of joints' weights that influence this vertex
+layout (location = 2) in uvec4 vJoints;  // The joints that influence this vertex
+layout (location = 3) in vec4 vWeights;   // Their weights, 0 for unused influences
 
 uniform mat4 uModel;
 uniform mat3 uModelInvTr; // The inverse transpose of the model matrix.
 uniform mat4 uProjView;
 uniform vec3 uLightPos;
 
-uniform mat4 uBindMats[64]; // The bind matrix of each joint
-uniform mat4 uJointTransMats[64]; // The overall transform matrix of each joint
+uniform samplerBuffer uJointPalette; // 7 texels per joint: the overall transform matrix * the bind matrix, then its inverse transpose
+uniform int uJointOffset; // The index of the first joint of this model (or of its first instance) in uJointPalette
+uniform int uJointsPerInstance; // Instance i reads its joints from uJointOffset + i * uJointsPerInstance
 uniform vec3 color = vec3(0.7, 0.7, 0.6);
 
 out vec3 nor;
 out vec3 lightDir;
 out vec3 vcolor;
 
+mat4 skinningMat(int id)
+{
+    int texel = (uJointOffset + gl_InstanceID * uJointsPerInstance + id) * 7;
+    return mat4(texelFetch(uJointPalette, texel), texelFetch(uJointPalette, texel + 1),
+                texelFetch(uJointPalette, texel + 2), texelFetch(uJointPalette, texel + 3));
+}
+
+mat3 normalMat(int id)
+{
+    int texel = (uJointOffset + gl_InstanceID * uJointsPerInstance + id) * 7 + 4;
+    return mat3(texelFetch(uJointPalette, texel).xyz, texelFetch(uJointPalette, texel + 1).xyz,
+                texelFetch(uJointPalette, texel + 2).xyz);
+}
+
 void main()
 {
     vec4 deformPos = vec4(0, 0, 0, 0);
     vec4 deformNor = vec4(0, 0, 0, 0);
-    for (int i = 0; i < vJointNum; ++i)
+    for (int i = 0; i < 4; ++i)
     {
-        int id = int(vJointWeights[i][0]);
-        float weight = vJointWeights[i][1];
-        deformPos += weight * uJointTransMats[id] * uBindMats[id] * vec4(vPos, 1);
-        deformNor += weight * transpose(inverse(uJointTransMats[id])) * transpose(inverse(uBindMats[id])) * vec4(vNor, 0);
+        float weight = vWeights[i];
+        if (weight == 0) { continue; }
+        int id = int(vJoints[i]);
+        deformPos += weight * (skinningMat(id) * vec4(vPos, 1));
+        deformNor += weight * vec4(normalMat(id) * vNor, 0);
     }
 
     vec4 modelPos = uModel * deformPos;
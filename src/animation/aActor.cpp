@@ -1,9 +1,11 @@
 #include "aActor.h"
+#include "aThreadPool.h"
 #include<iostream> 
 #include<algorithm> 
 
 #pragma warning(disable : 4018)
 
+int AActor::gIKThreads = 0;
 
 
 /****************************************************************
@@ -123,6 +125,38 @@ void AActor::updateGuideJoint(vec3 guideTargetPos)
 	m_pSkeleton->update();
 }
 
+// Frame with normal as its y axis and axis, projected onto the plane of normal, as its x axis
+static mat3 GroundFrame(const vec3& normal, const vec3& axis)
+{
+	vec3 yAxis = normal;
+	yAxis.Normalize();
+	vec3 xAxis = axis - (axis * yAxis) * yAxis;
+	xAxis.Normalize();
+	vec3 zAxis = xAxis.Cross(yAxis);
+	return mat3(xAxis, yAxis, zAxis).Transpose();
+}
+
+// Tilts the global rotation of foot from flat ground onto ground of the given normal, in skeleton space. The
+// foot keeps its heading: its axis furthest from both up vectors stays in the same vertical plane.
+static void OrientFoot(AJoint* foot, const vec3& normal)
+{
+	vec3 up(0, 1, 0);
+	vec3 n = normal;
+	if (n.Length() < 1.0e-6) return;
+	n.Normalize();
+	if (n * up > 1.0 - 1.0e-9) return;  // flat ground
+
+	mat3 rotation = foot->getGlobalRotation();
+	vec3 axis = rotation.GetCol(0);
+	for (int i = 1; i < 3; i++)
+	{
+		vec3 col = rotation.GetCol(i);
+		if (fabs(col * n) + fabs(col * up) < fabs(axis * n) + fabs(axis * up)) axis = col;
+	}
+	mat3 tilt = GroundFrame(n, axis) * GroundFrame(up, axis).Transpose();
+	foot->setGlobalRotation(tilt * rotation);
+}
+
 void AActor::solveFootIK(float leftHeight, float rightHeight, bool rotateLeft, bool rotateRight, vec3 leftNormal, vec3 rightNormal)
 {
 	if (!m_pSkeleton->getRootNode()) { return; }
@@ -141,38 +175,43 @@ void AActor::solveFootIK(float leftHeight, float rightHeight, bool rotateLeft, b
 	m_pSkeleton->update();
 
 	// 2.	Update the charter with Limb-based IK 
+	mat3 toSkeleton = m_Guide.getGlobalRotation().Transpose();  // the normals are in world space
 
 	// Rotate Foot
 	if (rotateLeft)
 	{
-		// Update the local orientation of the left foot based on the left normal
-
-		vec3 yAxis = leftNormal;
-		vec3 xAxis = leftFoot->getGlobalRotation()[0];
-		vec3 zAxis = yAxis.Cross(xAxis);
-		mat3 rotMat = mat3(xAxis, yAxis, zAxis).Transpose();
-		leftFoot->setGlobalRotation(rotMat);
-
 		ATarget lTarget;
 		vec3 lTarget_gPos = leftFoot->getGlobalTranslation();
 		lTarget.setGlobalTranslation(vec3(lTarget_gPos[0], lTarget_gPos[1] + leftHeight, lTarget_gPos[2]));
 		m_IKController->IKSolver_Limb(m_IKController->mLfootID, lTarget);
 
+		// Update the orientation of the left foot based on the left normal, after the limb solve that sets it
+		OrientFoot(leftFoot, toSkeleton * leftNormal);
+
 	}
 	if (rotateRight)
 	{
-		// Update the local orientation of the right foot based on the right normal
-
-		vec3 yAxis = rightNormal;
-		vec3 xAxis = rightFoot->getGlobalRotation()[0];
-		vec3 zAxis = yAxis.Cross(xAxis);
-		mat3 rotMat = mat3(xAxis, yAxis, zAxis).Transpose();
-		rightFoot->setGlobalRotation(rotMat);
-
 		ATarget rTarget;
 		vec3 rTarget_gPos = rightFoot->getGlobalTranslation();
 		rTarget.setGlobalTranslation(vec3(rTarget_gPos[0], rTarget_gPos[1] + rightHeight, rTarget_gPos[2]));
 		m_IKController->IKSolver_Limb(m_IKController->mRfootID, rTarget);
+
+		// Update the orientation of the right foot based on the right normal
+		OrientFoot(rightFoot, toSkeleton * rightNormal);
 	}
 	m_pSkeleton->update();
 }
+
+void AActor::SolveFootIKBatch(AActor* const* actors, const FootIKParams* params, int count)
+{
+	// Actors take a few microseconds each, so a handful per chunk keeps the shared counter out of the way
+	AThreadPool::Get().parallelFor(count, [actors, params](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			if (!actors[i]) continue;
+			const FootIKParams& p = params[i];
+			actors[i]->solveFootIK(p.leftHeight, p.rightHeight, p.rotateLeft, p.rotateRight, p.leftNormal, p.rightNormal);
+		}
+	}, 4, gIKThreads);
+}
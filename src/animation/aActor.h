@@ -44,6 +44,23 @@ public:
 		bool rotateLeft, bool rotateRight, 
 		vec3 leftNormal, vec3 rightNormal);
 
+	// Arguments of one solveFootIK call
+	struct FootIKParams
+	{
+		float leftHeight;
+		float rightHeight;
+		bool rotateLeft;
+		bool rotateRight;
+		vec3 leftNormal;
+		vec3 rightNormal;
+	};
+
+	// Calls actors[i]->solveFootIK with params[i] for count distinct actors, spread over the animation thread pool.
+	// Every actor is solved start to finish on one thread, so the results are the same as solving them one after
+	// the other. Null actors are skipped.
+	static void SolveFootIKBatch(AActor* const* actors, const FootIKParams* params, int count);
+	static int gIKThreads;	// threads SolveFootIKBatch uses, 0 for all of the pool
+
 protected:
 	// the actor owns the skeleton and controllers
 	ASkeleton* m_pSkeleton;
@@ -4,16 +4,49 @@
 #include <iostream>
 
 #include "aActor.h"
+#include "aMappedFile.h"
+#include "aThreadPool.h"
 
 
 #pragma warning(disable:4018)
 
+bool BVHController::gShareClips = true;
+bool BVHController::gUseClipCache = true;
+int BVHController::gLoadThreads = 0;
+
+// mat3::Rotation3D and mat3 multiplication for plain arrays, with the same arithmetic so that the results are
+// identical, but inlined. loadFrame spends most of its time converting Euler angles.
+static inline void AxisRotation(int axisID, double angleRad, double m[3][3])
+{
+	double axis[3] = { 0.0, 0.0, 0.0 };
+	axis[axisID] = 1.0;
+	double c = cos(angleRad), s = sin(angleRad), t = 1.0f - c;
+	m[0][0] = t * axis[0] * axis[0] + c;
+	m[0][1] = t * axis[0] * axis[1] - s * axis[2];
+	m[0][2] = t * axis[0] * axis[2] + s * axis[1];
+	m[1][0] = t * axis[0] * axis[1] + s * axis[2];
+	m[1][1] = t * axis[1] * axis[1] + c;
+	m[1][2] = t * axis[1] * axis[2] - s * axis[0];
+	m[2][0] = t * axis[0] * axis[2] - s * axis[1];
+	m[2][1] = t * axis[1] * axis[2] + s * axis[0];
+	m[2][2] = t * axis[2] * axis[2] + c;
+}
+
+static inline void MatrixProduct(const double a[3][3], const double b[3][3], double m[3][3])
+{
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			m[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+		}
+	}
+}
+
 BVHController::BVHController()
 {
 	mActor = NULL;
 	mSkeleton = NULL;
-	mFps = 120.0;
-	mDt = 0.008333;
 }
 
 BVHController::~BVHController()
@@ -25,8 +58,8 @@ void BVHController::clear()
 {
 	mFilename = "";
 	mSkeleton->clear();
-	mRootMotion.clear();
-	mMotion.clear();
+	mClip.reset();
+	mJointOverrides.clear();
 }
 
 ASkeleton* BVHController::getSkeleton()
@@ -56,44 +89,146 @@ void BVHController::update(double time, bool updateRootXZTranslation)
 	// 1. set the local transforms at each Skeleton joint using the cached spline data in member variables mRootMotion and mMotion 
 	// 2. update the joint transforms of the full skeleton in order to compute the global transforms at each joint
 	// Hint: the root can both rotate and translate (i.e. has 6 DOFs) while all the other joints just rotate 
-	AJoint* root = mSkeleton->getRootNode();
-	vec3 root_d = mRootMotion.getValue(time);
-	root->setLocalTranslation(root_d);
+	if (!mClip || !mSkeleton->getRootNode()) return;
+	const AMotionTracks& tracks = mClip->getTracks();
+
+	// The pose is set by joint ID, so that the joints of a skeleton instance are not created just for this
+	int rootID = mSkeleton->getRootNode()->getID();
+	vec3 root_d = mClip->getRootMotion().getValue(time);
+	mSkeleton->setLocalTranslation(rootID, root_d);
 
 	if (!updateRootXZTranslation) {
 		vec3 xz_d = vec3(0, root_d[1], 0);
-		root->setLocalTranslation(xz_d);
+		mSkeleton->setLocalTranslation(rootID, xz_d);
+	}
+
+	int numJoints = mSkeleton->getNumJoints();
+	if (tracks.isEmpty() || tracks.getNumTracks() < numJoints)
+	{
+		for (int i = 0; i < numJoints; i++) {
+			mSkeleton->setLocalRotation(i, quat(1.0, 0.0, 0.0, 0.0));
+		}
 	}
+	else
+	{
+		// Blend two adjacent rows of the packed track store
+		int frame0, frame1;
+		double u;
+		tracks.getFrameBlend(time, frame0, frame1, u);
+		const quat* row0 = tracks.getFrame(frame0);
+		const quat* row1 = tracks.getFrame(frame1);
+		bool beforeStart = time < tracks.getStartTime();
+		for (int i = 0; i < numJoints; i++) {
+			quat q = beforeStart ? row0[i] : quat::Slerp(row0[i], row1[i], u);
+			mSkeleton->setLocalRotation(i, q);
+		}
 
-	for (int i = 0; i < mSkeleton->getNumJoints(); i++) {
-		AJoint* joint = mSkeleton->getJointByID(i);
-		mat3 cachedRotate = mMotion[i].getCachedValue(time).ToRotation();
-		joint->setLocalRotation(cachedRotate);
+		// Edited joints play this controller's curve instead, sampled the same way
+		for (std::map<int, ASplineQuat>::const_iterator joint = mJointOverrides.begin(); joint != mJointOverrides.end(); ++joint) {
+			const ASplineQuat& curve = joint->second;
+			quat q = beforeStart ? curve.getCurvePoint(frame0) : quat::Slerp(curve.getCurvePoint(frame0), curve.getCurvePoint(frame1), u);
+			mSkeleton->setLocalRotation(joint->first, q);
+		}
 	}
 	mSkeleton->update();
 }
 
 bool BVHController::load(const std::string& filename)
 {
-	std::ifstream inFile(filename.c_str());
-	if (!inFile.is_open())
+	std::shared_ptr<const AMotionClip> clip = gShareClips ? AMotionClip::Find(filename) : NULL;
+	if (!clip)
+	{
+		bool status;
+		if (AMotionCache::IsCacheFilename(filename))
+		{
+			status = loadCache(filename, "");
+			if (!status) std::cout << "WARNING: Could not load " << filename.c_str() << std::endl;
+		}
+		else
+		{
+			status = (gUseClipCache && loadCache(AMotionCache::GetCacheFilename(filename), filename)) || loadText(filename);
+		}
+		clip = mNewClip;
+		mNewClip.reset();
+		if (!status) return false;
+		if (gShareClips) clip = AMotionClip::Share(clip);
+	}
+
+	setClip(clip);
+	mFilename = filename;
+	return true;
+}
+
+bool BVHController::loadText(const std::string& filename)
+{
+	AMappedFile file;
+	if (!file.open(filename))
 	{
 		std::cout << "WARNING: Could not open " << filename.c_str() << std::endl;
 		return false;
 	}
 
 	clear();
-	bool status = loadSkeleton(inFile) && loadMotion(inFile);
-
-	if (status)
+	mNewClip = std::make_shared<AMotionClip>();
+	mNewClip->setSource(filename, AMotionClip::Hash(file.getData(), file.getSize()));
+	ATextReader reader(file.getData(), file.getData() + file.getSize());
+	bool status = loadSkeleton(reader) && loadMotion(reader);
+	file.close();
+
+	// A failed write only means the next load parses the text again
+	if (status && gUseClipCache)
 	{
-		mFilename = filename;
+		AMotionCache::Write(AMotionCache::GetCacheFilename(filename), filename, mNewClip->getContentHash(), mSkeleton,
+			mNewClip->getFps(), mNewClip->getDt(), mNewClip->getRootMotion(), mNewClip->getMotion(), mNewClip->getTracks());
 	}
-	inFile.close();
 	return status;
 }
 
-bool BVHController::loadSkeleton(std::ifstream& inFile)
+bool BVHController::loadCache(const std::string& cacheFilename, const std::string& sourceFilename)
+{
+	std::shared_ptr<AMotionCache> cache = std::make_shared<AMotionCache>();
+	if (!cache->open(cacheFilename, sourceFilename))
+		return false;
+
+	clear();
+	mNewClip = std::make_shared<AMotionClip>();
+	const AMotionCache::Header& header = cache->getHeader();
+	// The rig and the root curve are read from the mapped records, the skeleton takes the rig in setClip
+	mNewClip->setDefinition(ASkeletonDef::Create(*cache));
+
+	mNewClip->setFrameTime(header.dt);
+	ASplineVec3& rootMotion = mNewClip->getRootMotion();
+	rootMotion.setFramerate(mNewClip->getFps());
+	rootMotion.setInterpolationType(ASplineVec3::LINEAR);
+	rootMotion.setMappedKeys(cache->getKeyTimes(), cache->getRootKeys(), header.numKeys,
+		cache->getRootCurve(), header.numRootSamples);
+
+	// Playback reads the rotation samples straight from the mapping. The per joint curves are only needed
+	// to edit keys, so AMotionClip::getJointCurve builds them from the mapped keys when a joint is edited.
+	mNewClip->getTracks().setSamples(cache->getSamples(), header.numJoints, header.numSamples,
+		header.startTime, header.sampleDt, header.looping != 0);
+	mNewClip->setCache(cache);
+	mNewClip->setSource(sourceFilename.empty() ? cacheFilename : sourceFilename, header.sourceHash);
+	return true;
+}
+
+void BVHController::setClip(const std::shared_ptr<const AMotionClip>& clip)
+{
+	// setDefinition also frees the joints the loader built
+	std::shared_ptr<const AMotionClip> newClip = clip;
+	mClip.reset();
+	mJointOverrides.clear();
+	mSkeleton->setDefinition(newClip->getDefinition());
+	mSkeleton->update();
+	mClip = newClip;
+}
+
+std::shared_ptr<const AMotionClip> BVHController::getClip() const
+{
+	return mClip;
+}
+
+bool BVHController::loadSkeleton(ATextReader& reader)
 {
 	clear();
 
@@ -102,43 +237,43 @@ bool BVHController::loadSkeleton(std::ifstream& inFile)
 	unsigned int channelCount;
 	ASkeleton* skeleton = mActor->getSkeleton();
 
-	inFile >> readString;
+	reader.readWord(readString);
 	if (readString != "HIERARCHY")
 		return false;
-	inFile >> readString;
+	reader.readWord(readString);
 	if (readString != "ROOT" && readString != "JOINT")
 		return false;
-	inFile.get(); //" "
-	getline(inFile, jointname);// jointnode name
+	reader.skipChar(); //" "
+	reader.readLine(jointname);// jointnode name
 	AJoint* jointnode = new AJoint(jointname);
 	skeleton->addJoint(jointnode, true);
-	inFile >> readString; // "{"
-	inFile >> readString; // "OFFSET"
-	inFile >> offsets[0] >> offsets[1] >> offsets[2];
+	reader.readWord(readString); // "{"
+	reader.readWord(readString); // "OFFSET"
+	reader.readDouble(offsets[0]); reader.readDouble(offsets[1]); reader.readDouble(offsets[2]);
 	jointnode->setLocalTranslation(offsets);
-	inFile >> readString;
+	reader.readWord(readString);
 	if (readString != "CHANNELS")
 		return false;
-	inFile >> channelCount;
+	reader.readUInt(channelCount);
 	jointnode->setNumChannels(channelCount);
-	getline(inFile, readString);	// " Xposition Yposition Zposition Zrotation Xrotation Yrotation"
+	reader.readLine(readString);	// " Xposition Yposition Zposition Zrotation Xrotation Yrotation"
 	jointnode->setRotationOrder(readString);
-	inFile >> readString;
+	reader.readWord(readString);
 	while (readString != "}")
 	{
-		if (!loadJoint(inFile, jointnode, readString))
+		if (!loadJoint(reader, jointnode, readString))
 		{
 			return false;
 		}
-		inFile >> readString;
+		reader.readWord(readString);
 	}
 	if (readString != "}") return false;
 
-	skeleton->update();
+	mNewClip->setDefinition(skeleton->getDefinition());
 	return true;
 }
 
-bool BVHController::loadJoint(std::ifstream &inFile, AJoint *pParent, std::string prefix)
+bool BVHController::loadJoint(ATextReader& reader, AJoint *pParent, std::string prefix)
 {
 	std::string readString, jointname;
 	vec3 offsets;
@@ -147,36 +282,36 @@ bool BVHController::loadJoint(std::ifstream &inFile, AJoint *pParent, std::strin
 
 	if (prefix == "JOINT")
 	{
-		inFile.get(); //" "
-		getline(inFile, jointname);// jointnode name
+		reader.skipChar(); //" "
+		reader.readLine(jointname);// jointnode name
 		AJoint* jointnode = new AJoint(jointname);
 
 		skeleton->addJoint(jointnode, false);
 		AJoint::Attach(pParent, jointnode);
-		inFile >> readString; // "{"
-		inFile >> readString; // "OFFSET"
-		inFile >> offsets[0] >> offsets[1] >> offsets[2];
+		reader.readWord(readString); // "{"
+		reader.readWord(readString); // "OFFSET"
+		reader.readDouble(offsets[0]); reader.readDouble(offsets[1]); reader.readDouble(offsets[2]);
 		jointnode->setLocalTranslation(offsets);
-		inFile >> readString; // "CHANNELS"
-		inFile >> channelCount;
+		reader.readWord(readString); // "CHANNELS"
+		reader.readUInt(channelCount);
 		jointnode->setNumChannels(channelCount);
 
-		getline(inFile, readString);// " Zrotation Xrotation Yrotation"
+		reader.readLine(readString);// " Zrotation Xrotation Yrotation"
 		jointnode->setRotationOrder(readString);
 
-		inFile >> readString; // "Joint" or "}" or "End"
+		reader.readWord(readString); // "Joint" or "}" or "End"
 		while (readString != "}")
 		{
-			if (loadJoint(inFile, jointnode, readString) == false)
+			if (loadJoint(reader, jointnode, readString) == false)
 				return false;
-			inFile >> readString; // "Joint" or "}" or "End"
+			reader.readWord(readString); // "Joint" or "}" or "End"
 		}
 		return true;
 	}
 	else if (prefix == "End")
 	{
-		inFile.get(); //" "
-		getline(inFile, jointname);// jointnode name
+		reader.skipChar(); //" "
+		reader.readLine(jointname);// jointnode name
 		if (jointname.find("Site") != std::string::npos)
 		{
 			jointname = pParent->getName() + "Site";
@@ -186,90 +321,144 @@ bool BVHController::loadJoint(std::ifstream &inFile, AJoint *pParent, std::strin
 		jointnode->setNumChannels(0);
 		skeleton->addJoint(jointnode, false);
 		AJoint::Attach(pParent, jointnode);
-		inFile >> readString; // "{"
-		inFile >> readString; // "OFFSET"
-		inFile >> offsets[0] >> offsets[1] >> offsets[2];
+		reader.readWord(readString); // "{"
+		reader.readWord(readString); // "OFFSET"
+		reader.readDouble(offsets[0]); reader.readDouble(offsets[1]); reader.readDouble(offsets[2]);
 		jointnode->setLocalTranslation(offsets);
-		inFile >> readString; // "}"
+		reader.readWord(readString); // "}"
 		return true;
 	}
 	else return false;
 }
 
-bool BVHController::loadMotion(std::ifstream& inFile)
+bool BVHController::loadMotion(ATextReader& reader)
 {
 	std::string readString;
 	unsigned int frameCount;
-	inFile >> readString;
+	reader.readWord(readString);
 	if (readString != "MOTION")
 		return false;
-	inFile >> readString;
+	reader.readWord(readString);
 	if (readString != "Frames:")
 		return false;
-	inFile >> frameCount;
-	inFile >> readString; // "Frame"
-	getline(inFile, readString); // " Time: 0.033333"
-	mDt = atof(&(readString.c_str()[6]));
-	mFps = 1.0 / mDt;
+	reader.readUInt(frameCount);
+	reader.readWord(readString); // "Frame"
+	reader.readLine(readString); // " Time: 0.033333"
+	double dt = 0.0;
+	if (readString.size() > 6)
+	{
+		ATextReader timeReader(readString.c_str() + 6, readString.c_str() + readString.size());
+		timeReader.readDouble(dt);
+	}
+	mNewClip->setFrameTime(dt);
+	double fps = mNewClip->getFps();
 
 	ASkeleton* skeleton = mActor->getSkeleton();
+	buildDecodePlan();
 	// Init rotation curves
+	ASplineVec3& rootMotion = mNewClip->getRootMotion();
+	std::vector<ASplineQuat>& motion = mNewClip->getMotion();
+	motion.resize(skeleton->getNumJoints());
 	for (unsigned int i = 0; i < skeleton->getNumJoints(); i++)
 	{
-		ASplineQuat q;
-		q.setFramerate(mFps);
-		q.setInterpolationType(ASplineQuat::LINEAR);
-		mMotion[i] = q;
+		motion[i].setFramerate(fps);
+		motion[i].setInterpolationType(ASplineQuat::LINEAR);
 	}
-	mRootMotion.setFramerate(mFps);
-	mRootMotion.setInterpolationType(ASplineVec3::LINEAR);
+	rootMotion.setFramerate(fps);
+	rootMotion.setInterpolationType(ASplineVec3::LINEAR);
 
 	// Read frames
 	for (unsigned int i = 0; i < frameCount; i++)
 	{
-		loadFrame(inFile);
+		loadFrame(reader);
 	}
 
-	mRootMotion.computeControlPoints();
-	mRootMotion.cacheCurve();
-	for (unsigned int i = 0; i < skeleton->getNumJoints(); i++)
+	// The curves are independent, each task only writes its own
+	int numJoints = skeleton->getNumJoints();
+	AThreadPool::Get().parallelFor(numJoints + 1, [&rootMotion, &motion](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			if (i == 0)
+			{
+				rootMotion.computeControlPoints();
+				rootMotion.cacheCurve();
+			}
+			else motion[i - 1].cacheCurve();
+		}
+	}, 1, gLoadThreads);
+	mNewClip->getTracks().build(motion, gLoadThreads);
+
+	// Playback only reads the packed tracks, the curves keep their keys for editing and for the .bvhc
+	for (unsigned int i = 0; i < motion.size(); i++)
 	{
-		mMotion[i].cacheCurve();
+		motion[i].releaseCurve();
 	}
 	return true;
 }
 
-void BVHController::loadFrame(std::ifstream& inFile)
+void BVHController::buildDecodePlan()
 {
-	float tx, ty, tz, r1, r2, r3;
-	double t = mDt * mRootMotion.getNumKeys();
-	ASkeleton* skeleton = mActor->getSkeleton();
-	for (unsigned int i = 0; i < skeleton->getNumJoints(); i++)
+	// Everything loadFrame would otherwise look up per joint and per frame
+	std::shared_ptr<const ASkeletonDef> definition = mActor->getSkeleton()->getDefinition();
+	mDecodePlan.resize(definition->getNumJoints());
+	for (int i = 0; i < definition->getNumJoints(); i++)
 	{
-		tx = ty = tz = 0.0f;
-		r1 = r2 = r3 = 0.0f;
-
-		AJoint* pJoint = skeleton->getJointByID(i);
-		if (pJoint->getNumChannels() == 6)
+		unsigned int numChannels = definition->getNumChannels(i);
+		ChannelDecode& decode = mDecodePlan[i];
+		decode.numChannels = numChannels == 6 || numChannels == 3 ? numChannels : 0;
+		decode.isRoot = definition->getRootID() == i;
+
+		// The three rotation values are applied in file order, e.g. "zxy" is Rz(r1) * Rx(r2) * Ry(r3)
+		const std::string& rotOrder = definition->getRotationOrder(i);
+		decode.isEuler = rotOrder == "xyz" || rotOrder == "xzy" || rotOrder == "yxz" ||
+			rotOrder == "yzx" || rotOrder == "zxy" || rotOrder == "zyx";
+		for (int k = 0; decode.isEuler && k < 3; k++)
 		{
-			inFile >> tx >> ty >> tz;
-			inFile >> r1 >> r2 >> r3;
+			decode.axis[k] = rotOrder[k] - 'x';
 		}
-		else if (pJoint->getNumChannels() == 3)
+
+		// Without rotation channels or a known order the rotation is the same on every frame
+		decode.rotation = ComputeBVHRot(0.0f, 0.0f, 0.0f, rotOrder);
+	}
+}
+
+void BVHController::loadFrame(ATextReader& reader)
+{
+	float values[6];
+	ASplineVec3& rootMotion = mNewClip->getRootMotion();
+	std::vector<ASplineQuat>& motion = mNewClip->getMotion();
+	double t = mNewClip->getDt() * rootMotion.getNumKeys();
+	for (unsigned int i = 0; i < mDecodePlan.size(); i++)
+	{
+		const ChannelDecode& decode = mDecodePlan[i];
+		for (int c = 0; c < decode.numChannels; c++)
 		{
-			inFile >> r1 >> r2 >> r3;
+			reader.readFloat(values[c]);
 		}
-		else
+		const float* r = decode.numChannels == 6 ? values + 3 : values;
+
+		if (decode.isRoot)
 		{
+			if (decode.numChannels == 6) rootMotion.appendKey(t, vec3(values[0], values[1], values[2]), false);
+			else rootMotion.appendKey(t, vec3(0.0f, 0.0f, 0.0f), false);
 		}
 
-		if (skeleton->getRootNode() == pJoint)
+		if (decode.numChannels == 0 || !decode.isEuler)
 		{
-			mRootMotion.appendKey(t, vec3(tx, ty, tz), false);
+			motion[i].appendKey(t, decode.rotation, false);
+			continue;
 		}
-
-		quat q = ComputeBVHRot(r1, r2, r3, pJoint->getRotationOrder());
-		mMotion[i].appendKey(t, q, false);
+		// Same product as mat3::FromEulerAngles
+		double r0[3][3], r1[3][3], r2[3][3], r01[3][3], m[3][3];
+		AxisRotation(decode.axis[0], r[0] * Deg2Rad, r0);
+		AxisRotation(decode.axis[1], r[1] * Deg2Rad, r1);
+		AxisRotation(decode.axis[2], r[2] * Deg2Rad, r2);
+		MatrixProduct(r0, r1, r01);
+		MatrixProduct(r01, r2, m);
+		quat q;
+		q.FromRotation(mat3(vec3(m[0][0], m[0][1], m[0][2]), vec3(m[1][0], m[1][1], m[1][2]), vec3(m[2][0], m[2][1], m[2][2])));
+		motion[i].appendKey(t, q, false);
 	}
 }
 
@@ -313,21 +502,30 @@ quat BVHController::ComputeBVHRot(float r1, float r2, float r3, const std::strin
 
 float BVHController::getDuration()
 {
-	return mRootMotion.getDuration();
+	return mClip ? mClip->getRootMotion().getDuration() : 0.0f;
 }
 
 int BVHController::getKeySize()
 {
-	return mRootMotion.getNumKeys();
+	return mClip ? mClip->getRootMotion().getNumKeys() : 0;
 }
 
 float BVHController::getKeyTime(int keyID)
 {
-	return mRootMotion.getKeyTime(keyID);
+	assert(mClip);
+	return mClip->getRootMotion().getKeyTime(keyID);
 }
 
 void BVHController::setJointRotationKey(int keyID, int jointID, quat newquat)
 {
 	assert(jointID < getSkeleton()->getNumJoints() && keyID < getKeySize());
-	mMotion[jointID].editKey(keyID, newquat);
+
+	// The shared clip is never changed, the first edit of a joint copies its curve
+	std::map<int, ASplineQuat>::iterator joint = mJointOverrides.find(jointID);
+	if (joint == mJointOverrides.end())
+	{
+		joint = mJointOverrides.insert(std::make_pair(jointID, ASplineQuat())).first;
+		mClip->getJointCurve(jointID, joint->second);
+	}
+	joint->second.editKey(keyID, newquat);
 }
@@ -5,14 +5,14 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
-#include <fstream>
 
 #include "aJoint.h"
 #include "aSkeleton.h"
 
-#include "aSplineVec3.h"
-#include "aSplineQuat.h"
+#include "aMotionClip.h"
+#include "aTextReader.h"
 
 
 class AActor;  // forward declaration since BVHController class references AActor and AActor class references BVHController
@@ -33,24 +33,47 @@ public:
 	float getDuration();
 	int getKeySize();
 	float getKeyTime(int keyID);
-	void setJointRotationKey(int keyID, int jointID, quat newquat);
+	void setJointRotationKey(int keyID, int jointID, quat newquat);	// edits this controller's copy of the joint curve
+
+	std::shared_ptr<const AMotionClip> getClip() const;	// clip data shared with the other controllers playing the file
+
+	// load() plays the clip another controller loaded from the same, unchanged file instead of reading it again
+	static bool gShareClips;
+	// load() maps the compiled clip (.bvhc) next to a .bvh if it is up to date, and writes one otherwise
+	static bool gUseClipCache;
+	// Threads that cache the joint curves of a clip while it loads, 0 for all the threads of AThreadPool::Get()
+	static int gLoadThreads;
 
 protected:
     virtual quat ComputeBVHRot(float r1, float r2, float r3, const std::string& rotOrder);
-    virtual bool loadSkeleton(std::ifstream &inFile);
-    virtual bool loadJoint(std::ifstream &inFile, AJoint *pParent, std::string prefix);
-    virtual bool loadMotion(std::ifstream &inFile);
-    virtual void loadFrame(std::ifstream& inFile);
+    virtual bool loadText(const std::string& filename);  // parses a .bvh into mNewClip
+    virtual bool loadSkeleton(ATextReader& reader);
+    virtual bool loadJoint(ATextReader& reader, AJoint *pParent, std::string prefix);
+    virtual bool loadMotion(ATextReader& reader);
+    virtual void loadFrame(ATextReader& reader);
+    virtual void buildDecodePlan();  // resolves the channel layout and rotation order of each joint for loadFrame
+    virtual bool loadCache(const std::string& cacheFilename, const std::string& sourceFilename);  // maps a .bvhc into mNewClip
+    virtual void setClip(const std::shared_ptr<const AMotionClip>& clip);  // plays clip on the actor skeleton
     virtual void clear();
 
 protected:
+    // How loadFrame reads the channels of one joint
+    struct ChannelDecode
+    {
+        int numChannels;       // values read per frame: 6 (translation, rotation), 3 (rotation) or 0
+        bool isRoot;           // its translation drives the root motion
+        bool isEuler;          // rotation order is one of the six Euler orders
+        int axis[3];           // 0, 1 or 2 (x, y or z) for each of the three rotation values, in file order
+        quat rotation;         // every frame's rotation if there are no rotation values or no Euler order
+    };
+
     std::string mFilename;
     AActor* mActor;
 	ASkeleton* mSkeleton;
-    double mFps;
-    double mDt;
-    ASplineVec3 mRootMotion;
-    std::map<int, ASplineQuat> mMotion;
+    std::shared_ptr<const AMotionClip> mClip;	// read-only, shared by the controllers playing the same file
+    std::shared_ptr<AMotionClip> mNewClip;	// clip being read by load()
+    std::map<int, ASplineQuat> mJointOverrides;	// curves of the joints edited through this controller, by joint ID
+    std::vector<ChannelDecode> mDecodePlan;	// per joint ID, built when the motion section is reached
 };
 
 #endif
\ No newline at end of file
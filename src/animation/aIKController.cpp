@@ -1,10 +1,14 @@
 #include "aIKController.h"
 #include "aActor.h"
+#include <algorithm>
+#include <cfloat>
 
 #pragma warning (disable : 4018)
 
 int IKController::gIKmaxIterations = 5;
 double IKController::gIKEpsilon = 0.1;
+double IKController::gIKDamping = 10.0;
+bool IKController::gIKWarmStart = true;
 
 // AIKchain class functions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -56,6 +60,7 @@ std::vector<double>& AIKchain::getWeights()
 void AIKchain::setChain(std::vector<AJoint*> chain)
 {
 	mChain = chain;
+	mOffsets.clear();
 }
 
 void AIKchain::setWeights(std::vector<double> weights)
@@ -63,6 +68,31 @@ void AIKchain::setWeights(std::vector<double> weights)
 	mWeights = weights;
 }
 
+std::vector<mat3>& AIKchain::getStartRotations()
+{
+	return mStartRotations;
+}
+
+std::vector<mat3>& AIKchain::getOffsets()
+{
+	return mOffsets;
+}
+
+std::vector<mat3>& AIKchain::getSolvedRotations()
+{
+	return mSolvedRotations;
+}
+
+double AIKchain::getLength()
+{
+	double length = 0.0;
+	for (int i = 0; i + 1 < mChain.size(); i++)
+	{
+		length += (mChain[i]->getGlobalTranslation() - mChain[i + 1]->getGlobalTranslation()).Length();
+	}
+	return length;
+}
+
 // AIKController class functions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -86,7 +116,10 @@ IKController::IKController()
 	mTarget1.setLocal2Global(desiredTarget);
 
 	//CCD IK
-	mWeight0 = 0.1;  // default joint rotation weight value
+	mWeight0 = 1.0;  // default joint rotation weight value, the fraction of the CCD step each joint takes
+
+	// the IK skeleton is only posed during a solve, see beginSubtreeSolve
+	mIKSkeleton.setScratchPose(true);
 
 }
 
@@ -134,21 +167,115 @@ AIKchain IKController::createIKchain(int endJointID, int desiredChainSize, ASkel
 	// desiredChainSize = -1 should create an IK chain of maximum length (where the last chain joint is the joint before the root joint)
 	// also add weight values to the associated AIKChain "weights" data member which can be used in a CCD IK implemention
 	AIKchain IKChain;
-	std::vector<AJoint*> chain;
-	std::vector<double> weights;
+	buildIKchain(IKChain, endJointID, desiredChainSize, pSkeleton);
+	return IKChain;
+}
+
+void IKController::buildIKchain(AIKchain& IKchain, int endJointID, int desiredChainSize, ASkeleton* pSkeleton)
+{
+	std::vector<AJoint*>& chain = IKchain.getChain();
+	std::vector<double>& weights = IKchain.getWeights();
 	AJoint* curr = pSkeleton->getJointByID(endJointID);
+	bool sameEnd = !chain.empty() && chain[0] == curr;
+	int oldSize = chain.size();
+	chain.clear();
+	weights.clear();
 
-	while (curr != pSkeleton->getRootNode() && desiredChainSize != 0) {
+	while (curr && curr != pSkeleton->getRootNode() && desiredChainSize != 0) {
 		chain.push_back(curr);
-		weights.push_back(0.1);
+		weights.push_back(mWeight0);
 		curr = curr->getParent();
 		desiredChainSize--;
 	}
 
-	IKChain.setChain(chain);
-	IKChain.setWeights(weights);
+	// the same chain built again keeps its warm start
+	if (!sameEnd || chain.size() != oldSize) IKchain.getOffsets().clear();
+}
 
-	return IKChain;
+void IKController::beginSubtreeSolve(int baseJointID)
+{
+	mSolveBaseID = baseJointID;
+	mIKSkeleton.beginScratchPose();
+	mIKSkeleton.copySubtreeTransforms(m_pSkeleton, mSolveBaseID);
+}
+
+void IKController::beginSubtreeSolve(AIKchain& IKchain)
+{
+	beginSubtreeSolve(IKchain.getSize() > 0 ? IKchain.getJoint(IKchain.getSize() - 1)->getID() : mRootID);
+}
+
+void IKController::endSubtreeSolve()
+{
+	// update IK Skeleton transforms
+	mIKSkeleton.updateDirtySubtree(mSolveBaseID);
+
+	// copy IK skeleton transforms to main skeleton
+	m_pSkeleton->copySubtreeTransforms(&mIKSkeleton, mSolveBaseID);
+	mIKSkeleton.endScratchPose();
+}
+
+void IKController::beginWarmStart(AIKchain& IKchain, ASkeleton* pIKSkeleton)
+{
+	std::vector<AJoint*>& chain = IKchain.getChain();
+	std::vector<mat3>& startRotations = IKchain.getStartRotations();
+	std::vector<mat3>& offsets = IKchain.getOffsets();
+	std::vector<mat3>& solvedRotations = IKchain.getSolvedRotations();
+	bool warm = gIKWarmStart && offsets.size() == chain.size();
+
+	// the pose the previous solve wrote back has not been animated since, so it already is the warm start
+	bool solved = warm;
+	for (int i = 0; i < chain.size() && solved; i++)
+	{
+		solved = chain[i]->getLocalRotation() == solvedRotations[i];
+	}
+	if (solved) return;
+
+	startRotations.resize(chain.size());
+	for (int i = 0; i < chain.size(); i++)
+	{
+		startRotations[i] = chain[i]->getLocalRotation();
+	}
+	if (!warm) return;
+
+	for (int i = chain.size() - 1; i >= 0; i--)
+	{
+		chain[i]->setLocalRotation(startRotations[i] * offsets[i]);
+		pIKSkeleton->updateJoint(chain[i]);
+	}
+}
+
+void IKController::endWarmStart(AIKchain& IKchain)
+{
+	std::vector<AJoint*>& chain = IKchain.getChain();
+	std::vector<mat3>& startRotations = IKchain.getStartRotations();
+	std::vector<mat3>& offsets = IKchain.getOffsets();
+	std::vector<mat3>& solvedRotations = IKchain.getSolvedRotations();
+	offsets.resize(chain.size());
+	solvedRotations.resize(chain.size());
+	for (int i = 0; i < chain.size(); i++)
+	{
+		solvedRotations[i] = chain[i]->getLocalRotation();
+		offsets[i] = startRotations[i].Transpose() * solvedRotations[i];
+	}
+}
+
+double IKController::getMinResidual(AIKchain& IKchain, const vec3& goal)
+{
+	// the chain cannot reach further than its length from its last joint, which the solve does not move
+	vec3 base = IKchain.getJoint(IKchain.getSize() - 1)->getGlobalTranslation();
+	return std::max(0.0, (goal - base).Length() - IKchain.getLength());
+}
+
+bool IKController::isIKDone(double residual, double lastResidual, double minResidual) const
+{
+	if (residual - minResidual <= gIKEpsilon) return true;
+	return minResidual > 0.0 && lastResidual - residual < gIKEpsilon;
+}
+
+void IKController::addIKStats(int iterations, double residual)
+{
+	mIKIterations += iterations;
+	mIKResidual = std::max(mIKResidual, residual);
 }
 
 
@@ -157,8 +284,8 @@ bool IKController::IKSolver_Limb(int endJointID, const ATarget& target)
 {
 	// Implements the analytic/geometric IK method assuming a three joint limb  
 
-	// copy transforms from base skeleton
-	mIKSkeleton.copyTransforms(m_pSkeleton);
+	mIKIterations = 0;
+	mIKResidual = 0.0;
 
 	if (!mvalidLimbIKchains || createLimbIKchains())
 	{
@@ -171,26 +298,31 @@ bool IKController::IKSolver_Limb(int endJointID, const ATarget& target)
 	if (endJointID == mLhandID)
 	{
 		mLhandTarget = target;
+		beginSubtreeSolve(mLhandIKchain);
 		computeLimbIK(mLhandTarget, mLhandIKchain, -axisY, &mIKSkeleton);
 	}
 	else if (endJointID == mRhandID)
 	{
 		mRhandTarget = target;
+		beginSubtreeSolve(mRhandIKchain);
 		computeLimbIK(mRhandTarget, mRhandIKchain, axisY, &mIKSkeleton);
 	}
 	else if (endJointID == mLfootID)
 	{
 		mLfootTarget = target;
+		beginSubtreeSolve(mLfootIKchain);
 		computeLimbIK(mLfootTarget, mLfootIKchain, axisX, &mIKSkeleton);
 	}
 	else if (endJointID == mRfootID)
 	{
 		mRfootTarget = target;
+		beginSubtreeSolve(mRfootIKchain);
 		computeLimbIK(mRfootTarget, mRfootIKchain, axisX, &mIKSkeleton);
 	}
 	else if (endJointID == mRootID)
 	{
 		desiredRootPosition = target.getGlobalTranslation();
+		beginSubtreeSolve(mRootID);
 		mIKSkeleton.getJointByID(mRootID)->setLocalTranslation(desiredRootPosition);
 		mIKSkeleton.update();
 		computeLimbIK(mLhandTarget, mLhandIKchain, -axisY, &mIKSkeleton);
@@ -200,17 +332,14 @@ bool IKController::IKSolver_Limb(int endJointID, const ATarget& target)
 	}
 	else
 	{
-		mIKchain = createIKchain(endJointID, 3, &mIKSkeleton);
+		buildIKchain(mIKchain, endJointID, 3, &mIKSkeleton);
+		beginSubtreeSolve(mIKchain);
 		computeLimbIK(target, mIKchain, axisY, &mIKSkeleton);
 	}
 
-	// update IK Skeleton transforms
-	mIKSkeleton.update();
+	endSubtreeSolve();
 
-	// copy IK skeleton transforms to main skeleton
-	m_pSkeleton->copyTransforms(&mIKSkeleton);
-
-	return true;
+	return mIKResidual <= gIKEpsilon;
 }
 
 
@@ -221,21 +350,20 @@ int IKController::createLimbIKchains()
 	int desiredChainSize = 3;
 
 	// create IK chains for Lhand, Rhand, Lfoot and Rfoot 
-	mLhandIKchain = createIKchain(mLhandID, desiredChainSize, &mIKSkeleton);
-	mRhandIKchain = createIKchain(mRhandID, desiredChainSize, &mIKSkeleton);
-	mLfootIKchain = createIKchain(mLfootID, desiredChainSize, &mIKSkeleton);
-	mRfootIKchain = createIKchain(mRfootID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mLhandIKchain, mLhandID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mRhandIKchain, mRhandID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mLfootIKchain, mLfootID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mRfootIKchain, mRfootID, desiredChainSize, &mIKSkeleton);
 
 	if (mLhandIKchain.getSize() == 3 && mRhandIKchain.getSize() == 3 && mLfootIKchain.getSize() == 3 && mRfootIKchain.getSize() == 3)
 	{
 		validChains = true;
 
 		// initalize end joint target transforms for Lhand, Rhand, Lfoot and Rfoot based on current position and orientation of joints
-		mIKSkeleton.copyTransforms(m_pSkeleton);
-		mLhandTarget.setLocal2Global(mIKSkeleton.getJointByID(mLhandID)->getLocal2Global());
-		mRhandTarget.setLocal2Global(mIKSkeleton.getJointByID(mRhandID)->getLocal2Global());
-		mLfootTarget.setLocal2Global(mIKSkeleton.getJointByID(mLfootID)->getLocal2Global());
-		mRfootTarget.setLocal2Global(mIKSkeleton.getJointByID(mRfootID)->getLocal2Global());
+		mLhandTarget.setLocal2Global(m_pSkeleton->getJointByID(mLhandID)->getLocal2Global());
+		mRhandTarget.setLocal2Global(m_pSkeleton->getJointByID(mRhandID)->getLocal2Global());
+		mLfootTarget.setLocal2Global(m_pSkeleton->getJointByID(mLfootID)->getLocal2Global());
+		mRfootTarget.setLocal2Global(m_pSkeleton->getJointByID(mRfootID)->getLocal2Global());
 	}
 
 	return validChains;
@@ -262,26 +390,47 @@ int IKController::computeLimbIK(ATarget target, AIKchain& IKchain, const vec3 mi
 	vec3 t = pd - p_start;
 
 	double l1 = (p_mid - p_start).Length();
-	double l2 = (pd - p_mid).Length();
-	vec3 rd = (p_end - p_start);
-
-	double phi = acos((l1*l1 + l2 * l2 - t.Length() * t.Length()) / (2.0 * l1 * l2));
-	double theta2 = M_PI - phi;
+	double l2 = (p_end - p_mid).Length();
+
+	// bend the middle joint, in the plane the limb is already bent in, until the end joint is as far from the
+	// start joint as the target is. A target out of reach straightens the limb.
+	double d = std::max(fabs(l1 - l2), std::min(l1 + l2, t.Length()));
+	double phi = acos(std::max(-1.0, std::min(1.0, (l1 * l1 + l2 * l2 - d * d) / (2.0 * l1 * l2))));
+	double phiCurrent = acos(std::max(-1.0, std::min(1.0, Dot(p_start - p_mid, p_end - p_mid) / (l1 * l2))));
+	vec3 bendAxis = (p_start - p_mid).Cross(p_end - p_mid);
+	if (bendAxis.Length() > DBL_EPSILON)
+	{
+		bendAxis = midJoint->getGlobalRotation().Transpose() * (bendAxis / bendAxis.Length());
+	}
+	else
+	{
+		// a straight limb bends about midJointAxis
+		bendAxis = -midJointAxis;
+	}
 
-	// set elbow joint to theta2
 	mat3 midJointRot = mat3();
-	midJointRot.FromAxisAngle(midJointAxis, theta2);
-	midJoint->setLocalRotation(midJointRot);
+	midJointRot.FromAxisAngle(bendAxis, phi - phiCurrent);
+	midJoint->setLocalRotation(midJoint->getLocalRotation() * midJointRot);
+	pIKSkeleton->updateJoint(midJoint);
+	pIKSkeleton->updateJoint(endJoint);
+	vec3 rd = endJoint->getGlobalTranslation() - p_start;
 
 	// compute angle at joint 1 to orient rd to target
-	double alpha = acos(Dot(t, rd) / (t.Length() * rd.Length()));
-	vec3 axis = (rd.Cross(t) / (rd.Cross(t).Length()));
+	double alpha = acos(std::max(-1.0, std::min(1.0, Dot(t, rd) / (t.Length() * rd.Length()))));
+	vec3 axis = rd.Cross(t);
+	if (axis.Length() > DBL_EPSILON)
+	{
+		axis = axis / axis.Length();
+		mat3 startJointRot = mat3();
+		startJointRot.FromAxisAngle(startJoint->getGlobalRotation().Transpose() * axis, alpha);
+		startJoint->setLocalRotation(startJoint->getLocalRotation() * startJointRot);
+	}
 
-	mat3 startJointRot = mat3();
-	startJointRot.FromAxisAngle(startJoint->getGlobalRotation().Transpose() * axis, alpha);
-	startJoint->setLocalRotation(startJoint->getLocalRotation() * startJointRot);
+	// only the limb below the start joint moved
+	pIKSkeleton->updateSubtree(startJoint);
 
-	m_pSkeleton->update();
+	// closed form, so a single iteration
+	addIKStats(1, (pd - endJoint->getGlobalTranslation()).Length());
 
 	return true;
 }
@@ -291,6 +440,8 @@ bool IKController::IKSolver_CCD(int endJointID, const ATarget& target)
 	// Implements the CCD IK method assuming a three joint limb 
 
 	bool validChains = false;
+	mIKIterations = 0;
+	mIKResidual = 0.0;
 
 	if (!mvalidCCDIKchains)
 	{
@@ -298,55 +449,58 @@ bool IKController::IKSolver_CCD(int endJointID, const ATarget& target)
 		assert(mvalidCCDIKchains);
 	}
 
-	// copy transforms from base skeleton
-	mIKSkeleton.copyTransforms(m_pSkeleton);
-
 	vec3 desiredRootPosition;
 
-
 	if (endJointID == mLhandID)
 	{
 		mLhandTarget = target;
+		beginSubtreeSolve(mLhandIKchain);
 		computeCCDIK(mLhandTarget, mLhandIKchain, &mIKSkeleton);
 	}
 	else if (endJointID == mRhandID)
 	{
 		mRhandTarget = target;
+		beginSubtreeSolve(mRhandIKchain);
 		computeCCDIK(mRhandTarget, mRhandIKchain, &mIKSkeleton);
 	}
 	else if (endJointID == mLfootID)
 	{
 		mLfootTarget = target;
+		beginSubtreeSolve(mLfootIKchain);
 		computeCCDIK(mLfootTarget, mLfootIKchain, &mIKSkeleton);
 	}
 	else if (endJointID == mRfootID)
 	{
 		mRfootTarget = target;
+		beginSubtreeSolve(mRfootIKchain);
 		computeCCDIK(mRfootTarget, mRfootIKchain, &mIKSkeleton);
 	}
 	else if (endJointID == mRootID)
 	{
 		desiredRootPosition = target.getGlobalTranslation();
+		beginSubtreeSolve(mRootID);
 		mIKSkeleton.getJointByID(mRootID)->setLocalTranslation(desiredRootPosition);
 		mIKSkeleton.update();
-		computeCCDIK(mLhandTarget, mLhandIKchain, &mIKSkeleton);
-		computeCCDIK(mRhandTarget, mRhandIKchain, &mIKSkeleton);
-		computeCCDIK(mLfootTarget, mLfootIKchain, &mIKSkeleton);
-		computeCCDIK(mRfootTarget, mRfootIKchain, &mIKSkeleton);
+
+		// the hand chains share the spine, so the four chains are swept together rather than one after the other
+		mNumEffectors = 0;
+		addEffector(mLhandID, mLhandTarget, &mIKSkeleton);
+		addEffector(mRhandID, mRhandTarget, &mIKSkeleton);
+		addEffector(mLfootID, mLfootTarget, &mIKSkeleton);
+		addEffector(mRfootID, mRfootTarget, &mIKSkeleton);
+		buildMultiIKchain(&mIKSkeleton);
+		computeMultiCCDIK(&mIKSkeleton);
 	}
 	else
 	{
-		mIKchain = createIKchain(endJointID, -1, &mIKSkeleton);
+		buildIKchain(mIKchain, endJointID, -1, &mIKSkeleton);
+		beginSubtreeSolve(mIKchain);
 		computeCCDIK(target, mIKchain, &mIKSkeleton);
 	}
 
-	// update IK Skeleton transforms
-	mIKSkeleton.update();
-
-	// copy IK skeleton transforms to main skeleton
-	m_pSkeleton->copyTransforms(&mIKSkeleton);
+	endSubtreeSolve();
 
-	return true;
+	return mIKResidual <= gIKEpsilon;
 }
 
 int IKController::createCCDIKchains()
@@ -357,28 +511,27 @@ int IKController::createCCDIKchains()
 
 
 	// create IK chains for Lhand, Rhand, Lfoot and Rfoot 
-	mLhandIKchain = createIKchain(mLhandID, desiredChainSize, &mIKSkeleton);
-	mRhandIKchain = createIKchain(mRhandID, desiredChainSize, &mIKSkeleton);
-	mLfootIKchain = createIKchain(mLfootID, desiredChainSize, &mIKSkeleton);
-	mRfootIKchain = createIKchain(mRfootID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mLhandIKchain, mLhandID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mRhandIKchain, mRhandID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mLfootIKchain, mLfootID, desiredChainSize, &mIKSkeleton);
+	buildIKchain(mRfootIKchain, mRfootID, desiredChainSize, &mIKSkeleton);
 
 	if (mLhandIKchain.getSize() > 1 && mRhandIKchain.getSize() > 1 && mLfootIKchain.getSize() > 1 && mRfootIKchain.getSize() > 1)
 	{
 		validChains = true;
 
 		// initalize end joint target transforms for Lhand, Rhand, Lfoot and Rfoot based on current position and orientation of joints
-		mIKSkeleton.copyTransforms(m_pSkeleton);
-		mLhandTarget.setLocal2Global(mIKSkeleton.getJointByID(mLhandID)->getLocal2Global());
-		mRhandTarget.setLocal2Global(mIKSkeleton.getJointByID(mRhandID)->getLocal2Global());
-		mLfootTarget.setLocal2Global(mIKSkeleton.getJointByID(mLfootID)->getLocal2Global());
-		mRfootTarget.setLocal2Global(mIKSkeleton.getJointByID(mRfootID)->getLocal2Global());
+		mLhandTarget.setLocal2Global(m_pSkeleton->getJointByID(mLhandID)->getLocal2Global());
+		mRhandTarget.setLocal2Global(m_pSkeleton->getJointByID(mRhandID)->getLocal2Global());
+		mLfootTarget.setLocal2Global(m_pSkeleton->getJointByID(mLfootID)->getLocal2Global());
+		mRfootTarget.setLocal2Global(m_pSkeleton->getJointByID(mRfootID)->getLocal2Global());
 	}
 
 	return validChains;
 }
 
 
-int IKController::computeCCDIK(ATarget target, AIKchain& IKchain, ASkeleton* pIKSkeleton)
+int IKController::computeCCDIK(const ATarget& target, AIKchain& IKchain, ASkeleton* pIKSkeleton)
 {
 
 	// TODO: Implement CCD IK  
@@ -392,33 +545,48 @@ int IKController::computeCCDIK(ATarget target, AIKchain& IKchain, ASkeleton* pIK
 	// 4. set local rotation matrix to new value
 	// 5. update transforms for joint and all children
 
-	std::vector<AJoint*> chain = IKchain.getChain();
-	std::vector<double> weights = IKchain.getWeights();
+	const std::vector<AJoint*>& chain = IKchain.getChain();
+	const std::vector<double>& weights = IKchain.getWeights();
 	AJoint* endJoint = IKchain.getJoint(0);
+	vec3 goal = target.getGlobalTranslation();
 
-	vec3 e = target.getGlobalTranslation() - endJoint->getGlobalTranslation();
-
-	for (int i = 0; i < 4; i++) {
-		if (e.Length() < DBL_EPSILON) {
-			break;
-		}
+	beginWarmStart(IKchain, pIKSkeleton);
+	double minResidual = getMinResidual(IKchain, goal);
+	double residual = (goal - endJoint->getGlobalTranslation()).Length();
+	double lastResidual = DBL_MAX;
+	int iterations = 0;
 
+	while (iterations < gIKmaxIterations && !isIKDone(residual, lastResidual, minResidual)) {
 		for (int i = 1; i < chain.size(); i++) {
 			vec3 r = endJoint->getGlobalTranslation() - chain[i]->getGlobalTranslation();
-			double angle = weights[i] * (r.Cross(e).Length() / (Dot(r, r) + Dot(r, e)));
-			vec3 axis = r.Cross(e) / (r.Cross(e).Length());
-			e = target.getGlobalTranslation() - endJoint->getGlobalTranslation();
+			vec3 e = goal - endJoint->getGlobalTranslation();
+			vec3 axis = r.Cross(e);
+			double sine = axis.Length();
+			if (sine < DBL_EPSILON) continue;
+			// angle between r and the vector from the joint to the goal
+			double angle = weights[i] * atan2(sine, Dot(r, r) + Dot(r, e));
+			axis = axis / sine;
 
 			mat3 rot;
 			rot.FromAxisAngle(chain[i]->getGlobalRotation().Transpose() * axis, angle);
 			chain[i]->setLocalRotation(chain[i]->getLocalRotation() * rot);
-			chain[i]->updateTransform();
+
+			// the next step only looks at the chain, the rest of the limb is updated once at the end
+			for (int j = i; j >= 0; j--)
+			{
+				pIKSkeleton->updateJoint(chain[j]);
+			}
 		}
+		lastResidual = residual;
+		residual = (goal - endJoint->getGlobalTranslation()).Length();
+		iterations++;
 	}
+	pIKSkeleton->updateDirtySubtree(chain.back()->getID());
 
-	pIKSkeleton->update();
+	endWarmStart(IKchain);
+	addIKStats(iterations, residual);
 
-	return true;
+	return iterations;
 }
 
 
@@ -426,12 +594,458 @@ bool IKController::IKSolver_PseudoInv(int endJointID, const ATarget& target)
 {
 	// TODO: Implement Pseudo Inverse-based IK  
 	// The actual position of the end joint should match the target position after the skeleton is updated with the new joint angles
-	return true;
+
+	// Damped least squares: dTheta = J^T (J J^T + lambda^2 I)^-1 e
+	// J J^T is only 3x3, so each iteration costs one small solve no matter how long the chain is
+
+	// rebuild the chain into the same vectors every call, so it stays valid if the IK skeleton hierarchy is
+	// recopied without reallocating
+	buildIKchain(mPseudoInvIKchain, endJointID, -1, &mIKSkeleton);
+	std::vector<AJoint*>& chain = mPseudoInvIKchain.getChain();
+
+	mIKIterations = 0;
+	mIKResidual = 0.0;
+	if (chain.size() < 2) return false;
+	beginSubtreeSolve(mPseudoInvIKchain);
+	beginWarmStart(mPseudoInvIKchain, &mIKSkeleton);
+
+	// the workspace only grows, so solving chains of different lengths in turn does not reallocate it
+	int numDOFs = 3 * (chain.size() - 1);
+	if (mJacobian.cols() < numDOFs)
+	{
+		mJacobian.resize(3, numDOFs);
+		mDeltaTheta.resize(numDOFs);
+	}
+	Eigen::MatrixXd::ColsBlockXpr jacobian = mJacobian.leftCols(numDOFs);
+	Eigen::VectorXd::SegmentReturnType deltaTheta = mDeltaTheta.head(numDOFs);
+
+	AJoint* endJoint = chain[0];
+	AJoint* baseJoint = chain.back();
+	vec3 goal = target.getGlobalTranslation();
+	vec3 e = goal - endJoint->getGlobalTranslation();
+	double minResidual = getMinResidual(mPseudoInvIKchain, goal);
+	double residual = e.Length();
+	double lastResidual = DBL_MAX;
+	int iterations = 0;
+
+	while (iterations < gIKmaxIterations && !isIKDone(residual, lastResidual, minResidual))
+	{
+		// the linearization only holds near the current pose, so far targets are approached in bounded steps
+		vec3 pEnd = endJoint->getGlobalTranslation();
+		double maxStep = 0.2 * (pEnd - baseJoint->getGlobalTranslation()).Length();
+		if (residual > maxStep) e = e * (maxStep / residual);
+
+		// column k of joint i is axis_k x r, r being the vector from joint i to the end joint
+		for (int i = 1; i < chain.size(); i++)
+		{
+			vec3 r = pEnd - chain[i]->getGlobalTranslation();
+			int c = 3 * (i - 1);
+			jacobian(0, c) = 0.0;     jacobian(1, c) = -r[2];     jacobian(2, c) = r[1];
+			jacobian(0, c + 1) = r[2]; jacobian(1, c + 1) = 0.0;   jacobian(2, c + 1) = -r[0];
+			jacobian(0, c + 2) = -r[1]; jacobian(1, c + 2) = r[0]; jacobian(2, c + 2) = 0.0;
+		}
+
+		// lazyProduct keeps Eigen from allocating blocking workspace for the products
+		mJJt.noalias() = jacobian.lazyProduct(jacobian.transpose());
+		mJJt.diagonal().array() += gIKDamping * gIKDamping;
+		Eigen::Vector3d y = mJJt.ldlt().solve(Eigen::Vector3d(e[0], e[1], e[2]));
+		deltaTheta.noalias() = jacobian.transpose().lazyProduct(y);
+
+		// dTheta holds global angular changes; express each axis in the joint frame like the CCD solver does
+		for (int i = 1; i < chain.size(); i++)
+		{
+			int c = 3 * (i - 1);
+			vec3 w(deltaTheta[c], deltaTheta[c + 1], deltaTheta[c + 2]);
+			double angle = w.Length();
+			if (angle < DBL_EPSILON) continue;
+
+			mat3 rot;
+			rot.FromAxisAngle(chain[i]->getGlobalRotation().Transpose() * (w / angle), angle);
+			chain[i]->setLocalRotation(chain[i]->getLocalRotation() * rot);
+		}
+		for (int i = chain.size() - 1; i >= 0; i--)
+		{
+			mIKSkeleton.updateJoint(chain[i]);
+		}
+
+		e = goal - endJoint->getGlobalTranslation();
+		lastResidual = residual;
+		residual = e.Length();
+		iterations++;
+	}
+	mIKSkeleton.updateDirtySubtree(baseJoint->getID());
+
+	endWarmStart(mPseudoInvIKchain);
+	addIKStats(iterations, residual);
+	endSubtreeSolve();
+
+	return mIKResidual <= gIKEpsilon;
+}
+
+int IKController::getIKIterations() const
+{
+	return mIKIterations;
+}
+
+double IKController::getIKResidual() const
+{
+	return mIKResidual;
 }
 
 bool IKController::IKSolver_Other(int endJointID, const ATarget& target)
 {
 	// TODO: Put Optional IK implementation or enhancements here
 
+	// FABRIK: each iteration pins the end joint to the target and pulls every joint towards it keeping the bone
+	// lengths, then pins the base joint back and pushes the chain out again. Only positions move, so there is no
+	// trig until the positions are turned back into local rotations once at the end.
+	buildIKchain(mFabrikIKchain, endJointID, -1, &mIKSkeleton);
+	std::vector<AJoint*>& chain = mFabrikIKchain.getChain();
+
+	mIKIterations = 0;
+	mIKResidual = 0.0;
+	if (chain.size() < 2) return false;
+	beginSubtreeSolve(mFabrikIKchain);
+	beginWarmStart(mFabrikIKchain, &mIKSkeleton);
+
+	int n = chain.size();
+	std::vector<vec3>& p = mFabrikPositions;
+	std::vector<double>& lengths = mFabrikLengths;
+	p.resize(n);
+	lengths.resize(n - 1);
+	for (int i = 0; i < n; i++)
+	{
+		p[i] = chain[i]->getGlobalTranslation();
+	}
+	for (int i = 0; i < n - 1; i++)
+	{
+		lengths[i] = (p[i] - p[i + 1]).Length();
+	}
+
+	AJoint* endJoint = chain[0];
+	AJoint* baseJoint = chain.back();
+	vec3 goal = target.getGlobalTranslation();
+	vec3 base = p[n - 1];
+	double minResidual = getMinResidual(mFabrikIKchain, goal);
+	double residual = (goal - p[0]).Length();
+	double lastResidual = DBL_MAX;
+	int iterations = 0;
+
+	while (iterations < gIKmaxIterations && !isIKDone(residual, lastResidual, minResidual))
+	{
+		p[0] = goal;
+		for (int i = 1; i < n; i++)
+		{
+			vec3 bone = p[i] - p[i - 1];
+			double length = bone.Length();
+			if (length > DBL_EPSILON) p[i] = p[i - 1] + bone * (lengths[i - 1] / length);
+		}
+		p[n - 1] = base;
+		for (int i = n - 2; i >= 0; i--)
+		{
+			vec3 bone = p[i] - p[i + 1];
+			double length = bone.Length();
+			if (length > DBL_EPSILON) p[i] = p[i + 1] + bone * (lengths[i] / length);
+		}
+		lastResidual = residual;
+		residual = (goal - p[0]).Length();
+		iterations++;
+	}
+
+	// base to end, turn each bone from where it points now to where the solve put its child
+	for (int i = n - 1; i >= 1; i--)
+	{
+		vec3 current = chain[i]->getGlobalRotation() * chain[i - 1]->getLocalTranslation();
+		vec3 desired = p[i - 1] - chain[i]->getGlobalTranslation();
+		vec3 axis = current.Cross(desired);
+		double sine = axis.Length();
+		if (sine > DBL_EPSILON)
+		{
+			mat3 rot;
+			rot.FromAxisAngle(chain[i]->getGlobalRotation().Transpose() * (axis / sine), atan2(sine, Dot(current, desired)));
+			chain[i]->setLocalRotation(chain[i]->getLocalRotation() * rot);
+		}
+		mIKSkeleton.updateJoint(chain[i]);
+		mIKSkeleton.updateJoint(chain[i - 1]);
+	}
+	mIKSkeleton.updateDirtySubtree(baseJoint->getID());
+
+	endWarmStart(mFabrikIKchain);
+	addIKStats(iterations, (goal - endJoint->getGlobalTranslation()).Length());
+	endSubtreeSolve();
+
+	return mIKResidual <= gIKEpsilon;
+}
+
+// true if joint aboveID is an ancestor of joint belowID
+static bool isAbove(const ASkeletonDef& def, int aboveID, int belowID)
+{
+	int above = def.getFKIndex()[aboveID];
+	int below = def.getFKIndex()[belowID];
+	return above >= 0 && above < below && below < def.getSubtreeEnd()[above];
+}
+
+bool IKController::IKSolver_Multi(const std::vector<int>& endJointIDs, const std::vector<ATarget>& targets)
+{
+	assert(endJointIDs.size() == targets.size());
+
+	mIKIterations = 0;
+	mIKResidual = 0.0;
+	beginSubtreeSolve(mRootID);
+
+	bool moveRoot = false;
+	mNumEffectors = 0;
+	for (int i = 0; i < endJointIDs.size(); i++)
+	{
+		int endJointID = endJointIDs[i];
+		if (endJointID == mRootID)
+		{
+			mIKSkeleton.getJointByID(mRootID)->setLocalTranslation(targets[i].getGlobalTranslation());
+			moveRoot = true;
+			continue;
+		}
+
+		if (endJointID == mLhandID) mLhandTarget = targets[i];
+		else if (endJointID == mRhandID) mRhandTarget = targets[i];
+		else if (endJointID == mLfootID) mLfootTarget = targets[i];
+		else if (endJointID == mRfootID) mRfootTarget = targets[i];
+		addEffector(endJointID, targets[i], &mIKSkeleton);
+	}
+
+	if (moveRoot)
+	{
+		mIKSkeleton.update();
+		const int limbIDs[] = { mLhandID, mRhandID, mLfootID, mRfootID };
+		const ATarget* limbTargets[] = { &mLhandTarget, &mRhandTarget, &mLfootTarget, &mRfootTarget };
+		for (int i = 0; i < 4; i++)
+		{
+			if (std::find(endJointIDs.begin(), endJointIDs.end(), limbIDs[i]) == endJointIDs.end())
+			{
+				addEffector(limbIDs[i], *limbTargets[i], &mIKSkeleton);
+			}
+		}
+	}
+
+	buildMultiIKchain(&mIKSkeleton);
+	computeMultiPseudoInvIK(&mIKSkeleton);
+	endSubtreeSolve();
+
+	return mIKResidual <= gIKEpsilon;
+}
+
+void IKController::addEffector(int endJointID, const ATarget& target, ASkeleton* pIKSkeleton)
+{
+	if (mNumEffectors == mEffectors.size()) mEffectors.resize(mNumEffectors + 1);
+	Effector& effector = mEffectors[mNumEffectors];
+	buildIKchain(effector.chain, endJointID, -1, pIKSkeleton);
+	if (effector.chain.getSize() == 0) return;  // the root or not a joint
+
+	effector.target = target;
+	mNumEffectors++;
+}
+
+void IKController::buildMultiIKchain(ASkeleton* pIKSkeleton)
+{
+	mMultiDefinition = pIKSkeleton->getDefinition();
+	const std::vector<int>& fkIndex = mMultiDefinition->getFKIndex();
+
+	mMultiJoints.clear();
+	for (int i = 0; i < mNumEffectors; i++)
+	{
+		std::vector<AJoint*>& chain = mEffectors[i].chain.getChain();
+		mMultiJoints.insert(mMultiJoints.end(), chain.begin(), chain.end());
+	}
+	std::sort(mMultiJoints.begin(), mMultiJoints.end(),
+		[&](AJoint* a, AJoint* b) { return fkIndex[a->getID()] > fkIndex[b->getID()]; });
+	mMultiJoints.erase(std::unique(mMultiJoints.begin(), mMultiJoints.end()), mMultiJoints.end());
+
+	// the same union built again keeps its warm start
+	std::vector<AJoint*>& chain = mMultiIKchain.getChain();
+	if (mMultiJoints != chain)
+	{
+		chain.swap(mMultiJoints);
+		mMultiIKchain.getWeights().assign(chain.size(), mWeight0);
+		mMultiIKchain.getOffsets().clear();
+	}
+}
+
+bool IKController::isMultiIKDone() const
+{
+	for (int i = 0; i < mNumEffectors; i++)
+	{
+		const Effector& effector = mEffectors[i];
+		if (!isIKDone(effector.residual, effector.lastResidual, effector.minResidual)) return false;
+	}
 	return true;
-}
\ No newline at end of file
+}
+
+void IKController::updateEffectorResiduals()
+{
+	for (int i = 0; i < mNumEffectors; i++)
+	{
+		Effector& effector = mEffectors[i];
+		effector.lastResidual = effector.residual;
+		effector.residual = (effector.target.getGlobalTranslation() - effector.chain.getJoint(0)->getGlobalTranslation()).Length();
+	}
+}
+
+void IKController::addEffectorStats(int iterations)
+{
+	addIKStats(iterations, 0.0);
+	for (int i = 0; i < mNumEffectors; i++)
+	{
+		addIKStats(0, mEffectors[i].residual);
+	}
+}
+
+int IKController::computeMultiCCDIK(ASkeleton* pIKSkeleton)
+{
+	std::vector<AJoint*>& joints = mMultiIKchain.getChain();
+	const ASkeletonDef& def = *mMultiDefinition;
+
+	beginWarmStart(mMultiIKchain, pIKSkeleton);
+	for (int i = 0; i < mNumEffectors; i++)
+	{
+		Effector& effector = mEffectors[i];
+		effector.minResidual = getMinResidual(effector.chain, effector.target.getGlobalTranslation());
+		effector.residual = DBL_MAX;
+	}
+	updateEffectorResiduals();
+	int iterations = 0;
+
+	while (iterations < gIKmaxIterations && !isMultiIKDone())
+	{
+		for (int i = 0; i < joints.size(); i++)
+		{
+			AJoint* joint = joints[i];
+			vec3 p = joint->getGlobalTranslation();
+			vec3 w(0.0, 0.0, 0.0);
+			int count = 0;
+			for (int k = 0; k < mNumEffectors; k++)
+			{
+				AJoint* endJoint = mEffectors[k].chain.getJoint(0);
+				if (!isAbove(def, joint->getID(), endJoint->getID())) continue;
+
+				vec3 r = endJoint->getGlobalTranslation() - p;
+				vec3 e = mEffectors[k].target.getGlobalTranslation() - endJoint->getGlobalTranslation();
+				vec3 axis = r.Cross(e);
+				double sine = axis.Length();
+				count++;
+				if (sine < DBL_EPSILON) continue;
+				w += axis * (atan2(sine, Dot(r, r) + Dot(r, e)) / sine);
+			}
+			if (count == 0) continue;
+			w /= count;
+			double angle = mMultiIKchain.getWeight(i) * w.Length();
+			if (angle < DBL_EPSILON) continue;
+
+			mat3 rot;
+			rot.FromAxisAngle(joint->getGlobalRotation().Transpose() * w.Normalize(), angle);
+			joint->setLocalRotation(joint->getLocalRotation() * rot);
+
+			// the union joints below this one come right before it
+			int end = def.getSubtreeEnd()[def.getFKIndex()[joint->getID()]];
+			for (int j = i; j >= 0 && def.getFKIndex()[joints[j]->getID()] < end; j--)
+			{
+				pIKSkeleton->updateJoint(joints[j]);
+			}
+		}
+		updateEffectorResiduals();
+		iterations++;
+	}
+
+	endWarmStart(mMultiIKchain);
+	addEffectorStats(iterations);
+
+	return iterations;
+}
+
+int IKController::computeMultiPseudoInvIK(ASkeleton* pIKSkeleton)
+{
+	// Damped least squares on the stacked Jacobian: dTheta = J^T (J J^T + lambda^2 I)^-1 e, J J^T being
+	// 3 rows per effector square
+	std::vector<AJoint*>& joints = mMultiIKchain.getChain();
+	const ASkeletonDef& def = *mMultiDefinition;
+	int numRows = 3 * mNumEffectors;
+	int numDOFs = 3 * joints.size();
+	if (mMultiJacobian.rows() != numRows || mMultiJacobian.cols() != numDOFs)
+	{
+		mMultiJacobian.resize(numRows, numDOFs);
+		mMultiJJt.resize(numRows, numRows);
+		mMultiLDLT = Eigen::LDLT<Eigen::MatrixXd>(numRows);
+		mMultiError.resize(numRows);
+		mMultiY.resize(numRows);
+		mMultiDeltaTheta.resize(numDOFs);
+	}
+
+	beginWarmStart(mMultiIKchain, pIKSkeleton);
+	for (int i = 0; i < mNumEffectors; i++)
+	{
+		Effector& effector = mEffectors[i];
+		effector.minResidual = getMinResidual(effector.chain, effector.target.getGlobalTranslation());
+		effector.residual = DBL_MAX;
+	}
+	updateEffectorResiduals();
+	int iterations = 0;
+
+	while (iterations < gIKmaxIterations && !isMultiIKDone())
+	{
+		mMultiJacobian.setZero();
+		for (int k = 0; k < mNumEffectors; k++)
+		{
+			// far targets are approached in bounded steps, like in IKSolver_PseudoInv
+			Effector& effector = mEffectors[k];
+			AJoint* endJoint = effector.chain.getJoint(0);
+			vec3 pEnd = endJoint->getGlobalTranslation();
+			vec3 e = effector.target.getGlobalTranslation() - pEnd;
+			double maxStep = 0.2 * (pEnd - effector.chain.getJoint(effector.chain.getSize() - 1)->getGlobalTranslation()).Length();
+			if (effector.residual > maxStep) e = e * (maxStep / effector.residual);
+			mMultiError[3 * k] = e[0];
+			mMultiError[3 * k + 1] = e[1];
+			mMultiError[3 * k + 2] = e[2];
+
+			// column k of joint i is axis_k x r, r being the vector from joint i to the end joint
+			for (int i = 0; i < joints.size(); i++)
+			{
+				if (!isAbove(def, joints[i]->getID(), endJoint->getID())) continue;
+				vec3 r = pEnd - joints[i]->getGlobalTranslation();
+				int row = 3 * k;
+				int c = 3 * i;
+				mMultiJacobian(row + 1, c) = -r[2];     mMultiJacobian(row + 2, c) = r[1];
+				mMultiJacobian(row, c + 1) = r[2];      mMultiJacobian(row + 2, c + 1) = -r[0];
+				mMultiJacobian(row, c + 2) = -r[1];     mMultiJacobian(row + 1, c + 2) = r[0];
+			}
+		}
+
+		mMultiJJt.noalias() = mMultiJacobian.lazyProduct(mMultiJacobian.transpose());
+		mMultiJJt.diagonal().array() += gIKDamping * gIKDamping;
+		mMultiLDLT.compute(mMultiJJt);
+		mMultiY = mMultiLDLT.solve(mMultiError);
+		mMultiDeltaTheta.noalias() = mMultiJacobian.transpose().lazyProduct(mMultiY);
+
+		for (int i = 0; i < joints.size(); i++)
+		{
+			int c = 3 * i;
+			vec3 w(mMultiDeltaTheta[c], mMultiDeltaTheta[c + 1], mMultiDeltaTheta[c + 2]);
+			double angle = w.Length();
+			if (angle < DBL_EPSILON) continue;
+
+			mat3 rot;
+			rot.FromAxisAngle(joints[i]->getGlobalRotation().Transpose() * (w / angle), angle);
+			joints[i]->setLocalRotation(joints[i]->getLocalRotation() * rot);
+		}
+
+		// one FK pass over the union, parents first
+		for (int i = joints.size() - 1; i >= 0; i--)
+		{
+			pIKSkeleton->updateJoint(joints[i]);
+		}
+		updateEffectorResiduals();
+		iterations++;
+	}
+
+	endWarmStart(mMultiIKchain);
+	addEffectorStats(iterations);
+
+	return iterations;
+}
@@ -7,6 +7,7 @@
 #include "aJoint.h"
 #include "aSkeleton.h"
 #include "aTarget.h"
+#include <Eigen/Dense>
 
 class AActor;  // forward declaration since IKController class references AActor and AActor class references IKController
 
@@ -31,9 +32,20 @@ public:
 	std::vector<AJoint*>& getChain();
 	void setChain(std::vector<AJoint*> chain);
 
+	// Warm start state: the local rotation each joint started the last solve from, the correction the solve
+	// applied to it and the rotation it ended with. Empty until the chain has been solved once.
+	std::vector<mat3>& getStartRotations();
+	std::vector<mat3>& getOffsets();
+	std::vector<mat3>& getSolvedRotations();
+
+	double getLength();  // distance from the last joint to the end joint along the chain
+
 protected:
 	std::vector<AJoint*> mChain;
 	std::vector<double> mWeights;
+	std::vector<mat3> mStartRotations;
+	std::vector<mat3> mOffsets;
+	std::vector<mat3> mSolvedRotations;
 	double mWeight0;
 };
 
@@ -54,10 +66,17 @@ public:
 	AActor* getActor();
 	void setActor(AActor* actor);
 
+	// Each solver returns true if the end joint reached the target within gIKEpsilon
 	bool IKSolver_Limb(int endJointID, const ATarget& target);
 	bool IKSolver_CCD(int endJointID, const ATarget& target);
 	bool IKSolver_PseudoInv(int endJointID, const ATarget& target);
-	bool IKSolver_Other(int endJointID, const ATarget& target);
+	bool IKSolver_Other(int endJointID, const ATarget& target);  // FABRIK
+
+	// Solves several end joints at once, each to its own target, with one damped least squares step per iteration
+	// on their stacked Jacobians. The chains all run to the root, so joints several of them share (the spine for
+	// both hands) serve all of them. An end joint of mRootID moves the root to its target first, and the hands and
+	// feet that are not given then hold on to their current targets.
+	bool IKSolver_Multi(const std::vector<int>& endJointIDs, const std::vector<ATarget>& targets);
 
 	int createLimbIKchains();
 	int createCCDIKchains();
@@ -65,10 +84,15 @@ public:
 	AIKchain createIKchain(int endJointID, int desiredChainSize, ASkeleton* pSkeleton);
 
 	int computeLimbIK(ATarget target, AIKchain& IKchain, const vec3 axis, ASkeleton* pIKSkeleton);
-	int computeCCDIK(ATarget target, AIKchain&, ASkeleton* pIKSkeleton);
+	int computeCCDIK(const ATarget& target, AIKchain&, ASkeleton* pIKSkeleton);  // returns the iterations used
+
+	// Statistics of the last solve. A solve of the root solves all four limbs and reports their total iterations
+	// and their largest residual.
+	int getIKIterations() const;   // iterations used by the last solve
+	double getIKResidual() const;  // end joint distance to the target after the last solve
 
 	enum EndJointIndex { ROOT, LHAND, RHAND, LFOOT, RFOOT } mEndJointIndex;
-	enum IKType { LIMB, CCD, PSEDUOINV };
+	enum IKType { LIMB, CCD, PSEDUOINV, FABRIK };
 
 	// End Joint IDs
 	// assumes skeleton structure associated with beta character
@@ -79,10 +103,43 @@ public:
 	int mRfootID = 51;
 
 protected:
+	// Fills IKchain in place, so a chain that is rebuilt every solve reuses its vectors
+	void buildIKchain(AIKchain& IKchain, int endJointID, int desiredChainSize, ASkeleton* pSkeleton);
+
+	// A solve only changes the joints below the base of its chain, so only that subtree of the skeleton is copied
+	// into the IK skeleton and written back. The IK skeleton holds the scratch pose of the thread in between.
+	void beginSubtreeSolve(int baseJointID);
+	void beginSubtreeSolve(AIKchain& IKchain);  // from the last joint of the chain
+	void endSubtreeSolve();
+
+	// An iterative solve of a chain starts from its animated pose plus the correction the previous solve of the
+	// chain made, so a target that moves smoothly is reached again in one or two iterations. A chain still in
+	// the pose of the previous solve starts from it as it is.
+	void beginWarmStart(AIKchain& IKchain, ASkeleton* pIKSkeleton);
+	void endWarmStart(AIKchain& IKchain);
+
+	// The end joint cannot get closer to the target than this
+	double getMinResidual(AIKchain& IKchain, const vec3& goal);
+	// true once residual is within gIKEpsilon of minResidual, or the target is out of reach and the last
+	// iteration gained less than gIKEpsilon
+	bool isIKDone(double residual, double lastResidual, double minResidual) const;
+	void addIKStats(int iterations, double residual);
+
+	// Multi-effector solves work on the first mNumEffectors of mEffectors and on mMultiIKchain, the union of their
+	// chains. Set mNumEffectors to 0, add the effectors, then build the union.
+	void addEffector(int endJointID, const ATarget& target, ASkeleton* pIKSkeleton);
+	void buildMultiIKchain(ASkeleton* pIKSkeleton);
+	bool isMultiIKDone() const;
+	void updateEffectorResiduals();
+	void addEffectorStats(int iterations);
+	// CCD over the union, each joint turning by the average of the rotations that would bring each end joint
+	// below it onto its target
+	int computeMultiCCDIK(ASkeleton* pIKSkeleton);
+	int computeMultiPseudoInvIK(ASkeleton* pIKSkeleton);
 
 	AActor* m_pActor;
 	ASkeleton* m_pSkeleton;
-	ASkeleton mIKSkeleton, mIKSkeleton1, mIKSkeleton2;
+	ASkeleton mIKSkeleton;  // joints of the chains, posed only during a solve
 
 	bool mValidChain = true;
 	bool mvalidLimbIKchains;
@@ -93,6 +150,7 @@ protected:
 	AIKchain mRfootIKchain; // IK chain of joint pointers starting with Rfoot joint 
 	AIKchain mLfootIKchain; // IK chain of joint pointers starting with Lfoot joint 
 	AIKchain mIKchain;  // IK chain of joint pointers starting with end joint 
+	int mSolveBaseID = -1;  // root of the subtree being solved
 
     int mEndJointID = -1;
     int mChainSize = -1;
@@ -118,9 +176,47 @@ protected:
 	// CCD IK variables
 	double mWeight0;
 
+	// Pseudo inverse IK variables, kept between calls so the solver does not allocate
+	AIKchain mPseudoInvIKchain;
+	Eigen::MatrixXd mJacobian;      // 3 x 3(n-1), rotations about the global x, y and z axes of each joint, sized
+	                                // for the longest chain solved so far; a shorter chain uses its first columns
+	Eigen::Matrix3d mJJt;           // J * J^T + damping^2 * I
+	Eigen::VectorXd mDeltaTheta;
+
+	// FABRIK variables: the chain is solved on joint positions, end joint first, and turned back into rotations
+	AIKchain mFabrikIKchain;
+	std::vector<vec3> mFabrikPositions;
+	std::vector<double> mFabrikLengths;  // from each joint to the next one up the chain
+
+	// Multi-effector variables
+	struct Effector
+	{
+		AIKchain chain;  // from the end joint to the root
+		ATarget target;
+		double residual;
+		double lastResidual;
+		double minResidual;
+	};
+	std::vector<Effector> mEffectors;  // kept beyond mNumEffectors so their vectors are reused
+	int mNumEffectors = 0;
+	AIKchain mMultiIKchain;  // every joint of the effector chains once, deeper joints first like in a chain
+	std::vector<AJoint*> mMultiJoints;
+	std::shared_ptr<const ASkeletonDef> mMultiDefinition;  // FK order of the IK skeleton, to tell what is above what
+	Eigen::MatrixXd mMultiJacobian;  // 3 rows per effector, 3 columns per joint of mMultiIKchain
+	Eigen::MatrixXd mMultiJJt;
+	Eigen::LDLT<Eigen::MatrixXd> mMultiLDLT;  // factorization of mMultiJJt, its storage reused by compute
+	Eigen::VectorXd mMultiError;
+	Eigen::VectorXd mMultiY;
+	Eigen::VectorXd mMultiDeltaTheta;
+
+	int mIKIterations = 0;
+	double mIKResidual = 0.0;
+
 public:
-    static double gIKEpsilon;
-    static int gIKmaxIterations;
+    static double gIKEpsilon;      // distance to the target at which a solve stops, in skeleton length units
+    static int gIKmaxIterations;   // per chain, for the CCD, PseudoInv, FABRIK and Multi solvers
+    static double gIKDamping;      // damped least squares lambda, in skeleton length units
+    static bool gIKWarmStart;      // see beginWarmStart
 };
 
 #endif
\ No newline at end of file
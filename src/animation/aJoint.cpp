@@ -1,4 +1,5 @@
 #include "aJoint.h"
+#include "aSkeleton.h"
 
 #pragma warning(disable : 4018)
 
@@ -17,7 +18,8 @@ AJoint::AJoint() :
 	mParent(0),
 	mChildren(),
 	mLocal2Parent(),
-	mLocal2Global()
+	mLocal2Global(),
+	m_pSkeleton(0)
 {
 
 }
@@ -31,12 +33,14 @@ AJoint::AJoint(const std::string& name) :
 	mParent(0),
 	mChildren(),
 	mLocal2Parent(),
-	mLocal2Global()
+	mLocal2Global(),
+	m_pSkeleton(0)
 {
 
 }
 
-AJoint::AJoint(const AJoint& jointnode)
+AJoint::AJoint(const AJoint& jointnode) :
+	m_pSkeleton(0)
 {
 	*this = jointnode;
 }
@@ -48,17 +52,24 @@ AJoint& AJoint::operator=(const AJoint& orig)
 		return *this;
 	}
 
-	// copy everything except parents/children
-	mParent = 0;
+	// copy everything except parents/children and the skeleton binding
+	setParent(0);
 	mChildren.clear();
-	mDirty = true;
 
 	mId = orig.mId;
 	mName = orig.mName;
 	mChannelCount = orig.mChannelCount;
 	mRotOrder = orig.mRotOrder;
-	mLocal2Parent = orig.mLocal2Parent;
-	mLocal2Global = orig.mLocal2Global;
+	if (m_pSkeleton)
+	{
+		m_pSkeleton->setLocal2Parent(mId, orig.getLocal2Parent());
+	}
+	else
+	{
+		mLocal2Parent = orig.getLocal2Parent();
+		mLocal2Global = orig.getLocal2Global();
+		mDirty = true;
+	}
 
 	return *this;
 }
@@ -68,38 +79,47 @@ AJoint::~AJoint()
 
 }
 
+// The joints of a skeleton instance have no links of their own, the skeleton looks them up in its definition.
+// Anything that changes the hierarchy tells the skeleton first, so that an instance can make its links its own.
 AJoint* AJoint::getParent()
 {
+	if (m_pSkeleton && m_pSkeleton->isInstanced()) return m_pSkeleton->getParentJoint(mId);
 	return mParent;
 }
 void AJoint::setParent(AJoint* parent)
 {
+	if (m_pSkeleton) m_pSkeleton->invalidateTopology();
 	mParent = parent;
 }
 
 unsigned int AJoint::getNumChildren() const
 {
+	if (m_pSkeleton && m_pSkeleton->isInstanced()) return m_pSkeleton->getNumChildJoints(mId);
 	return mChildren.size();
 }
 
 AJoint* AJoint::getChildAt(unsigned int index)
 {
+	if (m_pSkeleton && m_pSkeleton->isInstanced()) return m_pSkeleton->getChildJoint(mId, index);
 	assert(index >= 0 && index < mChildren.size());
 	return mChildren[index];
 }
 
 void AJoint::appendChild(AJoint* child)
 {
+	if (m_pSkeleton) m_pSkeleton->invalidateTopology();
 	mChildren.push_back(child);
 }
 
 void AJoint::setName(const std::string& name)
 {
+	if (m_pSkeleton) m_pSkeleton->invalidateTopology();
 	mName = name;
 }
 
 void AJoint::setID(int id)
 {
+	if (m_pSkeleton) m_pSkeleton->invalidateTopology();
 	mId = id;
 	if (strncmp("Site", mName.c_str(), 4) == 0)
 	{
@@ -111,12 +131,14 @@ void AJoint::setID(int id)
 
 void AJoint::setNumChannels(unsigned int count)
 {
+	if (m_pSkeleton) m_pSkeleton->invalidateTopology();
 	mChannelCount = count;
 }
 
 void AJoint::setRotationOrder(const std::string& _order)
 {
 	std::string order = _order;
+	if (m_pSkeleton) m_pSkeleton->invalidateTopology();
 
 	if (order.find("Zrotation Xrotation Yrotation") != std::string::npos) mRotOrder = "zxy";
 	else if (order.find("Zrotation Yrotation Xrotation") != std::string::npos) mRotOrder = "zyx";
@@ -130,32 +152,68 @@ void AJoint::setRotationOrder(const std::string& _order)
 
 void AJoint::setLocal2Parent(const ATransform& transform)
 {
+	if (m_pSkeleton)
+	{
+		m_pSkeleton->setLocal2Parent(mId, transform);
+		return;
+	}
 	mLocal2Parent = transform;
+	mDirty = true;
 }
 
 void AJoint::setLocalTranslation(const vec3& translation)
 {
+	if (m_pSkeleton)
+	{
+		m_pSkeleton->setLocalTranslation(mId, translation);
+		return;
+	}
 	mLocal2Parent.m_translation = translation;
+	mDirty = true;
 }
 
 void AJoint::setLocalRotation(const mat3& rotation)
 {
+	if (m_pSkeleton)
+	{
+		m_pSkeleton->setLocalRotation(mId, rotation);
+		return;
+	}
 	mLocal2Parent.m_rotation = rotation;
+	mDirty = true;
 }
 
 void AJoint::setLocal2Global(const ATransform& transform)
 {
+	if (m_pSkeleton)
+	{
+		m_pSkeleton->setLocal2Global(mId, transform);
+		return;
+	}
 	mLocal2Global = transform;
+	mDirty = true;
 }
 
 void AJoint::setGlobalTranslation(const vec3& translation)  // new function
 {
+	if (m_pSkeleton)
+	{
+		setLocal2Global(ATransform(getGlobalRotation(), translation));
+		return;
+	}
 	mLocal2Global.m_translation = translation;
+	mDirty = true;
 }
 
 void AJoint::setGlobalRotation(const mat3& rotation) // new function
 {
+	if (m_pSkeleton)
+	{
+		setLocal2Global(ATransform(rotation, getGlobalTranslation()));
+		return;
+	}
 	mLocal2Global.m_rotation = rotation;
+	mDirty = true;
 }
 
 
@@ -179,53 +237,62 @@ const std::string& AJoint::getRotationOrder() const
 	return mRotOrder;
 }
 
-const ATransform& AJoint::getLocal2Parent() const
+ATransform AJoint::getLocal2Parent() const
 {
+	if (m_pSkeleton) return m_pSkeleton->getLocal2Parent(mId);
 	return mLocal2Parent;
 }
 
-const vec3& AJoint::getLocalTranslation() const
+vec3 AJoint::getLocalTranslation() const
 {
-	return mLocal2Parent.m_translation;
+	return getLocal2Parent().m_translation;
 }
 
-const mat3& AJoint::getLocalRotation() const
+mat3 AJoint::getLocalRotation() const
 {
-	return mLocal2Parent.m_rotation;
+	return getLocal2Parent().m_rotation;
 }
 
-const ATransform& AJoint::getLocal2Global() const
+ATransform AJoint::getLocal2Global() const
 {
+	if (m_pSkeleton) return m_pSkeleton->getLocal2Global(mId);
 	return mLocal2Global;
 }
 
-const vec3& AJoint::getGlobalTranslation() const
+vec3 AJoint::getGlobalTranslation() const
 {
-	return mLocal2Global.m_translation;
+	return getLocal2Global().m_translation;
 }
 
-const mat3& AJoint::getGlobalRotation() const
+mat3 AJoint::getGlobalRotation() const
 {
-	return mLocal2Global.m_rotation;
+	return getLocal2Global().m_rotation;
 }
 
 void AJoint::updateTransform()
 {
 	// TODO: Compute mLocal2Global, which transforms from local coordinates to world coordinates
 
+	// the skeleton computes the global transforms of its joints itself
+	if (m_pSkeleton) {
+		m_pSkeleton->updateSubtree(this);
+		return;
+	}
+
 	// if there is a parent joint
-	if (mParent) {
-		setLocal2Global(getParent()->mLocal2Global * getLocal2Parent());
+	if (getParent()) {
+		mLocal2Global = getParent()->getLocal2Global() * getLocal2Parent();
 	}
 
 	// if we are at the root
 	else {
-		setLocal2Global(mLocal2Parent);
+		mLocal2Global = getLocal2Parent();
 	}
+	mDirty = false;
 
 	// TODO: Update children
-	for (AJoint* child : mChildren) {
-		child->updateTransform();
+	for (unsigned int i = 0; i < getNumChildren(); i++) {
+		getChildAt(i)->updateTransform();
 	}
 }
 
@@ -233,6 +300,8 @@ void AJoint::Attach(AJoint* pParent, AJoint* pChild)
 {
 	if (pChild)
 	{
+		if (pChild->m_pSkeleton) pChild->m_pSkeleton->invalidateTopology();
+		if (pParent && pParent->m_pSkeleton) pParent->m_pSkeleton->invalidateTopology();
 		AJoint* pOldParent = pChild->mParent;
 		if (pOldParent)
 		{
@@ -261,6 +330,7 @@ void AJoint::Attach(AJoint* pParent, AJoint* pChild)
 
 void AJoint::Detach(AJoint* pParent, AJoint* pChild)
 {
+	if (pChild && pChild->m_pSkeleton && pChild->getParent() == pParent) pChild->m_pSkeleton->invalidateTopology();
 	if (pChild && pChild->mParent == pParent)
 	{
 		if (pParent)
@@ -283,3 +353,29 @@ void AJoint::Detach(AJoint* pParent, AJoint* pChild)
 	}
 }
 
+void AJoint::bindTransforms(ASkeleton* pSkeleton)
+{
+	m_pSkeleton = pSkeleton;
+}
+
+void AJoint::unbindTransforms()
+{
+	if (m_pSkeleton && m_pSkeleton->getLocalPoseData())
+	{
+		mLocal2Parent = m_pSkeleton->getLocal2Parent(mId);
+		mLocal2Global = m_pSkeleton->getLocal2Global(mId);
+		mDirty = m_pSkeleton->isDirty(mId);
+	}
+	m_pSkeleton = 0;
+}
+
+bool AJoint::isDirty() const
+{
+	if (m_pSkeleton) return m_pSkeleton->isDirty(mId);
+	return mDirty;
+}
+
+ASkeleton* AJoint::getSkeleton() const
+{
+	return m_pSkeleton;
+}
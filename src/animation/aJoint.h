@@ -4,6 +4,7 @@
 #include "aTransform.h"
 #include <vector>
 
+class ASkeleton;
 
 class AJoint
 {
@@ -23,6 +24,7 @@ public:
 	void appendChild(AJoint* child);
 
 	void updateTransform();
+	bool isDirty() const;  // true if a transform was set since the last FK update of this joint
 
 	void setName(const std::string& name);
 	void setID(int id);
@@ -41,17 +43,24 @@ public:
 	unsigned int getNumChannels() const;
 	const std::string& getRotationOrder() const;
 
-	const ATransform& getLocal2Parent() const;
-	const vec3& getLocalTranslation() const;
-	const mat3& getLocalRotation() const;
+	ATransform getLocal2Parent() const;
+	vec3 getLocalTranslation() const;
+	mat3 getLocalRotation() const;
 
-	const ATransform& getLocal2Global() const;
-	const vec3& getGlobalTranslation() const;
-	const mat3& getGlobalRotation() const;
+	ATransform getLocal2Global() const;
+	vec3 getGlobalTranslation() const;
+	mat3 getGlobalRotation() const;
 
 	static void Attach(AJoint* pParent, AJoint* pChild);
 	static void Detach(AJoint* pParent, AJoint* pChild);
 
+	// A joint owned by a skeleton keeps its transforms in the skeleton's pose, and reads and sets them there by ID.
+	// bindTransforms points the joint at that pose, unbindTransforms copies the values back into the joint.
+	// The global transform of a bound joint is computed by the skeleton, and setting it sets the local transform.
+	void bindTransforms(ASkeleton* pSkeleton);
+	void unbindTransforms();
+	ASkeleton* getSkeleton() const;
+
 protected:
 	int mId;
 	std::string mName;
@@ -62,8 +71,10 @@ protected:
 	AJoint* mParent;
 	std::vector<AJoint*> mChildren;
 
-	ATransform mLocal2Parent;
+	ATransform mLocal2Parent;  // storage used while the joint is not bound to a skeleton
 	ATransform mLocal2Global;
+
+	ASkeleton* m_pSkeleton;        // skeleton whose pose holds this joint's transforms, if any
 };
 
 
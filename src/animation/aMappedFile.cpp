@@ -0,0 +1,95 @@
+#include "aMappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+AMappedFile::AMappedFile() : mData(0), mSize(0)
+{
+#ifdef _WIN32
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = 0;
+#endif
+}
+
+AMappedFile::~AMappedFile()
+{
+	close();
+}
+
+bool AMappedFile::open(const std::string& filename)
+{
+	close();
+
+#ifdef _WIN32
+	// FILE_SHARE_DELETE lets AMotionCache::Write replace a .bvhc that a clip still has mapped
+	mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (mFile == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	mMapping = CreateFileMappingA(mFile, 0, PAGE_READONLY, 0, 0, 0);
+	if (mMapping)
+	{
+		mData = (const char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+		mSize = (size_t)size.QuadPart;
+	}
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		void* data = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		mData = data == MAP_FAILED ? 0 : (const char*)data;
+		mSize = (size_t)info.st_size;
+	}
+	::close(fd);	// the mapping keeps the file open
+#endif
+	if (!mData)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void AMappedFile::close()
+{
+#ifdef _WIN32
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+	mMapping = 0;
+	mFile = INVALID_HANDLE_VALUE;
+#else
+	if (mData) munmap((void*)mData, mSize);
+#endif
+	mData = 0;
+	mSize = 0;
+}
+
+bool AMappedFile::isOpen() const
+{
+	return mData != 0;
+}
+
+const char* AMappedFile::getData() const
+{
+	return mData;
+}
+
+size_t AMappedFile::getSize() const
+{
+	return mSize;
+}
@@ -0,0 +1,34 @@
+#ifndef AMappedFile_H_
+#define AMappedFile_H_
+
+#include <cstddef>
+#include <string>
+
+// Read-only view of a whole file mapped into memory
+class AMappedFile
+{
+public:
+	AMappedFile();
+	virtual ~AMappedFile();
+
+	bool open(const std::string& filename);	// fails for missing and empty files
+	void close();
+	bool isOpen() const;
+
+	const char* getData() const;
+	size_t getSize() const;
+
+protected:
+	AMappedFile(const AMappedFile&);	// owns the mapping, not copyable
+	AMappedFile& operator=(const AMappedFile&);
+
+protected:
+	const char* mData;
+	size_t mSize;
+#ifdef _WIN32
+	void* mFile;
+	void* mMapping;
+#endif
+};
+
+#endif
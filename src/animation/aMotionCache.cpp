@@ -0,0 +1,288 @@
+#include "aMotionCache.h"
+#include "aMotionClip.h"
+#include "aSkeleton.h"
+#include "aSplineVec3.h"
+#include "aSplineQuat.h"
+#include "aMotionTracks.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#pragma warning(disable:4018)
+
+static uint64_t alignSection(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+// Replaces to with from in one step, so that a reader sees either the old file or the new one.
+// A clip playing the old file keeps its mapping.
+static bool replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+AMotionCache::AMotionCache() : mData(0), mSize(0)
+{
+}
+
+AMotionCache::~AMotionCache()
+{
+	close();
+}
+
+bool AMotionCache::open(const std::string& filename, const std::string& sourceFilename)
+{
+	close();
+	if (!mFile.open(filename) || mFile.getSize() < sizeof(Header))
+	{
+		close();
+		return false;
+	}
+	mData = mFile.getData();
+	mSize = mFile.getSize();
+
+	// Reject anything this build cannot use in place
+	const Header& header = getHeader();
+	bool valid = header.magic == kMagic && header.version == kVersion &&
+		header.vec3Size == sizeof(vec3) && header.quatSize == sizeof(quat) &&
+		header.fileSize == mSize && header.numJoints > 0 && header.numKeys > 1 &&
+		header.numRootSamples > 0 && header.numSamples > 0;
+	if (valid)
+	{
+		uint64_t numJoints = header.numJoints;
+		valid = header.jointsOffset + numJoints * sizeof(JointRecord) <= mSize &&
+			header.stringsOffset <= mSize &&
+			header.keyTimesOffset + header.numKeys * sizeof(double) <= mSize &&
+			header.rootKeysOffset + header.numKeys * sizeof(vec3) <= mSize &&
+			header.rootCurveOffset + header.numRootSamples * sizeof(vec3) <= mSize &&
+			header.rotationKeysOffset + header.numKeys * numJoints * sizeof(quat) <= mSize &&
+			header.samplesOffset + header.numSamples * numJoints * sizeof(quat) <= mSize;
+	}
+	for (int i = 0; valid && i < header.numJoints; i++)
+	{
+		const JointRecord& joint = getJoint(i);
+		valid = joint.parentID < i && (i == 0) == (joint.parentID < 0) &&
+			header.stringsOffset + joint.nameOffset + joint.nameLength <= mSize &&
+			header.stringsOffset + joint.rotOrderOffset + joint.rotOrderLength <= mSize;
+	}
+	if (valid && !sourceFilename.empty())
+	{
+		// The size and modification time reject an edit without reading the source. The time only has a
+		// resolution of a second, so the content is hashed only if the cache was written in the second the
+		// source was last modified, when a later edit in that second keeps both.
+		uint64_t sourceSize, cacheSize;
+		int64_t sourceTime, cacheTime;
+		valid = GetSourceInfo(sourceFilename, sourceSize, sourceTime) && header.sourceSize == sourceSize &&
+			header.sourceTime == sourceTime;
+		if (valid && (!GetSourceInfo(filename, cacheSize, cacheTime) || cacheTime <= sourceTime))
+		{
+			AMappedFile source;
+			valid = source.open(sourceFilename) && AMotionClip::Hash(source.getData(), source.getSize()) == header.sourceHash;
+		}
+	}
+	if (!valid)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void AMotionCache::close()
+{
+	mFile.close();
+	mData = 0;
+	mSize = 0;
+}
+
+bool AMotionCache::isOpen() const
+{
+	return mData != 0;
+}
+
+const AMotionCache::Header& AMotionCache::getHeader() const
+{
+	assert(mData);
+	return *getSection<Header>(0);
+}
+
+const AMotionCache::JointRecord& AMotionCache::getJoint(int jointID) const
+{
+	assert(jointID >= 0 && jointID < getHeader().numJoints);
+	return getSection<JointRecord>(getHeader().jointsOffset)[jointID];
+}
+
+std::string AMotionCache::getJointName(int jointID) const
+{
+	const JointRecord& joint = getJoint(jointID);
+	return std::string(getSection<char>(getHeader().stringsOffset + joint.nameOffset), joint.nameLength);
+}
+
+std::string AMotionCache::getJointRotationOrder(int jointID) const
+{
+	const JointRecord& joint = getJoint(jointID);
+	return std::string(getSection<char>(getHeader().stringsOffset + joint.rotOrderOffset), joint.rotOrderLength);
+}
+
+const double* AMotionCache::getKeyTimes() const
+{
+	return getSection<double>(getHeader().keyTimesOffset);
+}
+
+const vec3* AMotionCache::getRootKeys() const
+{
+	return getSection<vec3>(getHeader().rootKeysOffset);
+}
+
+const vec3* AMotionCache::getRootCurve() const
+{
+	return getSection<vec3>(getHeader().rootCurveOffset);
+}
+
+const quat* AMotionCache::getRotationKeys() const
+{
+	return getSection<quat>(getHeader().rotationKeysOffset);
+}
+
+const quat* AMotionCache::getSamples() const
+{
+	return getSection<quat>(getHeader().samplesOffset);
+}
+
+bool AMotionCache::Write(const std::string& filename, const std::string& sourceFilename, uint64_t sourceHash, const ASkeleton* skeleton,
+	double fps, double dt, const ASplineVec3& rootMotion, const std::vector<ASplineQuat>& rotations, const AMotionTracks& tracks)
+{
+	std::shared_ptr<const ASkeletonDef> definition = skeleton->getDefinition();
+	int numJoints = definition->getNumJoints();
+	int numKeys = rootMotion.getNumKeys();
+	if (numJoints == 0 || numKeys < 2 || rotations.size() != numJoints ||
+		tracks.getNumTracks() != numJoints || tracks.isEmpty())
+	{
+		return false;
+	}
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = kMagic;
+	header.version = kVersion;
+	header.vec3Size = sizeof(vec3);
+	header.quatSize = sizeof(quat);
+	if (!GetSourceInfo(sourceFilename, header.sourceSize, header.sourceTime)) return false;
+	header.sourceHash = sourceHash;
+	header.numJoints = numJoints;
+	header.numKeys = numKeys;
+	header.numRootSamples = rootMotion.getNumCurveSegments();
+	header.numSamples = tracks.getNumFrames();
+	header.fps = fps;
+	header.dt = dt;
+	header.startTime = tracks.getStartTime();
+	header.sampleDt = tracks.getDeltaTime();
+	header.looping = tracks.getLooping() ? 1 : 0;
+
+	std::vector<JointRecord> joints(numJoints);
+	std::string strings;
+	for (int i = 0; i < numJoints; i++)
+	{
+		if (rotations[i].getNumKeys() != numKeys) return false;
+
+		JointRecord& record = joints[i];
+		memset(&record, 0, sizeof(record));
+		record.parentID = definition->getParentID(i);
+		record.numChannels = definition->getNumChannels(i);
+		record.nameOffset = strings.size();
+		record.nameLength = definition->getName(i).size();
+		strings += definition->getName(i);
+		record.rotOrderOffset = strings.size();
+		record.rotOrderLength = definition->getRotationOrder(i).size();
+		strings += definition->getRotationOrder(i);
+		for (int c = 0; c < 3; c++) record.offset[c] = definition->getOffset(i)[c];
+	}
+
+	header.jointsOffset = alignSection(sizeof(Header));
+	header.stringsOffset = alignSection(header.jointsOffset + numJoints * sizeof(JointRecord));
+	header.keyTimesOffset = alignSection(header.stringsOffset + strings.size());
+	header.rootKeysOffset = alignSection(header.keyTimesOffset + numKeys * sizeof(double));
+	header.rootCurveOffset = alignSection(header.rootKeysOffset + numKeys * sizeof(vec3));
+	header.rotationKeysOffset = alignSection(header.rootCurveOffset + header.numRootSamples * sizeof(vec3));
+	header.samplesOffset = alignSection(header.rotationKeysOffset + (uint64_t)numKeys * numJoints * sizeof(quat));
+	header.fileSize = header.samplesOffset + (uint64_t)header.numSamples * numJoints * sizeof(quat);
+
+	std::vector<char> data((size_t)header.fileSize, 0);
+	memcpy(&data[0], &header, sizeof(header));
+	memcpy(&data[header.jointsOffset], joints.data(), numJoints * sizeof(JointRecord));
+	if (!strings.empty()) memcpy(&data[header.stringsOffset], strings.data(), strings.size());
+
+	double* keyTimes = (double*)&data[header.keyTimesOffset];
+	vec3* rootKeys = (vec3*)&data[header.rootKeysOffset];
+	quat* rotationKeys = (quat*)&data[header.rotationKeysOffset];
+	for (int k = 0; k < numKeys; k++)
+	{
+		keyTimes[k] = rootMotion.getKeyTime(k);
+		rootKeys[k] = rootMotion.getKey(k);
+		for (int i = 0; i < numJoints; i++)
+		{
+			rotationKeys[k * numJoints + i] = rotations[i].getKey(k);
+		}
+	}
+	vec3* rootCurve = (vec3*)&data[header.rootCurveOffset];
+	for (int s = 0; s < header.numRootSamples; s++)
+	{
+		rootCurve[s] = rootMotion.getCurvePoint(s);
+	}
+	memcpy(&data[header.samplesOffset], tracks.getFrame(0), (size_t)header.numSamples * numJoints * sizeof(quat));
+
+	// Written under a temporary name so that a reader never maps a partial file, one name per thread
+	// since actors loading the same clip on several threads all write its cache
+	std::string tmpFilename = filename + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	std::ofstream outFile(tmpFilename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!outFile.is_open()) return false;
+	outFile.write(data.data(), data.size());
+	outFile.close();
+	if (!outFile)
+	{
+		std::remove(tmpFilename.c_str());
+		return false;
+	}
+	// If the old file cannot be replaced it stays, and open keeps rejecting it while it is out of date
+	if (!replaceFile(tmpFilename, filename))
+	{
+		std::remove(tmpFilename.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::string AMotionCache::GetCacheFilename(const std::string& sourceFilename)
+{
+	return sourceFilename + "c";
+}
+
+bool AMotionCache::IsCacheFilename(const std::string& filename)
+{
+	return filename.size() > 5 && filename.compare(filename.size() - 5, 5, ".bvhc") == 0;
+}
+
+bool AMotionCache::GetSourceInfo(const std::string& filename, uint64_t& size, int64_t& time)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0) return false;
+	size = (uint64_t)info.st_size;
+	time = (int64_t)info.st_mtime;
+	return true;
+}
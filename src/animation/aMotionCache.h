@@ -0,0 +1,112 @@
+#ifndef AMotionCache_H_
+#define AMotionCache_H_
+
+#include "aVector.h"
+#include "aRotation.h"
+#include "aMappedFile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ASkeleton;
+class ASplineVec3;
+class ASplineQuat;
+class AMotionTracks;
+
+// Compiled BVH clip (.bvhc).
+// A single file holding everything BVHController::load produces from a .bvh: the joint hierarchy, offsets,
+// channel counts and rotation orders, the key times, root translation keys and rotation keys, and the cached
+// root curve and packed rotation samples. Every section is a flat array at an 8 byte aligned offset, so once
+// the file is mapped into memory the arrays are used in place.
+class AMotionCache
+{
+public:
+	static const uint32_t kMagic = 0x43485642;	// "BVHC"
+	static const uint32_t kVersion = 2;
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vec3Size;	// sizeof(vec3) and sizeof(quat) of the writer, the arrays are used as is
+		uint32_t quatSize;
+		uint64_t fileSize;
+		uint64_t sourceSize;	// size and modification time of the .bvh the file was compiled from
+		int64_t sourceTime;
+		uint64_t sourceHash;	// AMotionClip::Hash of the .bvh
+
+		int32_t numJoints;
+		int32_t numKeys;	// frames in the .bvh
+		int32_t numRootSamples;
+		int32_t numSamples;	// rows of the packed rotation samples
+		double fps;
+		double dt;	// BVH frame time
+		double startTime;	// time of the first sample row
+		double sampleDt;	// time between sample rows
+		int32_t looping;
+		int32_t reserved;
+
+		uint64_t jointsOffset;	// JointRecord[numJoints]
+		uint64_t stringsOffset;	// joint names and rotation orders
+		uint64_t keyTimesOffset;	// double[numKeys]
+		uint64_t rootKeysOffset;	// vec3[numKeys]
+		uint64_t rootCurveOffset;	// vec3[numRootSamples]
+		uint64_t rotationKeysOffset;	// quat[numKeys * numJoints], frame-major
+		uint64_t samplesOffset;	// quat[numSamples * numJoints], frame-major, same layout as AMotionTracks
+	};
+
+	struct JointRecord
+	{
+		int32_t parentID;	// -1 for the root
+		int32_t numChannels;
+		uint32_t nameOffset;	// into the strings section
+		uint32_t nameLength;
+		uint32_t rotOrderOffset;
+		uint32_t rotOrderLength;
+		double offset[3];
+	};
+
+public:
+	AMotionCache();
+	virtual ~AMotionCache();
+
+	// Maps filename read-only and checks its header. With a source file given, the cache is also rejected
+	// if it was compiled from a different version of that file: its size or modification time differ, or
+	// its content hash when the time cannot tell.
+	bool open(const std::string& filename, const std::string& sourceFilename = "");
+	void close();
+	bool isOpen() const;
+
+	const Header& getHeader() const;
+	const JointRecord& getJoint(int jointID) const;
+	std::string getJointName(int jointID) const;
+	std::string getJointRotationOrder(int jointID) const;
+	const double* getKeyTimes() const;
+	const vec3* getRootKeys() const;
+	const vec3* getRootCurve() const;
+	const quat* getRotationKeys() const;	// keys of frame k start at k * numJoints
+	const quat* getSamples() const;	// sample row r starts at r * numJoints
+
+	// Compiles a loaded clip. rotations holds the keys of each joint, indexed by joint ID.
+	static bool Write(const std::string& filename, const std::string& sourceFilename, uint64_t sourceHash, const ASkeleton* skeleton,
+		double fps, double dt, const ASplineVec3& rootMotion, const std::vector<ASplineQuat>& rotations, const AMotionTracks& tracks);
+	static std::string GetCacheFilename(const std::string& sourceFilename);	// samba.bvh -> samba.bvhc
+	static bool IsCacheFilename(const std::string& filename);
+	static bool GetSourceInfo(const std::string& filename, uint64_t& size, int64_t& time);	// file size and modification time
+
+protected:
+	template <class T> const T* getSection(uint64_t offset) const
+	{
+		return reinterpret_cast<const T*>(mData + offset);
+	}
+
+	AMotionCache(const AMotionCache&);	// owns the mapping, not copyable
+	AMotionCache& operator=(const AMotionCache&);
+
+protected:
+	AMappedFile mFile;
+	const char* mData;
+	size_t mSize;
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "aMotionClip.h"
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#pragma warning(disable:4018)
+
+// Process-wide table of shared clips, one entry per file path
+struct SharedClip
+{
+	uint64_t size;	// file size and modification time when the clip was shared
+	int64_t time;
+	std::weak_ptr<const AMotionClip> clip;
+};
+
+static std::mutex gSharedClipsMutex;
+static std::map<std::string, SharedClip> gSharedClips;
+
+AMotionClip::AMotionClip() : mContentHash(0), mFps(120.0), mDt(0.008333)
+{
+}
+
+AMotionClip::~AMotionClip()
+{
+}
+
+const std::string& AMotionClip::getFilename() const
+{
+	return mFilename;
+}
+
+uint64_t AMotionClip::getContentHash() const
+{
+	return mContentHash;
+}
+
+void AMotionClip::setSource(const std::string& filename, uint64_t contentHash)
+{
+	mFilename = filename;
+	mContentHash = contentHash;
+}
+
+std::shared_ptr<const ASkeletonDef> AMotionClip::getDefinition() const
+{
+	return mDefinition;
+}
+
+void AMotionClip::setDefinition(const std::shared_ptr<const ASkeletonDef>& definition)
+{
+	mDefinition = definition;
+}
+
+double AMotionClip::getFps() const
+{
+	return mFps;
+}
+
+double AMotionClip::getDt() const
+{
+	return mDt;
+}
+
+void AMotionClip::setFrameTime(double dt)
+{
+	mDt = dt;
+	mFps = 1.0 / dt;
+}
+
+ASplineVec3& AMotionClip::getRootMotion()
+{
+	return mRootMotion;
+}
+
+const ASplineVec3& AMotionClip::getRootMotion() const
+{
+	return mRootMotion;
+}
+
+std::vector<ASplineQuat>& AMotionClip::getMotion()
+{
+	return mMotion;
+}
+
+const std::vector<ASplineQuat>& AMotionClip::getMotion() const
+{
+	return mMotion;
+}
+
+AMotionTracks& AMotionClip::getTracks()
+{
+	return mTracks;
+}
+
+const AMotionTracks& AMotionClip::getTracks() const
+{
+	return mTracks;
+}
+
+void AMotionClip::setCache(const std::shared_ptr<AMotionCache>& cache)
+{
+	mCache = cache;
+}
+
+void AMotionClip::getJointCurve(int jointID, ASplineQuat& curve) const
+{
+	if (!mMotion.empty())
+	{
+		assert(jointID >= 0 && jointID < mMotion.size());
+		curve = mMotion[jointID];
+		curve.cacheCurve();	// the clip only keeps the keys once the tracks are packed
+		return;
+	}
+
+	// A mapped clip only has the keys, the curve is built from them
+	assert(mCache);
+	const AMotionCache::Header& header = mCache->getHeader();
+	assert(jointID >= 0 && jointID < header.numJoints);
+	const double* keyTimes = mCache->getKeyTimes();
+	const quat* keys = mCache->getRotationKeys();
+	curve.clear();
+	curve.setFramerate(mFps);
+	curve.setInterpolationType(ASplineQuat::LINEAR);
+	for (int k = 0; k < header.numKeys; k++)
+	{
+		curve.appendKey(keyTimes[k], keys[k * header.numJoints + jointID], false);
+	}
+	curve.cacheCurve();
+}
+
+std::shared_ptr<const AMotionClip> AMotionClip::Find(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(gSharedClipsMutex);
+	std::map<std::string, SharedClip>::iterator shared = gSharedClips.find(filename);
+	if (shared == gSharedClips.end()) return NULL;
+
+	std::shared_ptr<const AMotionClip> clip = shared->second.clip.lock();
+	uint64_t size;
+	int64_t time;
+	if (!clip || !AMotionCache::GetSourceInfo(filename, size, time) ||
+		size != shared->second.size || time != shared->second.time)
+	{
+		return NULL;
+	}
+	return clip;
+}
+
+std::shared_ptr<const AMotionClip> AMotionClip::Share(const std::shared_ptr<const AMotionClip>& clip)
+{
+	uint64_t size;
+	int64_t time;
+	if (!AMotionCache::GetSourceInfo(clip->getFilename(), size, time)) return clip;
+
+	std::lock_guard<std::mutex> lock(gSharedClipsMutex);
+	SharedClip& shared = gSharedClips[clip->getFilename()];
+	std::shared_ptr<const AMotionClip> sharedClip = shared.clip.lock();
+	if (!sharedClip || sharedClip->getContentHash() != clip->getContentHash())
+	{
+		sharedClip = clip;
+	}
+	shared.size = size;
+	shared.time = time;
+	shared.clip = sharedClip;
+	return sharedClip;
+}
+
+int AMotionClip::GetNumSharedClips()
+{
+	std::lock_guard<std::mutex> lock(gSharedClipsMutex);
+	int numClips = 0;
+	for (std::map<std::string, SharedClip>::iterator shared = gSharedClips.begin(); shared != gSharedClips.end();)
+	{
+		if (shared->second.clip.expired()) shared = gSharedClips.erase(shared);
+		else
+		{
+			numClips++;
+			++shared;
+		}
+	}
+	return numClips;
+}
+
+uint64_t AMotionClip::Hash(const char* data, size_t size)
+{
+	// FNV-1a over 8 byte words, with a shift so that high bits reach the low ones
+	uint64_t hash = 14695981039346656037ull ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++)
+	{
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+	}
+	return hash;
+}
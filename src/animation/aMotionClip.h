@@ -0,0 +1,68 @@
+#ifndef AMotionClip_H_
+#define AMotionClip_H_
+
+#include "aSkeletonDef.h"
+#include "aSplineVec3.h"
+#include "aSplineQuat.h"
+#include "aMotionTracks.h"
+#include "aMotionCache.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Everything BVHController::load reads from a clip file: the rig definition, the root translation curve, the
+// rotation curve of every joint and their packed samples.
+// Once loaded a clip is never changed, so one copy is shared read-only by every controller that plays the same
+// file. Share and Find keep a process-wide table of the clips in use, keyed by file path and content hash.
+class AMotionClip
+{
+public:
+	AMotionClip();
+	virtual ~AMotionClip();
+
+	const std::string& getFilename() const;
+	uint64_t getContentHash() const;
+	void setSource(const std::string& filename, uint64_t contentHash);
+
+	std::shared_ptr<const ASkeletonDef> getDefinition() const;
+	void setDefinition(const std::shared_ptr<const ASkeletonDef>& definition);
+	double getFps() const;
+	double getDt() const;	// BVH frame time
+	void setFrameTime(double dt);
+
+	// The non-const accessors are for the loader, before the clip is shared
+	ASplineVec3& getRootMotion();
+	const ASplineVec3& getRootMotion() const;
+	std::vector<ASplineQuat>& getMotion();
+	const std::vector<ASplineQuat>& getMotion() const;	// rotation keys of each joint, uncached, empty for a mapped clip
+	AMotionTracks& getTracks();
+	const AMotionTracks& getTracks() const;
+	void setCache(const std::shared_ptr<AMotionCache>& cache);	// mapped .bvhc the tracks and the root curve read from
+	void getJointCurve(int jointID, ASplineQuat& curve) const;	// copy of the cached rotation curve of a joint
+
+	// The clip loaded from filename if it is still in use and the file has not changed since
+	static std::shared_ptr<const AMotionClip> Find(const std::string& filename);
+	// Makes clip the one Find returns for its file. If a clip of the same file and contents is already
+	// in use, that one is returned instead and clip can be dropped.
+	static std::shared_ptr<const AMotionClip> Share(const std::shared_ptr<const AMotionClip>& clip);
+	static int GetNumSharedClips();	// clips still in use
+	static uint64_t Hash(const char* data, size_t size);
+
+protected:
+	AMotionClip(const AMotionClip&);	// shared, never copied
+	AMotionClip& operator=(const AMotionClip&);
+
+protected:
+	std::string mFilename;
+	uint64_t mContentHash;
+	std::shared_ptr<const ASkeletonDef> mDefinition;
+	double mFps;
+	double mDt;
+	ASplineVec3 mRootMotion;
+	std::vector<ASplineQuat> mMotion;	// indexed by joint ID, keys only
+	AMotionTracks mTracks;	// packed cached samples of mMotion used for playback
+	std::shared_ptr<AMotionCache> mCache;
+};
+
+#endif
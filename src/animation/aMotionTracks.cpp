@@ -0,0 +1,152 @@
+#include "aMotionTracks.h"
+#include "aThreadPool.h"
+#include <algorithm>
+
+#pragma warning(disable:4018)
+
+AMotionTracks::AMotionTracks() : mNumTracks(0), mNumFrames(0), mStartTime(0.0), mDt(1.0 / 120.0), mLooping(true), mExternalSamples(0)
+{
+}
+
+AMotionTracks::~AMotionTracks()
+{
+}
+
+void AMotionTracks::clear()
+{
+	mNumTracks = 0;
+	mNumFrames = 0;
+	mStartTime = 0.0;
+	mSamples.clear();
+	mExternalSamples = 0;
+}
+
+void AMotionTracks::build(const std::vector<ASplineQuat>& tracks, int maxThreads)
+{
+	clear();
+	if (tracks.empty() || tracks[0].getNumKeys() == 0) return;
+
+	// All tracks of a clip share the same key times, hence the same number of cached samples
+	mNumTracks = tracks.size();
+	mNumFrames = tracks[0].getNumCurveSegments();
+	mStartTime = tracks[0].getKeyTime(0);
+	mDt = 1.0 / tracks[0].getFramerate();
+	mLooping = tracks[0].getLooping();
+
+	mSamples.resize((size_t)mNumTracks * mNumFrames);
+
+	// Threads fill blocks of whole rows, so that no two write to the same cache line
+	const int kRowsPerBlock = 256;
+	AThreadPool::Get().parallelFor(mNumFrames, [this, &tracks](int firstFrame, int endFrame)
+	{
+		for (int i = 0; i < mNumTracks; i++)
+		{
+			updateTrack(i, tracks[i], firstFrame, endFrame - 1);
+		}
+	}, kRowsPerBlock, maxThreads);
+}
+
+void AMotionTracks::setSamples(const quat* samples, int numTracks, int numFrames, double startTime, double dt, bool looping)
+{
+	clear();
+	mNumTracks = numTracks;
+	mNumFrames = numFrames;
+	mStartTime = startTime;
+	mDt = dt;
+	mLooping = looping;
+	mExternalSamples = samples;
+}
+
+void AMotionTracks::updateTrack(int trackID, const ASplineQuat& track)
+{
+	updateTrack(trackID, track, 0, mNumFrames - 1);
+}
+
+void AMotionTracks::updateTrack(int trackID, const ASplineQuat& track, int firstFrame, int lastFrame)
+{
+	assert(trackID >= 0 && trackID < mNumTracks);
+	assert(track.getNumCurveSegments() == mNumFrames);
+	assert(firstFrame >= 0 && lastFrame < mNumFrames);
+
+	if (mExternalSamples)
+	{
+		mSamples.assign(mExternalSamples, mExternalSamples + (size_t)mNumTracks * mNumFrames);
+		mExternalSamples = 0;
+	}
+	quat* sample = mSamples.data() + firstFrame * mNumTracks + trackID;
+	for (int frame = firstFrame; frame <= lastFrame; frame++, sample += mNumTracks)
+	{
+		*sample = track.getCurvePoint(frame);
+	}
+}
+
+void AMotionTracks::setLooping(bool loop)
+{
+	mLooping = loop;
+}
+
+bool AMotionTracks::getLooping() const
+{
+	return mLooping;
+}
+
+int AMotionTracks::getNumTracks() const
+{
+	return mNumTracks;
+}
+
+int AMotionTracks::getNumFrames() const
+{
+	return mNumFrames;
+}
+
+double AMotionTracks::getStartTime() const
+{
+	return mStartTime;
+}
+
+double AMotionTracks::getDeltaTime() const
+{
+	return mDt;
+}
+
+bool AMotionTracks::isEmpty() const
+{
+	return mNumFrames == 0;
+}
+
+const quat* AMotionTracks::getFrame(int frame) const
+{
+	assert(frame >= 0 && frame < mNumFrames);
+	return (mExternalSamples ? mExternalSamples : mSamples.data()) + (size_t)frame * mNumTracks;
+}
+
+void AMotionTracks::getFrameBlend(double t, int& frame0, int& frame1, double& u) const
+{
+	// Mirrors ASplineQuat::getCachedValue so that packed and per-joint sampling agree
+	assert(mNumFrames > 0);
+	if (t < mStartTime)
+	{
+		frame0 = frame1 = 0;
+		u = 0.0;
+		return;
+	}
+	t -= mStartTime;
+
+	int numFrames = (int)(t / mDt);
+	frame0 = mLooping ? numFrames % mNumFrames : std::min<int>(numFrames, mNumFrames - 1);
+	frame1 = mLooping ? (frame0 + 1) % mNumFrames : std::min<int>(frame0 + 1, mNumFrames - 1);
+	u = (t - numFrames * mDt) / mDt;
+}
+
+quat AMotionTracks::getValue(int trackID, double t) const
+{
+	if (isEmpty()) return quat();
+
+	if (t < mStartTime) return getFrame(0)[trackID];
+
+	int frame0, frame1;
+	double u;
+	getFrameBlend(t, frame0, frame1, u);
+	return quat::Slerp(getFrame(frame0)[trackID], getFrame(frame1)[trackID], u);
+}
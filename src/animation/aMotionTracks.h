@@ -0,0 +1,49 @@
+#ifndef AMotionTracks_H_
+#define AMotionTracks_H_
+
+#include "aRotation.h"
+#include "aSplineQuat.h"
+#include <vector>
+
+// Packed rotation tracks for a whole clip.
+// The cached samples of every joint's ASplineQuat are stored in one allocation, frame-major
+// (all joints of frame 0, then all joints of frame 1, ...), and indexed by joint ID.
+// Sampling a pose at time t only touches the two adjacent frame rows.
+// The samples can also live outside the tracks (e.g. in a mapped AMotionCache file), in which case they are
+// only read in place, and copied into the tracks' own storage the first time a track is updated.
+class AMotionTracks
+{
+public:
+	AMotionTracks();
+	virtual ~AMotionTracks();
+
+	void clear();
+	void build(const std::vector<ASplineQuat>& tracks, int maxThreads = 1);	// packs the cached curve of each track, on up to maxThreads threads (0 for all)
+	void setSamples(const quat* samples, int numTracks, int numFrames, double startTime, double dt, bool looping);	// uses frame-major samples in place, they must outlive the tracks
+	void updateTrack(int trackID, const ASplineQuat& track);	// re-packs a single track after an edit
+	void updateTrack(int trackID, const ASplineQuat& track, int firstFrame, int lastFrame);	// re-packs part of a track
+
+	void setLooping(bool loop);
+	bool getLooping() const;
+
+	int getNumTracks() const;
+	int getNumFrames() const;
+	double getStartTime() const;
+	double getDeltaTime() const;
+	bool isEmpty() const;
+
+	const quat* getFrame(int frame) const;	// row of getNumTracks() samples
+	void getFrameBlend(double t, int& frame0, int& frame1, double& u) const; // rows and slerp weight for time t
+	quat getValue(int trackID, double t) const;	// same result as ASplineQuat::getCachedValue
+
+protected:
+	int mNumTracks;
+	int mNumFrames;
+	double mStartTime;
+	double mDt;
+	bool mLooping;
+	std::vector<quat> mSamples;
+	const quat* mExternalSamples;	// samples given to setSamples, 0 if they are in mSamples
+};
+
+#endif
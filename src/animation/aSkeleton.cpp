@@ -1,7 +1,99 @@
 #include "aSkeleton.h"
+#include <algorithm>
+#include <cmath>
 
 #pragma warning(disable : 4018)
 
+// Pose lent to the skeletons that only hold one between beginScratchPose and endScratchPose, one per thread
+struct AScratchPose
+{
+	const ASkeleton* owner = NULL;
+	std::vector<ALocalPose> pose;
+	std::unique_ptr<bool[]> dirty;
+	int capacity = 0;
+	std::vector<ATransform> local2Parent;
+	std::vector<ATransform> local2Global;
+};
+
+static thread_local AScratchPose tScratchPose;
+
+static void ToTransform(const ALocalPose& pose, ATransform& transform)
+{
+	// scaled by the squared length, so that the rotation stays orthonormal in double precision
+	double w = pose.rotation[0], x = pose.rotation[1], y = pose.rotation[2], z = pose.rotation[3];
+	double s = 2.0 / (w * w + x * x + y * y + z * z);
+	// on the rows' elements, as the mat3 and vec3 accessors are not inlined
+	double* m0 = transform.m_rotation[0].n;
+	double* m1 = transform.m_rotation[1].n;
+	double* m2 = transform.m_rotation[2].n;
+	m0[0] = 1.0 - s * (y * y + z * z); m0[1] = s * (x * y - w * z);       m0[2] = s * (x * z + w * y);
+	m1[0] = s * (x * y + w * z);       m1[1] = 1.0 - s * (x * x + z * z); m1[2] = s * (y * z - w * x);
+	m2[0] = s * (x * z - w * y);       m2[1] = s * (y * z + w * x);       m2[2] = 1.0 - s * (x * x + y * y);
+	double* t = transform.m_translation.n;
+	t[0] = pose.translation[0]; t[1] = pose.translation[1]; t[2] = pose.translation[2];
+}
+
+// global = parent * local, summed in the same order as ATransform's operator *. global must not be either input.
+static void Compose(const ATransform& parent, const ATransform& local, ATransform& global)
+{
+	const double* a[3] = { parent.m_rotation[0].n, parent.m_rotation[1].n, parent.m_rotation[2].n };
+	const double* b[3] = { local.m_rotation[0].n, local.m_rotation[1].n, local.m_rotation[2].n };
+	const double* p = parent.m_translation.n;
+	const double* t = local.m_translation.n;
+	double* g = global.m_translation.n;
+	for (int i = 0; i < 3; i++)
+	{
+		double* r = global.m_rotation[i].n;
+		r[0] = a[i][0] * b[0][0] + a[i][1] * b[1][0] + a[i][2] * b[2][0];
+		r[1] = a[i][0] * b[0][1] + a[i][1] * b[1][1] + a[i][2] * b[2][1];
+		r[2] = a[i][0] * b[0][2] + a[i][1] * b[1][2] + a[i][2] * b[2][2];
+		g[i] = (a[i][0] * t[0] + a[i][1] * t[1] + a[i][2] * t[2]) + p[i];
+	}
+}
+
+static void ToPose(const quat& rotation, ALocalPose& pose)
+{
+	pose.rotation[0] = (float)rotation.W();
+	pose.rotation[1] = (float)rotation.X();
+	pose.rotation[2] = (float)rotation.Y();
+	pose.rotation[3] = (float)rotation.Z();
+}
+
+static void ToPose(const mat3& m, ALocalPose& pose)
+{
+	// from the largest of w x y z, so that it never divides by a small one
+	double w, x, y, z;
+	double trace = m[0][0] + m[1][1] + m[2][2];
+	if (trace > 0.0)
+	{
+		double s = 2.0 * sqrt(1.0 + trace);
+		w = 0.25 * s; x = (m[2][1] - m[1][2]) / s; y = (m[0][2] - m[2][0]) / s; z = (m[1][0] - m[0][1]) / s;
+	}
+	else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+	{
+		double s = 2.0 * sqrt(1.0 + m[0][0] - m[1][1] - m[2][2]);
+		w = (m[2][1] - m[1][2]) / s; x = 0.25 * s; y = (m[0][1] + m[1][0]) / s; z = (m[0][2] + m[2][0]) / s;
+	}
+	else if (m[1][1] > m[2][2])
+	{
+		double s = 2.0 * sqrt(1.0 + m[1][1] - m[0][0] - m[2][2]);
+		w = (m[0][2] - m[2][0]) / s; x = (m[0][1] + m[1][0]) / s; y = 0.25 * s; z = (m[1][2] + m[2][1]) / s;
+	}
+	else
+	{
+		double s = 2.0 * sqrt(1.0 + m[2][2] - m[0][0] - m[1][1]);
+		w = (m[1][0] - m[0][1]) / s; x = (m[0][2] + m[2][0]) / s; y = (m[1][2] + m[2][1]) / s; z = 0.25 * s;
+	}
+	ToPose(quat(w, x, y, z), pose);
+}
+
+static void ToPose(const vec3& translation, ALocalPose& pose)
+{
+	pose.translation[0] = (float)translation[0];
+	pose.translation[1] = (float)translation[1];
+	pose.translation[2] = (float)translation[2];
+}
+
 
 /****************************************************************
 *
@@ -36,50 +128,21 @@ ASkeleton& ASkeleton::operator = (const ASkeleton& inputSkeleton)
 }
 void ASkeleton::copyHierarchy(const ASkeleton* inputSkeleton)
 {
-	// Performs a deep copy which includes joint hiearchy (mJoints) and transform data	
+	// Shares the joint hiearchy of the input skeleton and copies its transform data
 	if (inputSkeleton == this)
 	{
 		return;
 	}
 
-	// mJoints.clear();	// Memory leak here!
-	for each (AJoint* joint in mJoints)
-	{
-		delete joint;
-	}
-	mJoints.clear();
-	mRoot = 0;
-
-	// Copy joints
-	for (unsigned int i = 0; i < inputSkeleton->mJoints.size(); i++)
+	setDefinition(inputSkeleton->getDefinition());
+	if (mPose && inputSkeleton->mPose)
 	{
-		AJoint* jointnode = new AJoint(*(inputSkeleton->mJoints[i]));
-		mJoints.push_back(jointnode);
-		//std::cout << "Copy " << jointnode->GetName() << std::endl;
+		std::copy(inputSkeleton->mPose, inputSkeleton->mPose + mJoints.size(), mPose);
 	}
-
-	// Copy parent/children relationships
-	for (unsigned int i = 0; i < inputSkeleton->mJoints.size(); i++)
+	if (!mScratchPose && mLocal2Global && !inputSkeleton->mScratchPose && inputSkeleton->mLocal2Global)
 	{
-		AJoint* jointnode = inputSkeleton->mJoints[i];
-		if (jointnode->getParent())
-		{
-			AJoint* parent = mJoints[jointnode->getParent()->getID()];
-			mJoints[i]->setParent(parent);
-		}
-		else
-		{
-			mRoot = mJoints[i];
-			mRoot->setParent(0);
-		}
-
-		for (unsigned int j = 0; j < jointnode->getNumChildren(); j++)
-		{
-			AJoint* child = mJoints[jointnode->getChildAt(j)->getID()];
-			mJoints[i]->appendChild(child);
-		}
+		std::copy(inputSkeleton->mLocal2Global, inputSkeleton->mLocal2Global + mJoints.size(), mLocal2Global);
 	}
-	mJointCount = mJoints.size();
 }
 
 
@@ -92,23 +155,77 @@ void ASkeleton::copyTransforms(const ASkeleton* inputSkeleton)
 	}
 
 	if (this->getNumJoints() != inputSkeleton->getNumJoints())
+	{
 		assert(0);
+		return;
+	}
 	else mJointCount = inputSkeleton->getNumJoints();
 
-	AJoint* pJointInput;
-	AJoint* pJoint;
+	// Both skeletons keep their transforms in flat arrays indexed by joint ID
+	std::copy(inputSkeleton->mPose, inputSkeleton->mPose + mJoints.size(), mPose);
+	std::copy(inputSkeleton->mDirty, inputSkeleton->mDirty + mJoints.size(), mDirty);
+	if (!mLocal2Global) return;
 
-	for (int i = 0; i < mJointCount; i++) {
-		pJoint = this->mJoints[i];
-		pJointInput = inputSkeleton->mJoints[i];
+	// Same state as the input if it keeps all its globals, otherwise recomputed from the copied pose
+	if (!mScratchPose && !inputSkeleton->mScratchPose && inputSkeleton->mLocal2Global)
+	{
+		std::copy(inputSkeleton->mLocal2Global, inputSkeleton->mLocal2Global + mJoints.size(), mLocal2Global);
+		return;
+	}
+	for (int i = 0; mLocal2Parent && i < mJoints.size(); i++)
+	{
+		ToTransform(mPose[i], mLocal2Parent[i]);
+	}
+	if (mRoot) updateFKRange(mDefinition->getFKIndex()[mRoot->getID()]);
+}
 
-		if (pJoint) {
-			pJoint->setLocal2Global(pJointInput->getLocal2Global());
-			pJoint->setLocal2Parent(pJointInput->getLocal2Parent());
-		}
-		else assert(pJoint);
+void ASkeleton::copySubtreeTransforms(const ASkeleton* inputSkeleton, int jointID)
+{
+	if (inputSkeleton == this)
+	{
+		return;
+	}
+	assert(getNumJoints() == inputSkeleton->getNumJoints());
+
+	updateTopology();
+	int start = jointID >= 0 && jointID < mJoints.size() ? mDefinition->getFKIndex()[jointID] : -1;
+	if (start < 0)
+	{
+		copyTransforms(inputSkeleton);
+		return;
+	}
+
+	// The subtree is a contiguous run of the FK order
+	int end = mDefinition->getSubtreeEnd()[start];
+	const int* order = mDefinition->getFKOrder().data();
+	for (int i = start; i < end; i++)
+	{
+		int id = order[i];
+		mPose[id] = inputSkeleton->mPose[id];
+		mDirty[id] = inputSkeleton->mDirty[id];
+	}
+	if (!mLocal2Global) return;
 
+	for (int i = start; mLocal2Parent && i < end; i++)
+	{
+		ToTransform(mPose[order[i]], mLocal2Parent[order[i]]);
+	}
+	int parentID = mDefinition->getParentID(jointID);
+	if (parentID >= 0)
+	{
+		mLocal2Global[parentID] = inputSkeleton->getLocal2Global(parentID);
 	}
+	// The globals of the subtree are copied if the input keeps them, as of its last update, like its other
+	// global reads. Otherwise they follow from the parent's.
+	if (inputSkeleton->mLocal2Global)
+	{
+		for (int i = start; i < end; i++)
+		{
+			mLocal2Global[order[i]] = inputSkeleton->mLocal2Global[order[i]];
+		}
+		return;
+	}
+	updateFKRange(start);
 }
 
 ASkeleton::~ASkeleton()
@@ -118,20 +235,480 @@ ASkeleton::~ASkeleton()
 
 void ASkeleton::clear()
 {
+	if (tScratchPose.owner == this) endScratchPose();
+	if (mOwnsJoints) deleteJoints();
+	unbindPose();
 	mRoot = NULL;
 	mJoints.clear();
+	mDefinition.reset();
+	mTopologyDirty = true;
+	mInstanced = false;
+	mOwnsJoints = false;
+}
+
+std::shared_ptr<const ASkeletonDef> ASkeleton::getDefinition() const
+{
+	updateTopology();
+	return mDefinition;
+}
+
+void ASkeleton::setDefinition(const std::shared_ptr<const ASkeletonDef>& definition)
+{
+	deleteJoints();
+	unbindPose();
+	mDefinition = definition;
+	int numJoints = definition ? definition->getNumJoints() : 0;
+	mInstanced = numJoints > 0;
+	mOwnsJoints = mInstanced;
+	mTopologyDirty = !mInstanced;
+	mJoints.assign(numJoints, NULL);
+	mJointCount = numJoints;
+
+	allocatePose(numJoints);
+	mRoot = mInstanced && definition->getRootID() >= 0 ? getJointByID(definition->getRootID()) : NULL;
 }
 
 void ASkeleton::update()
 {
-	if (!mRoot) return; // Nothing loaded
+	if (!mRoot || !mPose) return; // Nothing loaded
 
 	// TODO: Update Joint Transforms recursively, starting at the root
-	mRoot->updateTransform();
+	// The hierarchy is flattened so that parents come before children, so FK is a single forward loop.
+	// Only joints that were set since the last update, or whose parent was recomputed, are touched.
+	updateTopology();
+	int numFKJoints = mDefinition->getFKOrder().size();
+	const int* order = mDefinition->getFKOrder().data();
+	const int* parents = mDefinition->getParentIDs().data();
+	bool* dirty = mDirty;
+	if (mLocal2Global)
+	{
+		for (int i = 0; i < numFKJoints; i++)
+		{
+			int id = order[i];
+			int parentID = parents[id];
+			if (parentID >= 0 && dirty[parentID]) dirty[id] = true;
+			if (dirty[id]) updateGlobal(id);
+		}
+	}
+	for (int i = 0; i < numFKJoints; i++)
+	{
+		dirty[order[i]] = false;
+	}
+}
+
+void ASkeleton::updateSubtree(AJoint* joint)
+{
+	if (!joint) return;
+	if (joint->getSkeleton() != this)
+	{
+		joint->updateTransform();
+		return;
+	}
+
+	updateTopology();
+	int start = mDefinition->getFKIndex()[joint->getID()];
+	if (start < 0)
+	{
+		updateGlobal(joint->getID());
+		mDirty[joint->getID()] = false;
+		return;
+	}
+	updateFKRange(start);
+}
+
+void ASkeleton::updateFKRange(int start)
+{
+	int end = mDefinition->getSubtreeEnd()[start];
+	const int* order = mDefinition->getFKOrder().data();
+	for (int i = start; i < end; i++)
+	{
+		updateGlobal(order[i]);
+		mDirty[order[i]] = false;
+	}
+}
+
+void ASkeleton::updateJoint(AJoint* joint)
+{
+	if (!joint) return;
+	if (joint->getSkeleton() != this)
+	{
+		joint->updateTransform();
+		return;
+	}
+
+	updateTopology();
+	updateGlobal(joint->getID());
+}
+
+void ASkeleton::updateGlobal(int id)
+{
+	if (!mLocal2Global) return;
+	int parentID = mDefinition->getParentID(id);
+	if (mLocal2Parent)
+	{
+		if (parentID < 0) mLocal2Global[id] = mLocal2Parent[id];
+		else Compose(mLocal2Global[parentID], mLocal2Parent[id], mLocal2Global[id]);
+		return;
+	}
+	if (parentID < 0)
+	{
+		ToTransform(mPose[id], mLocal2Global[id]);
+		return;
+	}
+	ATransform local2Parent;
+	ToTransform(mPose[id], local2Parent);
+	Compose(mLocal2Global[parentID], local2Parent, mLocal2Global[id]);
+}
+
+void ASkeleton::updateDirtySubtree(int jointID)
+{
+	if (!mRoot || !mPose) return;
+
+	updateTopology();
+	int start = jointID >= 0 && jointID < mJoints.size() ? mDefinition->getFKIndex()[jointID] : -1;
+	if (start < 0) return;
+
+	int end = mDefinition->getSubtreeEnd()[start];
+	const int* order = mDefinition->getFKOrder().data();
+	const int* parents = mDefinition->getParentIDs().data();
+	bool* dirty = mDirty;
+	if (mLocal2Global)
+	{
+		for (int i = start; i < end; i++)
+		{
+			int id = order[i];
+			int parentID = parents[id];
+			if (i > start && dirty[parentID]) dirty[id] = true;
+			if (dirty[id]) updateGlobal(id);
+		}
+	}
+	for (int i = start; i < end; i++)
+	{
+		dirty[order[i]] = false;
+	}
+}
+
+const std::vector<int>& ASkeleton::getParentIDs()
+{
+	updateTopology();
+	return mDefinition->getParentIDs();
+}
+
+const std::vector<int>& ASkeleton::getFKOrder()
+{
+	updateTopology();
+	return mDefinition->getFKOrder();
+}
+
+const ALocalPose* ASkeleton::getLocalPoseData() const
+{
+	return mPose;
+}
+
+ATransform ASkeleton::getLocal2Parent(int id) const
+{
+	if (mLocal2Parent) return mLocal2Parent[id];
+	ATransform local2Parent;
+	ToTransform(mPose[id], local2Parent);
+	return local2Parent;
+}
+
+ATransform ASkeleton::getLocal2Global(int id) const
+{
+	if (mLocal2Global) return mLocal2Global[id];
+
+	updateTopology();
+	const int* parents = mDefinition->getParentIDs().data();
+	ATransform local2Global, local2Parent;
+	ToTransform(mPose[id], local2Global);
+	for (int parentID = parents[id]; parentID >= 0; parentID = parents[parentID])
+	{
+		ToTransform(mPose[parentID], local2Parent);
+		local2Global = local2Parent * local2Global;
+	}
+	return local2Global;
+}
+
+void ASkeleton::getLocal2Global(std::vector<ATransform>& local2Global) const
+{
+	local2Global.resize(mJoints.size());
+	if (mLocal2Global)
+	{
+		std::copy(mLocal2Global, mLocal2Global + mJoints.size(), local2Global.begin());
+		return;
+	}
+
+	updateTopology();
+	const std::vector<int>& fkIndex = mDefinition->getFKIndex();
+	const int* order = mDefinition->getFKOrder().data();
+	const int* parents = mDefinition->getParentIDs().data();
+	int numFKJoints = mDefinition->getFKOrder().size();
+	ATransform local2Parent;
+	for (int i = 0; i < numFKJoints; i++)
+	{
+		int id = order[i];
+		int parentID = parents[id];
+		ToTransform(mPose[id], local2Parent);
+		if (parentID < 0) local2Global[id] = local2Parent;
+		else Compose(local2Global[parentID], local2Parent, local2Global[id]);
+	}
+	for (int id = 0; id < mJoints.size(); id++)
+	{
+		if (fkIndex[id] < 0) local2Global[id] = getLocal2Global(id);
+	}
+}
+
+void ASkeleton::setLocal2Parent(int id, const ATransform& transform)
+{
+	ToPose(transform.m_rotation, mPose[id]);
+	ToPose(transform.m_translation, mPose[id]);
+	if (mLocal2Parent) ToTransform(mPose[id], mLocal2Parent[id]);
+	mDirty[id] = true;
+}
+
+void ASkeleton::setLocalTranslation(int id, const vec3& translation)
+{
+	ToPose(translation, mPose[id]);
+	if (mLocal2Parent) ToTransform(mPose[id], mLocal2Parent[id]);
+	mDirty[id] = true;
+}
+
+void ASkeleton::setLocalRotation(int id, const mat3& rotation)
+{
+	ToPose(rotation, mPose[id]);
+	if (mLocal2Parent) ToTransform(mPose[id], mLocal2Parent[id]);
+	mDirty[id] = true;
+}
+
+void ASkeleton::setLocalRotation(int id, const quat& rotation)
+{
+	ToPose(rotation, mPose[id]);
+	if (mLocal2Parent) ToTransform(mPose[id], mLocal2Parent[id]);
+	mDirty[id] = true;
+}
+
+void ASkeleton::setLocal2Global(int id, const ATransform& transform)
+{
+	updateTopology();
+	int parentID = mDefinition->getParentID(id);
+	if (parentID < 0)
+	{
+		setLocal2Parent(id, transform);
+	}
+	else
+	{
+		ATransform parent = getLocal2Global(parentID);
+		mat3 inverse = parent.m_rotation.Transpose();
+		setLocal2Parent(id, ATransform(inverse * transform.m_rotation, inverse * (transform.m_translation - parent.m_translation)));
+	}
+	updateGlobal(id);
+}
+
+void ASkeleton::setCachedGlobals(bool cachedGlobals)
+{
+	if (cachedGlobals == mCachedGlobals) return;
+	mCachedGlobals = cachedGlobals;
+	if (mScratchPose || !mPose) return;
+
+	mOwnLocal2Global.clear();
+	mOwnLocal2Global.shrink_to_fit();
+	mLocal2Global = NULL;
+	if (mCachedGlobals)
+	{
+		mOwnLocal2Global.resize(mJoints.size());
+		mLocal2Global = mOwnLocal2Global.data();
+		for (int i = 0; i < mJoints.size(); i++)
+		{
+			mDirty[i] = true;
+		}
+		update();
+	}
+}
+
+void ASkeleton::setScratchPose(bool scratchPose)
+{
+	if (scratchPose == mScratchPose) return;
+	mScratchPose = scratchPose;
+	allocatePose(mJoints.size());
+}
+
+void ASkeleton::beginScratchPose()
+{
+	assert(mScratchPose && !tScratchPose.owner);
+	AScratchPose& scratch = tScratchPose;
+	int numJoints = mJoints.size();
+	scratch.owner = this;
+	scratch.pose.resize(numJoints);
+	scratch.local2Parent.resize(numJoints);
+	scratch.local2Global.resize(numJoints);
+	if (scratch.capacity < numJoints)
+	{
+		scratch.dirty.reset(new bool[numJoints]);
+		scratch.capacity = numJoints;
+	}
+	mPose = scratch.pose.data();
+	mDirty = scratch.dirty.get();
+	mLocal2Parent = scratch.local2Parent.data();
+	mLocal2Global = scratch.local2Global.data();
+}
+
+void ASkeleton::endScratchPose()
+{
+	assert(tScratchPose.owner == this);
+	tScratchPose.owner = NULL;
+	mPose = NULL;
+	mDirty = NULL;
+	mLocal2Parent = NULL;
+	mLocal2Global = NULL;
+}
+
+void ASkeleton::allocatePose(int numJoints)
+{
+	// Rest pose, the same as a freshly loaded skeleton
+	mOwnPose.clear();
+	mOwnDirty.reset();
+	mOwnLocal2Global.clear();
+	mPose = NULL;
+	mDirty = NULL;
+	mLocal2Global = NULL;
+	if (mScratchPose) return;
+
+	ALocalPose rest = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+	mOwnPose.assign(numJoints, rest);
+	mOwnDirty.reset(new bool[numJoints]);
+	mPose = mOwnPose.data();
+	mDirty = mOwnDirty.get();
+	if (mCachedGlobals)
+	{
+		mOwnLocal2Global.resize(numJoints);
+		mLocal2Global = mOwnLocal2Global.data();
+	}
+	for (int i = 0; i < numJoints; i++)
+	{
+		if (mDefinition && mInstanced) ToPose(mDefinition->getOffset(i), mPose[i]);
+		mDirty[i] = true;
+	}
+}
+
+void ASkeleton::invalidateTopology()
+{
+	makeUnique();
+	mTopologyDirty = true;
+}
+
+AJoint* ASkeleton::getParentJoint(int id) const
+{
+	int parentID = mDefinition->getParentID(id);
+	return parentID < 0 ? NULL : getJointByID(parentID);
+}
+
+unsigned int ASkeleton::getNumChildJoints(int id) const
+{
+	return mDefinition->getNumChildren(id);
+}
+
+AJoint* ASkeleton::getChildJoint(int id, unsigned int index) const
+{
+	assert(index < mDefinition->getNumChildren(id));
+	return getJointByID(mDefinition->getChildID(id, index));
+}
+
+void ASkeleton::bindPose()
+{
+	// Gather the current transforms first; the joints may still read from the old pose
+	std::vector<ATransform> local2Parent(mJoints.size());
+	for (int i = 0; i < mJoints.size(); i++)
+	{
+		local2Parent[i] = mJoints[i]->getLocal2Parent();
+	}
+	allocatePose(mJoints.size());
+
+	for (int i = 0; i < mJoints.size(); i++)
+	{
+		mJoints[i]->bindTransforms(this);
+		if (mPose) setLocal2Parent(i, local2Parent[i]);
+	}
+	mTopologyDirty = true;
+}
+
+void ASkeleton::unbindPose()
+{
+	for (int i = 0; i < mJoints.size(); i++)
+	{
+		if (mJoints[i] && mJoints[i]->getSkeleton() == this) mJoints[i]->unbindTransforms();
+	}
+	mOwnPose.clear();
+	mOwnDirty.reset();
+	mOwnLocal2Global.clear();
+	mPose = NULL;
+	mDirty = NULL;
+	mLocal2Global = NULL;
+}
+
+void ASkeleton::updateTopology() const
+{
+	if (!mTopologyDirty) return;
+
+	mDefinition = ASkeletonDef::Create(mJoints, mRoot);
+
+	// A new order may reach joints that were never computed
+	for (int i = 0; mDirty && i < mJoints.size(); i++)
+	{
+		mDirty[i] = true;
+	}
+	mTopologyDirty = false;
+}
+
+AJoint* ASkeleton::createJoint(int id) const
+{
+	AJoint* joint = new AJoint(mDefinition->getName(id));
+	joint->setID(id);
+	joint->setNumChannels(mDefinition->getNumChannels(id));
+	joint->setRotationOrder(mDefinition->getRotationOrder(id));
+
+	joint->bindTransforms(const_cast<ASkeleton*>(this));
+	return joint;
+}
+
+void ASkeleton::deleteJoints()
+{
+	for (int i = 0; i < mJoints.size(); i++)
+	{
+		delete mJoints[i];
+	}
+	mJoints.clear();
+	mRoot = NULL;
+}
+
+void ASkeleton::makeUnique()
+{
+	if (!mInstanced) return;
+
+	for (int i = 0; i < mJoints.size(); i++)
+	{
+		getJointByID(i);
+	}
+	mInstanced = false;
+
+	// From here on the joints answer with their own links
+	for (int i = 0; i < mJoints.size(); i++)
+	{
+		int parentID = mDefinition->getParentID(i);
+		if (parentID >= 0) mJoints[i]->setParent(mJoints[parentID]);
+		for (unsigned int j = 0; j < mDefinition->getNumChildren(i); j++)
+		{
+			mJoints[i]->appendChild(mJoints[mDefinition->getChildID(i, j)]);
+		}
+	}
 }
 
 AJoint* ASkeleton::getJointByName(const std::string& name) const
 {
+	if (mInstanced)
+	{
+		int id = mDefinition->findJoint(name);
+		return id < 0 ? NULL : getJointByID(id);
+	}
 	for (int i = 0; i < mJoints.size(); i++)
 	{
 		if (name == mJoints[i]->getName())
@@ -144,6 +721,11 @@ AJoint* ASkeleton::getJointByName(const std::string& name) const
 AJoint* ASkeleton::getJointByID(unsigned int id) const
 {
 	assert(id >= 0 && id < mJoints.size());
+	if (!mInstanced) return mJoints[id];
+
+	// Parallel jobs may read the same instance, so the joints are created under the lock
+	std::lock_guard<std::mutex> lock(mJointsMutex);
+	if (!mJoints[id]) mJoints[id] = createJoint(id);
 	return mJoints[id];
 }
 
@@ -154,14 +736,17 @@ AJoint* ASkeleton::getRootNode() const
 
 void ASkeleton::addJoint(AJoint* jointnode, bool isRoot)
 {
+	makeUnique();
 	jointnode->setID(mJoints.size());
 	mJoints.push_back(jointnode);
 	if (isRoot) mRoot = jointnode;
 	mJointCount = mJoints.size();
+	bindPose();
 }
 
 void ASkeleton::deleteJoint(const std::string& name)
 {
+	makeUnique();
 	AJoint* jointnode = getJointByName(name);
 	if (!jointnode) return; // no work to do
 
@@ -172,6 +757,9 @@ void ASkeleton::deleteJoint(const std::string& name)
 		deleteJoint(child->getName());
 	}
 
+	// The joints read their transforms by ID, so they take them back while the IDs move
+	unbindPose();
+
 	// Re-assign ids and delete orphans
 	AJoint* parent = jointnode->getParent();
 	if (parent)
@@ -187,4 +775,5 @@ void ASkeleton::deleteJoint(const std::string& name)
 	mJoints.resize(mJoints.size() - 1);
 	delete jointnode;
 	mJointCount = mJoints.size();
+	bindPose();
 }
@@ -3,7 +3,18 @@
 
 #include "aTransform.h"
 #include "aJoint.h"
+#include "aSkeletonDef.h"
 #include <vector>
+#include <memory>
+#include <mutex>
+
+// Local transform of a joint in single precision, 28 bytes: the rotation as a unit quaternion w x y z and the
+// translation. This is all the pose a skeleton keeps.
+struct ALocalPose
+{
+	float rotation[4];
+	float translation[3];
+};
 
 // Class for createing hierarchies of joints
 
@@ -15,15 +26,25 @@ public:
 	ASkeleton(const ASkeleton& inputSkeleton); // Deep copy
 
 	virtual ~ASkeleton();
-	virtual void update();
+	virtual void update();  // recomputes the global transforms of dirty joints and their descendants
 	virtual void clear();
 
 	// new/revised functions
 	virtual ASkeleton& operator=(const ASkeleton& inputSkeleton); // Copies both joint hiearchy and transforms of the input skeleton
-	virtual void copyHierarchy(const ASkeleton* inputSkeleton);  // copies the input skeleton joint hierarchy
+	virtual void copyHierarchy(const ASkeleton* inputSkeleton);  // shares the input skeleton joint hierarchy and copies its pose
 	virtual void copyTransforms(const ASkeleton* inputSkeleton); // assumes the same joint hierarchy as input skeleton and copies joint transforms
+	// Copies the transforms of joint jointID and its descendants, and the global transform of its parent, so that
+	// updateSubtree can run on that joint. Assumes the same joint hierarchy as the input skeleton.
+	void copySubtreeTransforms(const ASkeleton* inputSkeleton, int jointID);
 	// end new/ revised functions
 
+	// The joint hierarchy as an immutable definition, shared with every skeleton instanced from it.
+	// An instance keeps only its pose and creates its AJoint objects the first time they are asked for;
+	// editing its hierarchy gives it joints of its own again.
+	std::shared_ptr<const ASkeletonDef> getDefinition() const;
+	void setDefinition(const std::shared_ptr<const ASkeletonDef>& definition);  // instances definition in its rest pose
+	bool isInstanced() const { return mInstanced; }
+
 	AJoint* getJointByName(const std::string& name) const;
 	AJoint* getJointByID(unsigned int id) const;
 	AJoint* getRootNode() const;
@@ -33,10 +54,85 @@ public:
 
 	size_t getNumJoints() const { return mJoints.size(); }
 
+	// The pose, indexed by joint ID. A skeleton keeps the local transforms in single precision, and by default the
+	// global transforms in double precision, which update computes in one FK pass over the dirty subtrees. As
+	// before, a global read between a setter and update gives the value of the last update. A skeleton without
+	// cached globals computes one when it is asked for, walking up to the root. The AJoint transform accessors
+	// go through these.
+	const std::vector<int>& getParentIDs();     // parent joint ID of each joint, -1 if none
+	const std::vector<int>& getFKOrder();       // joint IDs reachable from the root, parents before children
+	const ALocalPose* getLocalPoseData() const;
+	ATransform getLocal2Parent(int id) const;
+	ATransform getLocal2Global(int id) const;
+	void getLocal2Global(std::vector<ATransform>& local2Global) const;  // all joints, in one FK pass
+	void setLocal2Parent(int id, const ATransform& transform);  // same as the AJoint setters, without the joint
+	void setLocalTranslation(int id, const vec3& translation);
+	void setLocalRotation(int id, const mat3& rotation);
+	void setLocalRotation(int id, const quat& rotation);
+	void setLocal2Global(int id, const ATransform& transform);  // sets the local transform that gives it
+	bool isDirty(int id) const { return mDirty[id]; }
+	// Drops or restores the global transforms of a skeleton with its own pose, 96 bytes a joint. Worth turning
+	// off for crowds that only read their globals with getLocal2Global(std::vector&) once a frame.
+	void setCachedGlobals(bool cachedGlobals);
+	bool hasCachedGlobals() const { return mLocal2Global != NULL; }
+	void invalidateTopology();  // called by AJoint before a parent/child link or joint attribute changes
+
+	// Links of the joints of an instance, looked up in the definition
+	AJoint* getParentJoint(int id) const;
+	unsigned int getNumChildJoints(int id) const;
+	AJoint* getChildJoint(int id, unsigned int index) const;
+
+	// Recomputes the global transforms of joint and all its descendants, dirty or not.
+	// Assumes the ancestors of joint are up to date.
+	void updateSubtree(AJoint* joint);
+	// Recomputes the global transform of joint alone, from its parent's. Its descendants are left as they are.
+	void updateJoint(AJoint* joint);
+	// Same as update, for joint jointID and its descendants only. A dirty parent of jointID is not looked at.
+	void updateDirtySubtree(int jointID);
+	// Without cached globals, the update functions just clear the dirty flags.
+
+	// A skeleton that is only posed for short spans, like the IK skeleton during a solve, can keep no pose of its
+	// own. Between beginScratchPose and endScratchPose it uses the scratch pose of the calling thread, which also
+	// holds the local and global transforms in double precision so that solvers read them without walking the
+	// hierarchy. Only the transforms copied in since beginScratchPose are valid, and one skeleton per thread can
+	// hold the scratch pose at a time.
+	void setScratchPose(bool scratchPose);
+	void beginScratchPose();
+	void endScratchPose();
+
 protected:
-	std::vector<AJoint*> mJoints;
+	void bindPose();           // rebuilds the pose from the joints and points every joint at it
+	void unbindPose();         // hands the transforms back to the joints
+	void allocatePose(int numJoints);  // own pose of numJoints joints in the rest pose, none for a scratch pose skeleton
+	void updateTopology() const;  // rebuilds mDefinition from the joints if the hierarchy changed
+	void updateGlobal(int id);  // global transform of joint id from its parent's, with the scratch pose
+	void updateFKRange(int start);  // updateSubtree of the joint at start in the FK order
+	AJoint* createJoint(int id) const;  // AJoint view of a joint of an instance
+	void deleteJoints();
+	void makeUnique();         // gives an instance joints and links of its own
+
+	mutable std::vector<AJoint*> mJoints;  // null for joints of an instance that were not asked for yet
+	mutable std::mutex mJointsMutex;  // guards the creation of the joints of an instance, which can be read by many threads
 	int mJointCount = 0;
 	AJoint* mRoot;
+
+	mutable std::shared_ptr<const ASkeletonDef> mDefinition;  // parent IDs, FK order and subtree ranges
+
+	// mPose, mDirty and mLocal2Global point at mOwnPose, mOwnDirty and mOwnLocal2Global, or at the scratch pose
+	// of the thread, which also sets mLocal2Parent
+	ALocalPose* mPose = NULL;
+	bool* mDirty = NULL;  // per joint, set by the transform setters
+	ATransform* mLocal2Parent = NULL;
+	ATransform* mLocal2Global = NULL;
+	std::vector<ALocalPose> mOwnPose;
+	std::unique_ptr<bool[]> mOwnDirty;
+	std::vector<ATransform> mOwnLocal2Global;  // empty without cached globals
+	bool mCachedGlobals = true;
+	bool mScratchPose = false;
+
+	mutable bool mTopologyDirty = true;
+	bool mInstanced = false;
+	bool mOwnsJoints = false;  // the joints were created by the skeleton
 };
 
 
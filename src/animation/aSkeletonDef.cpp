@@ -0,0 +1,122 @@
+#include "aSkeletonDef.h"
+#include "aJoint.h"
+#include "aMotionCache.h"
+
+#pragma warning(disable : 4018)
+
+std::shared_ptr<const ASkeletonDef> ASkeletonDef::Create(const std::vector<AJoint*>& joints, const AJoint* root)
+{
+	std::shared_ptr<ASkeletonDef> def(new ASkeletonDef());
+	int numJoints = joints.size();
+	def->mNames.resize(numJoints);
+	def->mParentIDs.assign(numJoints, -1);
+	def->mNumChannels.resize(numJoints);
+	def->mRotOrders.resize(numJoints);
+	def->mOffsets.resize(numJoints);
+	def->mChildStart.assign(numJoints + 1, 0);
+	for (int i = 0; i < numJoints; i++)
+	{
+		AJoint* joint = joints[i];
+		def->mNames[i] = joint->getName();
+		def->mNumChannels[i] = joint->getNumChannels();
+		def->mRotOrders[i] = joint->getRotationOrder();
+		def->mOffsets[i] = joint->getLocalTranslation();
+
+		AJoint* parent = joint->getParent();
+		if (parent && parent->getID() >= 0 && parent->getID() < numJoints && joints[parent->getID()] == parent)
+		{
+			def->mParentIDs[i] = parent->getID();
+		}
+		if (joint == root) def->mRootID = i;
+
+		def->mChildStart[i + 1] = def->mChildStart[i];
+		for (unsigned int j = 0; j < joint->getNumChildren(); j++)
+		{
+			def->mChildIDs.push_back(joint->getChildAt(j)->getID());
+			def->mChildStart[i + 1]++;
+		}
+	}
+
+	def->computeFKOrder();
+	return def;
+}
+
+std::shared_ptr<const ASkeletonDef> ASkeletonDef::Create(const AMotionCache& cache)
+{
+	std::shared_ptr<ASkeletonDef> def(new ASkeletonDef());
+	int numJoints = cache.getHeader().numJoints;
+	def->mNames.resize(numJoints);
+	def->mParentIDs.resize(numJoints);
+	def->mNumChannels.resize(numJoints);
+	def->mRotOrders.resize(numJoints);
+	def->mOffsets.resize(numJoints);
+	def->mChildStart.assign(numJoints + 1, 0);
+	def->mChildIDs.resize(numJoints > 0 ? numJoints - 1 : 0);
+	def->mRootID = numJoints > 0 ? 0 : -1;  // AMotionCache::open checks that joint 0 is the only root
+	for (int i = 0; i < numJoints; i++)
+	{
+		const AMotionCache::JointRecord& record = cache.getJoint(i);
+		def->mNames[i] = cache.getJointName(i);
+		def->mParentIDs[i] = record.parentID;
+		def->mNumChannels[i] = record.numChannels;
+		def->mRotOrders[i] = cache.getJointRotationOrder(i);
+		def->mOffsets[i] = vec3(record.offset[0], record.offset[1], record.offset[2]);
+		if (record.parentID >= 0) def->mChildStart[record.parentID + 1]++;
+	}
+
+	// Children in ID order, the order the loader attached them in
+	for (int i = 0; i < numJoints; i++)
+	{
+		def->mChildStart[i + 1] += def->mChildStart[i];
+	}
+	std::vector<int> numChildren(numJoints, 0);
+	for (int i = 1; i < numJoints; i++)
+	{
+		int parentID = def->mParentIDs[i];
+		def->mChildIDs[def->mChildStart[parentID] + numChildren[parentID]++] = i;
+	}
+	def->computeFKOrder();
+	return def;
+}
+
+void ASkeletonDef::computeFKOrder()
+{
+	// Depth-first order from the root, matching the recursive AJoint::updateTransform traversal
+	int numJoints = mNames.size();
+	mFKOrder.reserve(numJoints);
+	if (mRootID >= 0)
+	{
+		std::vector<int> stack(1, mRootID);
+		while (!stack.empty())
+		{
+			int id = stack.back();
+			stack.pop_back();
+			mFKOrder.push_back(id);
+			for (int i = getNumChildren(id) - 1; i >= 0; i--)
+			{
+				stack.push_back(getChildID(id, i));
+			}
+		}
+	}
+
+	// Every subtree is a contiguous run of mFKOrder; sizes accumulate from the leaves up
+	mFKIndex.assign(numJoints, -1);
+	mSubtreeEnd.assign(mFKOrder.size(), 0);
+	std::vector<int> subtreeSize(numJoints, 1);
+	for (int i = mFKOrder.size() - 1; i >= 0; i--)
+	{
+		int id = mFKOrder[i];
+		mFKIndex[id] = i;
+		mSubtreeEnd[i] = i + subtreeSize[id];
+		if (mParentIDs[id] >= 0) subtreeSize[mParentIDs[id]] += subtreeSize[id];
+	}
+}
+
+int ASkeletonDef::findJoint(const std::string& name) const
+{
+	for (int i = 0; i < mNames.size(); i++)
+	{
+		if (name == mNames[i]) return i;
+	}
+	return -1;
+}
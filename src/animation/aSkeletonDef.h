@@ -0,0 +1,58 @@
+#ifndef ASKELETONDEF_H_
+#define ASKELETONDEF_H_
+
+#include "aVector.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class AJoint;
+class AMotionCache;
+
+// Immutable description of a rig: joint names, parent indices, offsets and channel layout, plus the
+// flattened FK order. Skeletons of the same rig share one definition through a shared_ptr and each keeps
+// only its own pose (see ASkeleton::setDefinition).
+class ASkeletonDef
+{
+public:
+	// Snapshot of a joint hierarchy. joints are indexed by ID; a parent outside joints counts as none.
+	static std::shared_ptr<const ASkeletonDef> Create(const std::vector<AJoint*>& joints, const AJoint* root);
+	// The rig of a compiled clip, from its joint records without building any AJoint
+	static std::shared_ptr<const ASkeletonDef> Create(const AMotionCache& cache);
+
+	int getNumJoints() const { return (int)mNames.size(); }
+	int getRootID() const { return mRootID; }  // -1 if none
+	int findJoint(const std::string& name) const;  // -1 if none
+
+	const std::string& getName(int id) const { return mNames[id]; }
+	int getParentID(int id) const { return mParentIDs[id]; }
+	unsigned int getNumChannels(int id) const { return mNumChannels[id]; }
+	const std::string& getRotationOrder(int id) const { return mRotOrders[id]; }
+	const vec3& getOffset(int id) const { return mOffsets[id]; }  // local translation when the definition was made
+
+	int getNumChildren(int id) const { return mChildStart[id + 1] - mChildStart[id]; }
+	int getChildID(int id, int index) const { return mChildIDs[mChildStart[id] + index]; }
+
+	const std::vector<int>& getParentIDs() const { return mParentIDs; }
+	const std::vector<int>& getFKOrder() const { return mFKOrder; }  // IDs reachable from the root, parents first
+	const std::vector<int>& getFKIndex() const { return mFKIndex; }  // position of each joint in the FK order, -1 if unreachable
+	const std::vector<int>& getSubtreeEnd() const { return mSubtreeEnd; }  // subtree of getFKOrder()[i] ends before getSubtreeEnd()[i]
+
+protected:
+	ASkeletonDef() : mRootID(-1) {}
+	void computeFKOrder();  // mFKOrder, mFKIndex and mSubtreeEnd from the root, parents and children
+
+	int mRootID;
+	std::vector<std::string> mNames;
+	std::vector<int> mParentIDs;
+	std::vector<unsigned int> mNumChannels;
+	std::vector<std::string> mRotOrders;
+	std::vector<vec3> mOffsets;
+	std::vector<int> mChildStart;  // children of joint i are mChildIDs[mChildStart[i] .. mChildStart[i + 1])
+	std::vector<int> mChildIDs;
+	std::vector<int> mFKOrder;
+	std::vector<int> mFKIndex;
+	std::vector<int> mSubtreeEnd;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "aSkinning.h"
+#include "aThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ASKINNING_SSE
+#include <emmintrin.h>
+#endif
+
+#pragma warning(disable:4018)
+
+static const int kPaletteFloats = 28;	// 7 columns of 4 floats per joint
+
+int ASkinning::gGrainSize = 4096;
+
+ASkinning::ASkinning() : mNumVertices(0), mNumJoints(0), mMaxJointIndex(-1)
+{
+}
+
+ASkinning::~ASkinning()
+{
+}
+
+void ASkinning::setMesh(const Vertex* vertices, int numVertices)
+{
+	mNumVertices = numVertices;
+	mMaxJointIndex = -1;
+	mVertices.resize(numVertices * 8);
+	mInfluenceStart.resize(numVertices + 1);
+	mInfluenceJoints.clear();
+	mInfluenceWeights.clear();
+	for (int i = 0; i < numVertices; i++)
+	{
+		const Vertex& vertex = vertices[i];
+		float* v = &mVertices[i * 8];
+		v[0] = vertex.pos[0];
+		v[1] = vertex.pos[1];
+		v[2] = vertex.pos[2];
+		v[3] = 1.0f;
+		v[4] = vertex.nor[0];
+		v[5] = vertex.nor[1];
+		v[6] = vertex.nor[2];
+		v[7] = 0.0f;
+
+		mInfluenceStart[i] = mInfluenceJoints.size();
+		for (int j = 0; j < kMaxInfluences; j++)
+		{
+			if (vertex.weights[j] == 0) continue;
+			int joint = vertex.joints[j];
+			mInfluenceJoints.push_back(joint);
+			mInfluenceWeights.push_back(vertex.weights[j] / 65535.0f);
+			if (joint > mMaxJointIndex) mMaxJointIndex = joint;
+		}
+	}
+	mInfluenceStart[numVertices] = mInfluenceJoints.size();
+}
+
+void ASkinning::PackInfluences(int* joints, float* weights, int count, Vertex& vertex)
+{
+	// Largest weights first
+	for (int i = 0; i < count && i < kMaxInfluences; i++)
+	{
+		int largest = i;
+		for (int j = i + 1; j < count; j++)
+		{
+			if (weights[j] > weights[largest]) largest = j;
+		}
+		std::swap(joints[i], joints[largest]);
+		std::swap(weights[i], weights[largest]);
+	}
+	count = std::min(count, (int)kMaxInfluences);
+
+	float sum = 0.0f;
+	for (int i = 0; i < count; i++) sum += weights[i];
+	int total = 0;
+	for (int i = 0; i < kMaxInfluences; i++)
+	{
+		assert(i >= count || (joints[i] >= 0 && joints[i] <= 65535));
+		vertex.joints[i] = i < count ? joints[i] : 0;
+		vertex.weights[i] = i < count && sum > 0.0f ? (unsigned short)std::min(65535.0f, floorf(weights[i] / sum * 65535.0f + 0.5f)) : 0;
+		total += vertex.weights[i];
+	}
+	// Rounding goes to the largest weight so that they still sum to 1
+	if (total > 0) vertex.weights[0] = (unsigned short)(vertex.weights[0] + 65535 - total);
+}
+
+int ASkinning::getNumVertices() const
+{
+	return mNumVertices;
+}
+
+int ASkinning::getNumJoints() const
+{
+	return mNumJoints;
+}
+
+void ASkinning::setJointMatrices(const float* matrices, int numJoints)
+{
+	mNumJoints = numJoints;
+	mPalette.resize(numJoints * kPaletteFloats);
+	for (int j = 0; j < numJoints; j++)
+	{
+		const float* m = matrices + j * 16;
+		float* p = &mPalette[j * kPaletteFloats];
+		for (int c = 0; c < 4; c++)
+		{
+			p[c * 4 + 0] = m[c * 4 + 0];
+			p[c * 4 + 1] = m[c * 4 + 1];
+			p[c * 4 + 2] = m[c * 4 + 2];
+			p[c * 4 + 3] = 0.0f;
+		}
+
+		// Inverse transpose of the upper 3x3: its columns are the cross products of the other two, over the determinant
+		vec3 a0(m[0], m[1], m[2]), a1(m[4], m[5], m[6]), a2(m[8], m[9], m[10]);
+		vec3 n[3] = { a1.Cross(a2), a2.Cross(a0), a0.Cross(a1) };
+		double det = Dot(a0, n[0]);
+		double invDet = fabs(det) > 1e-12 ? 1.0 / det : 0.0;
+		for (int c = 0; c < 3; c++)
+		{
+			p[16 + c * 4 + 0] = (float)(n[c][0] * invDet);
+			p[16 + c * 4 + 1] = (float)(n[c][1] * invDet);
+			p[16 + c * 4 + 2] = (float)(n[c][2] * invDet);
+			p[16 + c * 4 + 3] = 0.0f;
+		}
+	}
+}
+
+void ASkinning::setJointTransforms(const ATransform* transforms, int numJoints)
+{
+	std::vector<float> matrices(numJoints * 16);
+	for (int j = 0; j < numJoints; j++)
+	{
+		float* m = &matrices[j * 16];
+		transforms[j].m_rotation.WriteToGLMatrix(m);
+		m[12] = (float)transforms[j].m_translation[0];
+		m[13] = (float)transforms[j].m_translation[1];
+		m[14] = (float)transforms[j].m_translation[2];
+	}
+	setJointMatrices(matrices.data(), numJoints);
+}
+
+void ASkinning::skin(float* positions, float* normals, int maxThreads) const
+{
+	assert(mMaxJointIndex < mNumJoints);
+	AThreadPool::Get().parallelFor(mNumVertices, [&](int begin, int end)
+	{
+		skinRange(begin, end, positions, normals);
+	}, gGrainSize, maxThreads);
+}
+
+#ifdef ASKINNING_SSE
+
+// x y z of v to p, without touching p[3], which may belong to a vertex of another thread
+static inline void StoreXYZ(float* p, __m128 v)
+{
+	_mm_storel_pi((__m64*)p, v);
+	_mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+
+void ASkinning::skinRange(int begin, int end, float* positions, float* normals) const
+{
+	const float* palette = mPalette.data();
+	for (int i = begin; i < end; i++)
+	{
+		// Blend the 7 columns of every influence, one SSE register per column
+		__m128 c0 = _mm_setzero_ps(), c1 = c0, c2 = c0, c3 = c0, n0 = c0, n1 = c0, n2 = c0;
+		for (int k = mInfluenceStart[i]; k < mInfluenceStart[i + 1]; k++)
+		{
+			const float* p = palette + mInfluenceJoints[k] * kPaletteFloats;
+			__m128 w = _mm_set1_ps(mInfluenceWeights[k]);
+			c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(p)));
+			c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(p + 4)));
+			c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(p + 8)));
+			c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(p + 12)));
+			n0 = _mm_add_ps(n0, _mm_mul_ps(w, _mm_loadu_ps(p + 16)));
+			n1 = _mm_add_ps(n1, _mm_mul_ps(w, _mm_loadu_ps(p + 20)));
+			n2 = _mm_add_ps(n2, _mm_mul_ps(w, _mm_loadu_ps(p + 24)));
+		}
+
+		const float* v = &mVertices[i * 8];
+		__m128 pos = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(v[0])), _mm_mul_ps(c1, _mm_set1_ps(v[1]))),
+			_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(v[2])), c3));
+		__m128 nor = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0, _mm_set1_ps(v[4])), _mm_mul_ps(n1, _mm_set1_ps(v[5]))),
+			_mm_mul_ps(n2, _mm_set1_ps(v[6])));
+		StoreXYZ(positions + i * 3, pos);
+		StoreXYZ(normals + i * 3, nor);
+	}
+}
+
+#else
+
+void ASkinning::skinRange(int begin, int end, float* positions, float* normals) const
+{
+	const float* palette = mPalette.data();
+	for (int i = begin; i < end; i++)
+	{
+		float m[28] = { 0.0f };
+		for (int k = mInfluenceStart[i]; k < mInfluenceStart[i + 1]; k++)
+		{
+			const float* p = palette + mInfluenceJoints[k] * kPaletteFloats;
+			float w = mInfluenceWeights[k];
+			for (int c = 0; c < 28; c++) m[c] += w * p[c];
+		}
+
+		const float* v = &mVertices[i * 8];
+		for (int r = 0; r < 3; r++)
+		{
+			positions[i * 3 + r] = m[r] * v[0] + m[4 + r] * v[1] + m[8 + r] * v[2] + m[12 + r];
+			normals[i * 3 + r] = m[16 + r] * v[4] + m[20 + r] * v[5] + m[24 + r] * v[6];
+		}
+	}
+}
+
+#endif
+
+void ASkinning::skinReference(float* positions, float* normals) const
+{
+	assert(mMaxJointIndex < mNumJoints);
+	for (int i = 0; i < mNumVertices; i++)
+	{
+		const float* v = &mVertices[i * 8];
+		float pos[3] = { 0.0f, 0.0f, 0.0f }, nor[3] = { 0.0f, 0.0f, 0.0f };
+		for (int k = mInfluenceStart[i]; k < mInfluenceStart[i + 1]; k++)
+		{
+			const float* m = &mPalette[mInfluenceJoints[k] * kPaletteFloats];
+			float w = mInfluenceWeights[k];
+			for (int r = 0; r < 3; r++)
+			{
+				pos[r] += w * (m[r] * v[0] + m[4 + r] * v[1] + m[8 + r] * v[2] + m[12 + r]);
+				nor[r] += w * (m[16 + r] * v[4] + m[20 + r] * v[5] + m[24 + r] * v[6]);
+			}
+		}
+		for (int r = 0; r < 3; r++)
+		{
+			positions[i * 3 + r] = pos[r];
+			normals[i * 3 + r] = nor[r];
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef ASkinning_H_
+#define ASkinning_H_
+
+#include "aTransform.h"
+#include <vector>
+
+// Linear blend skinning on the CPU, for when the deformed mesh is needed without a GL context (picking,
+// collision, export) or outside the viewer.
+// setMesh takes the vertices the skinning shader gets, setJointMatrices the matrices it blends. skin then
+// writes the same positions and normals as the shader, before its model transform. Each vertex blends the
+// matrices of its influences once and transforms its position and normal with the result, with SSE where
+// the compiler has it. Large meshes are split over the threads of AThreadPool.
+class ASkinning
+{
+public:
+	enum { kMaxInfluences = 4 };
+
+	// Also the viewer's FBXVertex, so its vertex buffer can be passed as is. 40 bytes.
+	struct Vertex
+	{
+		float pos[3];
+		float nor[3];
+		unsigned short joints[kMaxInfluences];	// joint indices
+		unsigned short weights[kMaxInfluences];	// weights in 1/65535, summing to 65535; unused influences are 0
+	};
+
+	// Keeps the kMaxInfluences largest of count influences, renormalized, in vertex.joints and vertex.weights.
+	// joints and weights are reordered.
+	static void PackInfluences(int* joints, float* weights, int count, Vertex& vertex);
+
+	ASkinning();
+	virtual ~ASkinning();
+
+	void setMesh(const Vertex* vertices, int numVertices);
+	int getNumVertices() const;
+	int getNumJoints() const;
+
+	// Skinning matrix (joint transform * inverse bind matrix) of each joint index of the mesh,
+	// 16 floats per joint, column-major as GL takes them
+	void setJointMatrices(const float* matrices, int numJoints);
+	void setJointTransforms(const ATransform* transforms, int numJoints);	// same from rigid transforms
+
+	// Writes 3 floats per vertex to positions and to normals, on up to maxThreads threads (0 for all).
+	// Normals are not normalized, the shader does that after its model transform.
+	void skin(float* positions, float* normals, int maxThreads = 0) const;
+	// One influence at a time without SSE, as the shader does it. Reference for skin.
+	void skinReference(float* positions, float* normals) const;
+
+	static int gGrainSize;	// vertices per parallelFor chunk
+
+protected:
+	void skinRange(int begin, int end, float* positions, float* normals) const;
+
+protected:
+	int mNumVertices;
+	int mNumJoints;
+	int mMaxJointIndex;
+	std::vector<float> mVertices;	// position x y z 1 and normal x y z 0 of each vertex
+	std::vector<int> mInfluenceStart;	// first influence of each vertex, then the total
+	std::vector<int> mInfluenceJoints;
+	std::vector<float> mInfluenceWeights;
+	std::vector<float> mPalette;	// per joint 4 columns of the skinning matrix and 3 of the normal matrix, 4 floats each
+};
+
+#endif
@@ -34,6 +34,7 @@ bool ASplineQuat::getLooping() const
 void ASplineQuat::setFramerate(double fps)
 {
     mDt = 1.0 / fps;
+    mCurveCached = false;
 }
 
 double ASplineQuat::getFramerate() const
@@ -43,29 +44,18 @@ double ASplineQuat::getFramerate() const
 
 int ASplineQuat::getCurveSegment(double time)
 {
-	int segment = 0;
-	bool foundSegment = false;
+	int numKeys = mKeys.size();
+	if (numKeys < 2) return 0;
 
 	double t = time;
 	if (t < 0.0)
 		t = 0.0;
 
-	int numKeys = mKeys.size();
-	while (!foundSegment) {
-		if (segment == numKeys - 1) {
-			segment = numKeys - 2;
-			foundSegment = true;
-		}
-		else {
-			double keyTime0 = mKeys[segment].first;
-			double keyTime1 = mKeys[segment + 1].first;
-			if ((t >= keyTime0) && (t < keyTime1))
-				 foundSegment = true;
-			else segment++;
-		}
-	}
-	return segment;
-
+	// Binary search for the first key strictly after t; the segment starts one key before it.
+	// Times at or past the last key fall into the last segment.
+	std::vector<Key>::const_iterator it = std::upper_bound(mKeys.begin() + 1, mKeys.end() - 1, t,
+		[](double value, const Key& key) { return value < key.first; });
+	return (int)(it - (mKeys.begin() + 1));
 }
 
 
@@ -110,6 +100,69 @@ void ASplineQuat::cacheCurve()
 		computeControlPoints(startQuat, endQuat);
 		createSplineCurveCubic();
 	}
+
+	mCurveCached = numKeys > 0;
+	mUpdatedFirst = 0;
+	mUpdatedLast = (int)mCachedCurve.size() - 1;
+}
+
+void ASplineQuat::cacheCurve(int keyID, int keyOffset)
+{
+	// Only the samples that depend on keys[keyID] are recomputed, so a key edit costs the same on a long clip
+	// as on a short one. The sample grid is set by the first and last key times, so edits that move either
+	// of them, or a cache that does not match the keys before the edit, re-cache everything.
+	// So do curves starting before time 0, whose earlier samples all use the segment at time 0 (see getCurveSegment).
+	int numKeys = mKeys.size();
+	int oldNumKeys = numKeys - keyOffset;
+	int lastKey = keyOffset > 0 ? numKeys - 1 : oldNumKeys - 1;
+	bool endsMoved = keyOffset != 0 && (keyID == 0 || keyID == lastKey);
+	if (numKeys < 2 || oldNumKeys < 2 || !mCurveCached || endsMoved || mKeys[0].first < 0.0 ||
+		(mType == CUBIC && mCtrlPoints.size() != 4 * (oldNumKeys - 1)))
+	{
+		cacheCurve();
+		return;
+	}
+
+	// The 4 control points of a cubic segment depend on its 2 keys and one more key on each side,
+	// so a key affects at most 4 cubic segments or 2 linear ones
+	int numSegments = numKeys - 1;
+	int firstSegment = std::max(0, keyID - 1);
+	int lastSegment = std::min(numSegments - 1, keyID);
+	if (mType == CUBIC)
+	{
+		// an inserted key splits a segment in two, a deleted key merges two
+		if (keyOffset > 0) mCtrlPoints.insert(mCtrlPoints.begin() + 4 * keyID, 4, quat());
+		else if (keyOffset < 0) mCtrlPoints.erase(mCtrlPoints.begin() + 4 * keyID, mCtrlPoints.begin() + 4 * keyID + 4);
+
+		firstSegment = std::max(0, keyID - 2);
+		lastSegment = std::min(numSegments - 1, keyID + 1);
+		quat startQuat = mKeys[0].second;
+		quat endQuat = mKeys[numKeys - 1].second;
+		for (int segment = firstSegment; segment <= lastSegment; segment++)
+		{
+			computeSegmentControlPoints(segment, startQuat, endQuat);
+		}
+	}
+
+	// Recompute the samples that fall in those segments, with one sample of margin for rounding
+	double startTime = mKeys[0].first;
+	int first = std::max(0, (int)floor((mKeys[firstSegment].first - startTime) / mDt) - 1);
+	int last = std::min((int)mCachedCurve.size() - 1, (int)ceil((mKeys[lastSegment + 1].first - startTime) / mDt) + 1);
+	int segment = getCurveSegment(getSampleTime(first));
+	for (int i = first; i <= last; i++)
+	{
+		double t = getSampleTime(i);
+		segment = advanceCurveSegment(segment, t);
+		mCachedCurve[i] = (mType == CUBIC) ? getCubicValue(segment, t) : getLinearValue(segment, t);
+	}
+	mUpdatedFirst = first;
+	mUpdatedLast = last;
+}
+
+void ASplineQuat::getUpdatedRange(int& firstSample, int& lastSample) const
+{
+	firstSample = mUpdatedFirst;
+	lastSample = mUpdatedLast;
 }
 void ASplineQuat::computeControlPoints(quat& startQuat, quat& endQuat)
 {
@@ -120,56 +173,68 @@ void ASplineQuat::computeControlPoints(quat& startQuat, quat& endQuat)
 	int numKeys = mKeys.size();
 	if (numKeys <= 1) return;
 
+	mCtrlPoints.resize(4 * (numKeys - 1));
+	for (int segment = 0; segment < numKeys - 1; segment++)
+	{
+		computeSegmentControlPoints(segment, startQuat, endQuat);
+	}
+}
+
+void ASplineQuat::computeSegmentControlPoints(int segment, const quat& startQuat, const quat& endQuat)
+{
+	int numKeys = mKeys.size();
 	quat b0, b1, b2, b3;
 	quat q_1, q0, q1, q2;
 
-	for (int segment = 0; segment < numKeys - 1; segment++)
-	{
-		// TODO: student implementation goes here
-		//  Given the quaternion keys q_1, q0, q1 and q2 associated with a curve segment, compute b0, b1, b2, b3 
-		//  for each cubic quaternion curve, then store the results in mCntrlPoints in same the same way 
-		//  as was used with the SplineVec implementation
-		//  Hint: use the SDouble, SBisect and Slerp to compute b1 and b2
-		if (segment == 0) {
-			q_1 = startQuat;
-		}
-		else {
-			q_1 = mKeys[segment - 1].second;
-		}
+	// TODO: student implementation goes here
+	//  Given the quaternion keys q_1, q0, q1 and q2 associated with a curve segment, compute b0, b1, b2, b3 
+	//  for each cubic quaternion curve, then store the results in mCntrlPoints in same the same way 
+	//  as was used with the SplineVec implementation
+	//  Hint: use the SDouble, SBisect and Slerp to compute b1 and b2
+	if (segment == 0) {
+		q_1 = startQuat;
+	}
+	else {
+		q_1 = mKeys[segment - 1].second;
+	}
 
-		q0 = mKeys[segment].second;
-		q1 = mKeys[segment + 1].second;
+	q0 = mKeys[segment].second;
+	q1 = mKeys[segment + 1].second;
 
-		if (segment == numKeys - 2) {
-			q2 = endQuat;
-		}
-		else {
-			q2 = mKeys[segment + 2].second;
-		}
-		
-		quat q0_D, q0_B, q1_D, q1_B;
-
-		q1_D = q1_D.SDouble(q_1, q0);
-		q1_B = q1_B.SBisect(q1_D, q1);
-		q0_D = q0_D.SDouble(q2, q1);
-		q0_B = q0_B.SBisect(q0, q0_D);
-
-		b0 = q0;
-		b1 = b1.Slerp(q0, q1_B, 1.0 / 3.0);
-		b2 = b2.Slerp(q1, q0_B, 1.0 / 3.0);
-		b3 = q1;
-
-		mCtrlPoints.push_back(b0);
-		mCtrlPoints.push_back(b1);
-		mCtrlPoints.push_back(b2);
-		mCtrlPoints.push_back(b3);
+	if (segment == numKeys - 2) {
+		q2 = endQuat;
 	}
+	else {
+		q2 = mKeys[segment + 2].second;
+	}
+	
+	quat q0_D, q0_B, q1_D, q1_B;
+
+	q1_D = q1_D.SDouble(q_1, q0);
+	q1_B = q1_B.SBisect(q1_D, q1);
+	q0_D = q0_D.SDouble(q2, q1);
+	q0_B = q0_B.SBisect(q0, q0_D);
+
+	b0 = q0;
+	b1 = b1.Slerp(q0, q1_B, 1.0 / 3.0);
+	b2 = b2.Slerp(q1, q0_B, 1.0 / 3.0);
+	b3 = q1;
+
+	mCtrlPoints[4 * segment] = b0;
+	mCtrlPoints[4 * segment + 1] = b1;
+	mCtrlPoints[4 * segment + 2] = b2;
+	mCtrlPoints[4 * segment + 3] = b3;
 }
 
 quat ASplineQuat::getLinearValue(double t)
 {
-	quat q;
 	int segment = getCurveSegment(t);
+	return getLinearValue(segment, t);
+}
+
+quat ASplineQuat::getLinearValue(int segment, double t) const
+{
+	quat q;
 
 	// TODO: student implementation goes here
 	// compute the value of a linear quaternion spline at the value of t using slerp
@@ -183,24 +248,32 @@ quat ASplineQuat::getLinearValue(double t)
 
 void ASplineQuat::createSplineCurveLinear()
 {
-
-	quat q;
 	mCachedCurve.clear();
 	int numKeys = mKeys.size(); 
 	double startTime = mKeys[0].first;
 	double endTime = mKeys[numKeys-1].first;
+	int numSamples = getNumSamples(startTime, endTime);
+	mCachedCurve.resize(numSamples);
 
-	for (double t = startTime; t <= endTime; t += mDt)
+	// Sweep the segments once instead of searching for each sample's segment
+	int segment = 0;
+	for (int i = 0; i < numSamples; i++)
 	{
-		q = getLinearValue(t);
-		mCachedCurve.push_back(q);
+		double t = getSampleTime(i);
+		segment = advanceCurveSegment(segment, t);
+		mCachedCurve[i] = getLinearValue(segment, t);
 	}
 }
 
 quat ASplineQuat::getCubicValue(double t)
 {
-	quat q, b0, b1, b2, b3;
 	int segment = getCurveSegment(t);
+	return getCubicValue(segment, t);
+}
+
+quat ASplineQuat::getCubicValue(int segment, double t) const
+{
+	quat q, b0, b1, b2, b3;
 
 	// TODO: student implementation goes here
 	// compute the value of a cubic quaternion spline at the value of t using Scubic
@@ -220,25 +293,56 @@ quat ASplineQuat::getCubicValue(double t)
 
 void ASplineQuat::createSplineCurveCubic()
 {
-	quat q;
 	mCachedCurve.clear();
 	int numKeys = mKeys.size();
 	double startTime = mKeys[0].first;
 	double endTime = mKeys[numKeys - 1].first;
+	int numSamples = getNumSamples(startTime, endTime);
+	mCachedCurve.resize(numSamples);
 
-	for (double t = startTime; t <= endTime; t += mDt)
+	// Sweep the segments once instead of searching for each sample's segment
+	int segment = 0;
+	for (int i = 0; i < numSamples; i++)
 	{
-		q = getCubicValue(t);
-		mCachedCurve.push_back(q);
+		double t = getSampleTime(i);
+		segment = advanceCurveSegment(segment, t);
+		mCachedCurve[i] = getCubicValue(segment, t);
 	}
 }
 
+int ASplineQuat::getNumSamples(double startTime, double endTime) const
+{
+	// Same count as stepping t by mDt from startTime while t <= endTime, which clip durations have always been based on
+	int numSamples = 0;
+	for (double t = startTime; t <= endTime; t += mDt)
+		numSamples++;
+	return numSamples;
+}
+
+double ASplineQuat::getSampleTime(int i) const
+{
+	// Computed from the index rather than accumulated, so that any sample can be recomputed on its own
+	return mKeys[0].first + i * mDt;
+}
+
+int ASplineQuat::advanceCurveSegment(int segment, double t) const
+{
+	// Same result as getCurveSegment(t) as long as t never decreases between calls
+	if (t < 0.0)
+		t = 0.0;
+
+	int lastSegment = (int)mKeys.size() - 2;
+	while (segment < lastSegment && t >= mKeys[segment + 1].first)
+		segment++;
+	return segment;
+}
+
 
 void ASplineQuat::editKey(int keyID, const quat& value)
 {
     assert(keyID >= 0 && keyID < mKeys.size());
     mKeys[keyID].second = value;
-	cacheCurve();
+	cacheCurve(keyID, 0);
 }
 
 void ASplineQuat::appendKey(const quat& value, bool updateCurve)
@@ -268,7 +372,8 @@ int ASplineQuat::insertKey(double time, const quat& value, bool updateCurve)
 		if (time < mKeys[i].first)
 		{
 			mKeys.insert(mKeys.begin() + i, Key(time, value));
-			if (updateCurve) cacheCurve();
+			if (updateCurve) cacheCurve(i, 1);
+			else mCurveCached = false;
 			return i;
 		}
 	}
@@ -280,17 +385,18 @@ int ASplineQuat::insertKey(double time, const quat& value, bool updateCurve)
 void ASplineQuat::appendKey(double t, const quat& value, bool updateCurve)
 {
     mKeys.push_back(Key(t, value));
-    if (updateCurve) cacheCurve();
+    if (updateCurve) cacheCurve(mKeys.size() - 1, 1);
+    else mCurveCached = false;
 }
 
 void ASplineQuat::deleteKey(int keyID)
 {
     assert(keyID >= 0 && keyID < mKeys.size());
     mKeys.erase(mKeys.begin() + keyID);
-	cacheCurve();
+	cacheCurve(keyID, -1);
 }
 
-quat ASplineQuat::getKey(int keyID)
+quat ASplineQuat::getKey(int keyID) const
 {
     assert(keyID >= 0 && keyID < mKeys.size());
     return mKeys[keyID].second;
@@ -301,9 +407,34 @@ int ASplineQuat::getNumKeys() const
     return mKeys.size();
 }
 
+double ASplineQuat::getKeyTime(int keyID) const
+{
+    assert(keyID >= 0 && keyID < mKeys.size());
+    return mKeys[keyID].first;
+}
+
+int ASplineQuat::getNumCurveSegments() const
+{
+    return mCachedCurve.size();
+}
+
+const quat& ASplineQuat::getCurvePoint(int i) const
+{
+    return mCachedCurve[i];
+}
+
+void ASplineQuat::releaseCurve()
+{
+    std::vector<quat>().swap(mCachedCurve);
+    std::vector<quat>().swap(mCtrlPoints);
+    mKeys.shrink_to_fit();
+    mCurveCached = false;
+}
+
 void ASplineQuat::clear()
 {
     mKeys.clear();
+    mCurveCached = false;
 }
 
 double ASplineQuat::getDuration() const
@@ -29,16 +29,23 @@ public:
     void appendKey(const quat& value, bool updateCurve = true);
 	int insertKey(double time, const quat& value, bool updateCurve = true);
     void deleteKey(int keyID);
-    quat getKey(int keyID);
+    quat getKey(int keyID) const;
     int getNumKeys() const;
+    double getKeyTime(int keyID) const;
 
     void cacheCurve();
+    void cacheCurve(int keyID, int keyOffset);  // updates only the curve around a key that was edited (0), inserted (1) or deleted (-1)
+    void getUpdatedRange(int& firstSample, int& lastSample) const;  // cached samples rewritten by the last update
+    void releaseCurve();  // frees the cached samples and control points and keeps the keys, cacheCurve rebuilds them
 
     int getNumCurveSegments() const;
+    const quat& getCurvePoint(int i) const;
 	int getCurveSegment(double t);
 	quat getCachedValue(double t) const;
 	quat getCubicValue(double t);
 	quat getLinearValue(double t);
+	quat getCubicValue(int segment, double t) const;	// evaluates a known segment without searching for it
+	quat getLinearValue(int segment, double t) const;
 	void computeControlPoints(quat& startQuat, quat& endQuat);
 
     void clear();
@@ -49,6 +56,10 @@ protected:
 
     void createSplineCurveLinear();
     void createSplineCurveCubic();
+    void computeSegmentControlPoints(int segment, const quat& startQuat, const quat& endQuat);
+    int advanceCurveSegment(int segment, double t) const; // forward-only segment search used while caching
+    int getNumSamples(double startTime, double endTime) const;
+    double getSampleTime(int i) const;  // time of cached sample i
 
 
 protected:
@@ -58,6 +69,9 @@ protected:
     std::vector<quat> mCachedCurve;
 	std::vector<quat> mCtrlPoints;
     InterpolationType mType;
+    bool mCurveCached = false;  // false once the keys change without the curve being updated
+    int mUpdatedFirst = 0;
+    int mUpdatedLast = -1;
 };
 
 #endif
\ No newline at end of file
@@ -6,7 +6,8 @@
 #pragma warning(disable:4244)
 
 
-ASplineVec3::ASplineVec3() : mInterpolator(new ABernsteinInterpolatorVec3())
+ASplineVec3::ASplineVec3() : mLooping(true), mInterpolator(new ABernsteinInterpolatorVec3()),
+    mMappedTimes(NULL), mMappedValues(NULL), mMappedSamples(NULL), mNumMappedKeys(0), mNumMappedSamples(0)
 {
 }
 
@@ -18,6 +19,7 @@ ASplineVec3::~ASplineVec3()
 void ASplineVec3::setFramerate(double fps)
 {
     mInterpolator->setFramerate(fps);
+    mSegmentStart.clear(); // the cached samples no longer match the framerate
 }
 
 double ASplineVec3::getFramerate() const
@@ -39,6 +41,7 @@ void ASplineVec3::setInterpolationType(ASplineVec3::InterpolationType type)
 {
     double fps = getFramerate();
 
+	copyMappedKeys();
 	if (mInterpolator) { delete mInterpolator; }
     switch (type)
     {
@@ -64,14 +67,15 @@ ASplineVec3::InterpolationType ASplineVec3::getInterpolationType() const
 
 void ASplineVec3::editKey(int keyID, const vec3& value)
 {
+    copyMappedKeys();
     assert(keyID >= 0 && keyID < mKeys.size());
     mKeys[keyID].second = value;
-    computeControlPoints();
-    cacheCurve();
+    cacheCurve(keyID, 0);
 }
 
 void ASplineVec3::editControlPoint(int ID, const vec3& value)
 {
+    copyMappedKeys();
     assert(ID >= 0 && ID < mCtrlPoints.size()+2);
     if (ID == 0)
     {
@@ -85,21 +89,24 @@ void ASplineVec3::editControlPoint(int ID, const vec3& value)
     }
     else mCtrlPoints[ID-1] = value;
     cacheCurve();
+    mSegmentStart.clear(); // the next key edit recomputes every control point
 }
 
 void ASplineVec3::appendKey(double time, const vec3& value, bool updateCurve)
 {
+    copyMappedKeys();
     mKeys.push_back(Key(time, value));
 
     if (updateCurve)
     {
-        computeControlPoints();
-        cacheCurve();
+        cacheCurve(mKeys.size() - 1, 1);
     }
+    else mSegmentStart.clear();
 }
 
 int ASplineVec3::insertKey(double time, const vec3& value, bool updateCurve)
 {
+	copyMappedKeys();
 	if (mKeys.size() == 0)
 	{
 		appendKey(time, value, updateCurve);
@@ -114,9 +121,9 @@ int ASplineVec3::insertKey(double time, const vec3& value, bool updateCurve)
 			mKeys.insert(mKeys.begin() + i, Key(time, value));
 			if (updateCurve)
 			{
-				computeControlPoints();
-				cacheCurve();
+				cacheCurve(i, 1);
 			}
+			else mSegmentStart.clear();
 			return i;
 		}
 	}
@@ -128,6 +135,7 @@ int ASplineVec3::insertKey(double time, const vec3& value, bool updateCurve)
 
 void ASplineVec3::appendKey(const vec3& value, bool updateCurve)
 {
+    copyMappedKeys();
     if (mKeys.size() == 0)
     {
         appendKey(0, value, updateCurve);
@@ -141,21 +149,26 @@ void ASplineVec3::appendKey(const vec3& value, bool updateCurve)
 
 void ASplineVec3::deleteKey(int keyID)
 {
+    copyMappedKeys();
     assert(keyID >= 0 && keyID < mKeys.size());
     mKeys.erase(mKeys.begin() + keyID);
-    computeControlPoints();
-    cacheCurve();
+    cacheCurve(keyID, -1);
 }
 
 vec3 ASplineVec3::getKey(int keyID) const
 {
+    if (mMappedValues)
+    {
+        assert(keyID >= 0 && keyID < mNumMappedKeys);
+        return mMappedValues[keyID];
+    }
     assert(keyID >= 0 && keyID < mKeys.size());
     return mKeys[keyID].second;
 }
 
 int ASplineVec3::getNumKeys() const
 {
-    return mKeys.size();
+    return mMappedValues ? mNumMappedKeys : mKeys.size();
 }
 
 vec3 ASplineVec3::getControlPoint(int ID) const
@@ -174,11 +187,16 @@ int ASplineVec3::getNumControlPoints() const
 void ASplineVec3::clear()
 {
     mKeys.clear();
+    mSegmentStart.clear();
+    mMappedTimes = NULL;
+    mMappedValues = NULL;
+    mMappedSamples = NULL;
 }
 
 double ASplineVec3::getDuration() const 
 {
-    return mKeys.size() == 0 ? 0 : mKeys[mKeys.size()-1].first;
+    int numKeys = getNumKeys();
+    return numKeys == 0 ? 0 : getKeyTime(numKeys - 1);
 }
 
 double ASplineVec3::getNormalizedTime(double t) const 
@@ -188,39 +206,131 @@ double ASplineVec3::getNormalizedTime(double t) const
 
 double ASplineVec3::getKeyTime(int keyID) const
 {
+	if (mMappedTimes)
+	{
+		assert(keyID >= 0 && keyID < mNumMappedKeys);
+		return mMappedTimes[keyID];
+	}
 	assert(keyID >= 0 && keyID < mKeys.size());
 	return mKeys[keyID].first;
 }
 
 vec3 ASplineVec3::getValue(double t) const
 {
-    if (mCachedCurve.size() == 0 || mKeys.size() == 0) return vec3();
-	if (t < mKeys[0].first)
-		return mCachedCurve[0];
+    const vec3* curve = mMappedSamples ? mMappedSamples : mCachedCurve.data();
+    int numSamples = getNumCurveSegments();
+    if (numSamples == 0 || getNumKeys() == 0) return vec3();
+	double startTime = getKeyTime(0);
+	if (t < startTime)
+		return curve[0];
 	else
-		t -= mKeys[0].first;
+		t -= startTime;
 
     double dt = mInterpolator->getDeltaTime();
     int rawi = (int)(t / dt); // assumes uniform spacing
     double frac = (t - rawi*dt) / dt;
 
-	int i = mLooping? rawi % mCachedCurve.size() : std::min<int>(rawi, mCachedCurve.size() - 1);
-	int inext = mLooping ? (i + 1) % mCachedCurve.size() : std::min<int>(i + 1, mCachedCurve.size() - 1);
+	int i = mLooping? rawi % numSamples : std::min<int>(rawi, numSamples - 1);
+	int inext = mLooping ? (i + 1) % numSamples : std::min<int>(i + 1, numSamples - 1);
 
-    vec3 v1 = mCachedCurve[i];
-    vec3 v2 = mCachedCurve[inext];
+    vec3 v1 = curve[i];
+    vec3 v2 = curve[inext];
     vec3 v = v1*(1 - frac) + v2 * frac;
     return v;
 }
 
 void ASplineVec3::cacheCurve()
 {
-    mInterpolator->interpolate(mKeys, mCtrlPoints, mCachedCurve);
+    copyMappedKeys();
+    mCachedCurve.clear();
+    mSegmentStart.clear();
+    mInterpolator->interpolateSegments(mKeys, mCtrlPoints, 0, (int)mKeys.size() - 2, mCachedCurve, &mSegmentStart);
 }
 
-void ASplineVec3::computeControlPoints(bool updateEndPoints)
+void ASplineVec3::setCachedCurve(const vec3* samples, int numSamples)
+{
+    copyMappedKeys();
+    mCachedCurve.assign(samples, samples + numSamples);
+    mSegmentStart.clear(); // the next key edit re-caches the whole curve
+}
+
+void ASplineVec3::setMappedKeys(const double* times, const vec3* values, int numKeys, const vec3* samples, int numSamples)
+{
+    clear();
+    mCachedCurve.clear();
+    mMappedTimes = times;
+    mMappedValues = values;
+    mMappedSamples = samples;
+    mNumMappedKeys = numKeys;
+    mNumMappedSamples = numSamples;
+}
+
+void ASplineVec3::copyMappedKeys()
+{
+    if (!mMappedValues) return;
+    mKeys.resize(mNumMappedKeys);
+    for (int i = 0; i < mNumMappedKeys; i++)
+    {
+        mKeys[i] = Key(mMappedTimes[i], mMappedValues[i]);
+    }
+    mCachedCurve.assign(mMappedSamples, mMappedSamples + mNumMappedSamples);
+    mMappedTimes = NULL;
+    mMappedValues = NULL;
+    mMappedSamples = NULL;
+    computeControlPoints();
+}
+
+void ASplineVec3::cacheCurve(int keyID, int keyOffset)
+{
+	// Only the segments that depend on keys[keyID] are sampled again and spliced into mCachedCurve,
+	// so a key edit costs the same on a long curve as on a short one.
+	// If the cache does not match the keys before the edit, everything is recomputed.
+	int numSegments = (int)mKeys.size() - 1;
+	int oldNumSegments = numSegments - keyOffset;
+	if (numSegments < 1 || oldNumSegments < 1 || mSegmentStart.size() != oldNumSegments + 1)
+	{
+		computeControlPoints();
+		cacheCurve();
+		return;
+	}
+
+	computeEndPoints();
+	int firstSegment = 0;
+	int lastSegment = numSegments - 1;
+	mInterpolator->updateControlPoints(mKeys, mCtrlPoints, mStartPoint, mEndPoint, keyID, keyOffset, firstSegment, lastSegment);
+
+	// The new segments firstSegment..lastSegment replace the old segments firstSegment..oldLastSegment,
+	// together with the final sample when they reach the end of the curve
+	int oldLastSegment = lastSegment - keyOffset;
+	bool toEnd = (lastSegment == numSegments - 1);
+	int begin = mSegmentStart[firstSegment];
+	int end = toEnd ? mCachedCurve.size() : mSegmentStart[oldLastSegment + 1];
+	int oldEndEntry = toEnd ? oldNumSegments + 1 : oldLastSegment + 1;
+
+	mSegmentSamples.clear();
+	mSegmentSampleStart.clear();
+	mInterpolator->interpolateSegments(mKeys, mCtrlPoints, firstSegment, lastSegment, mSegmentSamples, &mSegmentSampleStart);
+
+	int sizeChange = (int)mSegmentSamples.size() - (end - begin);
+	if (sizeChange > 0) mCachedCurve.insert(mCachedCurve.begin() + end, sizeChange, vec3());
+	else if (sizeChange < 0) mCachedCurve.erase(mCachedCurve.begin() + end + sizeChange, mCachedCurve.begin() + end);
+	std::copy(mSegmentSamples.begin(), mSegmentSamples.end(), mCachedCurve.begin() + begin);
+
+	for (int i = 0; i < mSegmentSampleStart.size(); i++)
+	{
+		mSegmentSampleStart[i] += begin;
+	}
+	mSegmentStart.erase(mSegmentStart.begin() + firstSegment, mSegmentStart.begin() + oldEndEntry);
+	mSegmentStart.insert(mSegmentStart.begin() + firstSegment, mSegmentSampleStart.begin(), mSegmentSampleStart.end());
+	for (int i = firstSegment + mSegmentSampleStart.size(); i < mSegmentStart.size(); i++)
+	{
+		mSegmentStart[i] += sizeChange;
+	}
+}
+
+void ASplineVec3::computeEndPoints()
 {
-	if (mKeys.size() >= 2 && updateEndPoints)
+	if (mKeys.size() >= 2)
 	{
 		int totalPoints = mKeys.size();
 
@@ -234,26 +344,38 @@ void ASplineVec3::computeControlPoints(bool updateEndPoints)
 		n = tmp.Length();
 		mEndPoint = mKeys[totalPoints - 1].second + (tmp / n) * n * 0.25;
 	}
+}
+
+void ASplineVec3::computeControlPoints(bool updateEndPoints)
+{
+	copyMappedKeys();
+	if (updateEndPoints)
+	{
+		computeEndPoints();
+	}
     mInterpolator->computeControlPoints(mKeys, mCtrlPoints, mStartPoint, mEndPoint);
 }
 
 vec3* ASplineVec3::getCachedCurveData()
 {
+	copyMappedKeys();
 	return mCachedCurve.data();
 }
 
 vec3 * ASplineVec3::getControlPointsData()
 {
+	copyMappedKeys();
 	return mCtrlPoints.data();
 }
 
 int ASplineVec3::getNumCurveSegments() const
 {
-    return mCachedCurve.size();
+    return mMappedSamples ? mNumMappedSamples : mCachedCurve.size();
 }
 
 vec3 ASplineVec3::getCurvePoint(int i) const
 {
+    if (mMappedSamples) return mMappedSamples[i];
     return mCachedCurve[i];
 }
 
@@ -279,15 +401,22 @@ double AInterpolatorVec3::getDeltaTime() const
 
 void AInterpolatorVec3::interpolate(const std::vector<ASplineVec3::Key>& keys, 
     const std::vector<vec3>& ctrlPoints, std::vector<vec3>& curve)
+{
+	curve.clear();
+	interpolateSegments(keys, ctrlPoints, 0, (int)keys.size() - 2, curve);
+}
+
+void AInterpolatorVec3::interpolateSegments(const std::vector<ASplineVec3::Key>& keys, 
+    const std::vector<vec3>& ctrlPoints, int firstSegment, int lastSegment,
+    std::vector<vec3>& curve, std::vector<int>* segmentStart)
 {
 	vec3 val = 0.0;
 	double u = 0.0;
 
-	curve.clear();
-
 	int numSegments = keys.size() - 1;
-	for (int segment = 0; segment < numSegments; segment++)
+	for (int segment = firstSegment; segment <= lastSegment; segment++)
     {
+		if (segmentStart) segmentStart->push_back(curve.size());
         for (double t = keys[segment].first; t < keys[segment+1].first - FLT_EPSILON; t += mDt)
         {
 			// TODO: Compute u, fraction of duration between segment and segmentnext, for example,
@@ -301,14 +430,31 @@ void AInterpolatorVec3::interpolate(const std::vector<ASplineVec3::Key>& keys,
         }
     }
 	// add last point
-	if (keys.size() > 1)
+	if (numSegments > 0 && lastSegment == numSegments - 1)
 	{
+		if (segmentStart) segmentStart->push_back(curve.size());
 		u = 1.0;
 		val = interpolateSegment(keys, ctrlPoints, numSegments - 1, u);
 		curve.push_back(val);
 	}
 }
 
+void AInterpolatorVec3::updateControlPoints(const std::vector<ASplineVec3::Key>& keys, 
+    std::vector<vec3>& ctrlPoints, vec3& startPoint, vec3& endPoint,
+    int /*keyID*/, int /*keyOffset*/, int& firstSegment, int& lastSegment)
+{
+	computeControlPoints(keys, ctrlPoints, startPoint, endPoint);
+	firstSegment = 0;
+	lastSegment = keys.size() - 2;
+}
+
+void ALinearInterpolatorVec3::updateControlPoints(const std::vector<ASplineVec3::Key>& keys, 
+    std::vector<vec3>& /*ctrlPoints*/, vec3& /*startPoint*/, vec3& /*endPoint*/,
+    int keyID, int /*keyOffset*/, int& firstSegment, int& lastSegment)
+{
+	firstSegment = std::max(0, keyID - 1);
+	lastSegment = std::min((int)keys.size() - 2, keyID);
+}
 
 // Interpolate p0 and p1 so that t = 0 returns p0 and t = 1 returns p1
 vec3 ALinearInterpolatorVec3::interpolateSegment(
@@ -451,33 +597,68 @@ void ACubicInterpolatorVec3::computeControlPoints(
     ctrlPoints.clear();
     if (keys.size() <= 1) return;
 
-	for (int i = 1; i < keys.size(); i++)
+	ctrlPoints.resize(4 * (keys.size() - 1));
+	for (int segment = 0; segment < keys.size() - 1; segment++)
 	{
-		vec3 b0, b1, b2, b3;
-		// TODO: compute b0, b1, b2, b3
-		b0 = keys[i - 1].second;
-		b3 = keys[i].second;
-
-		// left side of curve
-		if (i == 1) {
-			b1 = b0 + (1.0 / 3.0) * ((keys[1].second - startPoint) / 2.0);
-		}
-		else {
-			b1 = keys[i - 1].second + (1.0 / 3.0) * ((keys[i].second - keys[i - 2].second) / 2.0);
-		}
+		computeSegmentControlPoints(keys, startPoint, endPoint, segment, &ctrlPoints[4 * segment]);
+	}
+}
 
-		// right side of curve
-		if (i == keys.size() - 1) {
-			b2 = b3 - (1.0 / 3.0) * ((endPoint - keys[keys.size() - 1].second) / 2.0);
-		}
-		else {
-			b2 = keys[i ].second - (1.0 / 3.0) * ((keys[i + 1].second - keys[i - 1].second) / 2.0);
-		}
+void ACubicInterpolatorVec3::computeSegmentControlPoints(
+    const std::vector<ASplineVec3::Key>& keys, 
+    const vec3& startPoint, const vec3& endPoint,
+    int segment, vec3* b)
+{
+	int i = segment + 1;
+	vec3 b0, b1, b2, b3;
+	// TODO: compute b0, b1, b2, b3
+	b0 = keys[i - 1].second;
+	b3 = keys[i].second;
+
+	// left side of curve
+	if (i == 1) {
+		b1 = b0 + (1.0 / 3.0) * ((keys[1].second - startPoint) / 2.0);
+	}
+	else {
+		b1 = keys[i - 1].second + (1.0 / 3.0) * ((keys[i].second - keys[i - 2].second) / 2.0);
+	}
+
+	// right side of curve
+	if (i == keys.size() - 1) {
+		b2 = b3 - (1.0 / 3.0) * ((endPoint - keys[keys.size() - 1].second) / 2.0);
+	}
+	else {
+		b2 = keys[i ].second - (1.0 / 3.0) * ((keys[i + 1].second - keys[i - 1].second) / 2.0);
+	}
+
+	b[0] = b0;
+	b[1] = b1;
+	b[2] = b2;
+	b[3] = b3;
+}
+
+void ACubicInterpolatorVec3::updateControlPoints(
+    const std::vector<ASplineVec3::Key>& keys, 
+    std::vector<vec3>& ctrlPoints, 
+    vec3& startPoint, vec3& endPoint,
+    int keyID, int keyOffset, int& firstSegment, int& lastSegment)
+{
+	int numSegments = keys.size() - 1;
+	if (ctrlPoints.size() != 4 * (numSegments - keyOffset))
+	{
+		AInterpolatorVec3::updateControlPoints(keys, ctrlPoints, startPoint, endPoint, keyID, keyOffset, firstSegment, lastSegment);
+		return;
+	}
 
-		ctrlPoints.push_back(b0);
-		ctrlPoints.push_back(b1);
-		ctrlPoints.push_back(b2);
-		ctrlPoints.push_back(b3);
+	// an inserted key splits a segment in two, a deleted key merges two
+	if (keyOffset > 0) ctrlPoints.insert(ctrlPoints.begin() + 4 * std::min(keyID, numSegments - 1), 4, vec3());
+	else if (keyOffset < 0) ctrlPoints.erase(ctrlPoints.begin() + 4 * std::min(keyID, numSegments), ctrlPoints.begin() + 4 * std::min(keyID, numSegments) + 4);
+
+	firstSegment = std::max(0, keyID - 2);
+	lastSegment = std::min(numSegments - 1, keyID + 1);
+	for (int segment = firstSegment; segment <= lastSegment; segment++)
+	{
+		computeSegmentControlPoints(keys, startPoint, endPoint, segment, &ctrlPoints[4 * segment]);
 	}
 }
 
@@ -503,63 +684,83 @@ void AHermiteInterpolatorVec3::computeControlPoints(
 	// Step 3: Solve AC=D for C
 	// Step 4: Save control points in ctrlPoints
 
-	// Initialize A
-	Eigen::MatrixXd A(keys.size(), keys.size());
-
-	for (int row = 0; row < keys.size(); row++) {
-		for (int col = 0; col < keys.size(); col++) {
-			if (row == 0 && (col == 0 || col == 1)) {
-				A(0, 0) = 2;
-				A(0, 1) = 1;
-			} 
-			else if (row == keys.size() - 1 && (col == keys.size() - 2 || col == keys.size() - 1)) {
-				A(keys.size() - 1, keys.size() - 2) = 1;
-				A(keys.size() - 1, keys.size() - 1) = 2;
-			}
-			else if (row > 0 && col == row - 1) {
-				A(row, col) = 1;
-			}
-			else if (col == row) {
-				A(row, col) = 4;
-			}
-			else if (row < keys.size() - 1 && col == row + 1) {
-				A(row, col) = 1;
-			}
-			else {
-				A(row, col) = 0;
-			}
-		}
+	// A is tridiagonal: 2 1 on the first row, 1 4 1 on the inner rows and 1 2 on the last row,
+	// so AC=D is solved with the Thomas algorithm in O(n) instead of inverting a dense n x n matrix.
+	solveSlopes(keys, ctrlPoints, 0, keys.size() - 1);
+}
+
+void AHermiteInterpolatorVec3::updateControlPoints(
+    const std::vector<ASplineVec3::Key>& keys,
+    std::vector<vec3>& ctrlPoints,
+    vec3& startPoint, vec3& endPoint,
+    int keyID, int keyOffset, int& firstSegment, int& lastSegment)
+{
+	int n = keys.size();
+	if (ctrlPoints.size() != n - keyOffset)
+	{
+		AInterpolatorVec3::updateControlPoints(keys, ctrlPoints, startPoint, endPoint, keyID, keyOffset, firstSegment, lastSegment);
+		return;
 	}
 
-	// Initialize D
-	Eigen::MatrixXd D(keys.size(), 3);
-	for (int row = 0; row < keys.size(); row++) {
+	if (keyOffset > 0) ctrlPoints.insert(ctrlPoints.begin() + keyID, vec3(0, 0, 0));
+	else if (keyOffset < 0) ctrlPoints.erase(ctrlPoints.begin() + std::min(keyID, n));
+
+	int firstRow = std::max(0, keyID - kUpdateWindow - 1);
+	int lastRow = std::min(n - 1, keyID + kUpdateWindow);
+	if (lastRow == n - 2) lastRow = n - 1; // the saved slope of the last key is zero, so it cannot bound the window
+	solveSlopes(keys, ctrlPoints, firstRow, lastRow);
+
+	firstSegment = std::max(0, firstRow - 1);
+	lastSegment = std::min(n - 2, lastRow);
+}
+
+void AHermiteInterpolatorVec3::solveSlopes(
+    const std::vector<ASplineVec3::Key>& keys,
+    std::vector<vec3>& ctrlPoints,
+    int firstRow, int lastRow)
+{
+	// The forward sweep stores the modified D in ctrlPoints and the back substitution overwrites it with C.
+	// Slopes just outside firstRow..lastRow are known and move to the right hand side.
+	int n = keys.size();
+	mUpper.resize(lastRow - firstRow + 1); // modified super-diagonal
+	for (int row = firstRow; row <= lastRow; row++) {
+		// Initialize D
+		vec3 d;
 		for (int col = 0; col < 3; col++) {
 			// clamped endpoint conditions
 			if (row == 0) {
-				D(row, col) = 3 * keys[1].second[1] - keys[0].second[col];
+				d[col] = 3 * (keys[1].second[col] - keys[0].second[col]);
 			}
-			else if (row == keys.size() - 1) {
-				D(row, col) = 3 * keys[keys.size() - 1].second[col] - keys[keys.size() - 2].second[col];
+			else if (row == n - 1) {
+				d[col] = 3 * (keys[n - 1].second[col] - keys[n - 2].second[col]);
 			}
 			else {
-				D(row, col) = 3 * (keys[row + 1].second[col] - keys[row - 1].second[col]);
+				d[col] = 3 * (keys[row + 1].second[col] - keys[row - 1].second[col]);
 			}
 		}
+		if (row == firstRow && row > 0) d = d - ctrlPoints[row - 1];
+		if (row == lastRow && row < n - 1) d = d - ctrlPoints[row + 1];
+
+		// Eliminate the sub-diagonal
+		double diagonal = (row == 0 || row == n - 1) ? 2.0 : 4.0;
+		if (row == firstRow) {
+			mUpper[0] = 1.0 / diagonal;
+			ctrlPoints[row] = d / diagonal;
+		}
+		else {
+			diagonal = diagonal - mUpper[row - 1 - firstRow];
+			mUpper[row - firstRow] = 1.0 / diagonal;
+			ctrlPoints[row] = (d - ctrlPoints[row - 1]) / diagonal;
+		}
 	}
 
 	// Solve for C
-	Eigen::MatrixXd C(keys.size(), 3);
-	C = A.inverse() * D;
-
-	for (int row = 0; row < keys.size() - 1; row++) {
-		vec3 dp;
-
-		for (int col = 0; col < 3; col++) {
-			dp[col] = C(row, col);
-		}
-		ctrlPoints[row] = dp;
+	for (int row = lastRow - 1; row >= firstRow; row--) {
+		ctrlPoints[row] = ctrlPoints[row] - ctrlPoints[row + 1] * mUpper[row - firstRow];
 	}
+
+	// the slope of the last key is not saved
+	if (lastRow == n - 1) ctrlPoints[n - 1] = vec3(0, 0, 0);
 }
 
 void ABSplineInterpolatorVec3::computeControlPoints(
@@ -595,6 +796,16 @@ void ABSplineInterpolatorVec3::computeControlPoints(
 	// Step 5: save control points in ctrlPoints
 }
 
+void ABSplineInterpolatorVec3::updateControlPoints(
+    const std::vector<ASplineVec3::Key>& keys,
+    std::vector<vec3>& ctrlPoints,
+    vec3& startPoint, vec3& endPoint,
+    int keyID, int keyOffset, int& firstSegment, int& lastSegment)
+{
+	// every control point depends on every key
+	AInterpolatorVec3::updateControlPoints(keys, ctrlPoints, startPoint, endPoint, keyID, keyOffset, firstSegment, lastSegment);
+}
+
 std::vector<vec3> AInterpolatorVec3::convertAngles(vec3 key0, vec3 key1) {
 	std::vector<vec3> angleVector;
 	vec3 newKey0, newKey1;
@@ -649,6 +860,16 @@ vec3 AEulerLinearInterpolatorVec3::interpolateSegment(
 	return curveValue;
 }
 
+void AEulerLinearInterpolatorVec3::updateControlPoints(
+	const std::vector<ASplineVec3::Key>& keys,
+	std::vector<vec3>& /*ctrlPoints*/,
+	vec3& /*startPoint*/, vec3& /*endPoint*/,
+	int keyID, int /*keyOffset*/, int& firstSegment, int& lastSegment)
+{
+	firstSegment = std::max(0, keyID - 1);
+	lastSegment = std::min((int)keys.size() - 2, keyID);
+}
+
 vec3 AEulerCubicInterpolatorVec3::interpolateSegment(
 	const std::vector<ASplineVec3::Key>& keys, 
 	const std::vector<vec3>& ctrlPoints, int segment, double t)
@@ -672,45 +893,41 @@ vec3 AEulerCubicInterpolatorVec3::interpolateSegment(
 	return curveValue;
 }
 
-void AEulerCubicInterpolatorVec3::computeControlPoints(
+void AEulerCubicInterpolatorVec3::computeSegmentControlPoints(
 	const std::vector<ASplineVec3::Key>& keys, 
-	std::vector<vec3>& ctrlPoints, vec3 & startPoint, vec3 & endPoint)
+	const vec3& startPoint, const vec3& endPoint,
+	int segment, vec3* b)
 {
-	ctrlPoints.clear();
-	if (keys.size() <= 1) return;
-
 	// Hint: One naive way is to first convert the keys such that the differences of the x, y, z Euler angles 
 	//		 between every two adjacent keys are less than 180 degrees respectively 
 
-	for (int i = 1; i < keys.size(); i++)
-	{
-		vec3 b0, b1, b2, b3;
-		b0 = convertAngles(keys[i - 1].second, keys[i].second)[0];
-		b3 = convertAngles(keys[i - 1].second, keys[i].second)[1];
-
-		// left side of curve
-		if (i == 1) {
-			vec3 sP_converted = convertAngles(startPoint, b0)[0];
-			b1 = b0 + (1.0 / 3.0) * ((b3 - sP_converted) / 2.0);
-		}
-		else {
-			vec3 b2_converted = convertAngles(keys[i - 2].second, b0)[0];
-			b1 = b0 + (1.0 / 3.0) * ((b3 - b2_converted) / 2.0);
-		}
+	int i = segment + 1;
+	vec3 b0, b1, b2, b3;
+	b0 = convertAngles(keys[i - 1].second, keys[i].second)[0];
+	b3 = convertAngles(keys[i - 1].second, keys[i].second)[1];
 
-		// right side of curve
-		if (i == keys.size() - 1) {
-			vec3 eP_converted = convertAngles(b3, endPoint)[1];
-			b2 = b3 - (1.0 / 3.0) * ((eP_converted - b0) / 2.0);
-		}
-		else {
-			vec3 b1_converted = convertAngles(b3, keys[i + 1].second)[1];
-			b2 = b3 - (1.0 / 3.0) * ((b1_converted - b0) / 2.0);
-		}
+	// left side of curve
+	if (i == 1) {
+		vec3 sP_converted = convertAngles(startPoint, b0)[0];
+		b1 = b0 + (1.0 / 3.0) * ((b3 - sP_converted) / 2.0);
+	}
+	else {
+		vec3 b2_converted = convertAngles(keys[i - 2].second, b0)[0];
+		b1 = b0 + (1.0 / 3.0) * ((b3 - b2_converted) / 2.0);
+	}
 
-		ctrlPoints.push_back(b0);
-		ctrlPoints.push_back(b1);
-		ctrlPoints.push_back(b2);
-		ctrlPoints.push_back(b3);
+	// right side of curve
+	if (i == keys.size() - 1) {
+		vec3 eP_converted = convertAngles(b3, endPoint)[1];
+		b2 = b3 - (1.0 / 3.0) * ((eP_converted - b0) / 2.0);
+	}
+	else {
+		vec3 b1_converted = convertAngles(b3, keys[i + 1].second)[1];
+		b2 = b3 - (1.0 / 3.0) * ((b1_converted - b0) / 2.0);
 	}
+
+	b[0] = b0;
+	b[1] = b1;
+	b[2] = b2;
+	b[3] = b3;
 }
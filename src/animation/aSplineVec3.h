@@ -52,6 +52,11 @@ public:
     // Update curve -- by default, these do not need to be called manually
     void cacheCurve();
     void computeControlPoints(bool updateEndPoints = true);
+    void cacheCurve(int keyID, int keyOffset);  // updates only the curve around a key that was edited (0), inserted (1) or deleted (-1)
+    void setCachedCurve(const vec3* samples, int numSamples);  // uses samples cached earlier from the same keys instead of cacheCurve()
+    // Reads the keys and their cached samples in place, from arrays that outlive the spline (a mapped .bvhc).
+    // The first edit copies them.
+    void setMappedKeys(const double* times, const vec3* values, int numKeys, const vec3* samples, int numSamples);
 
 	vec3* getCachedCurveData();
 	vec3* getControlPointsData();
@@ -62,7 +67,18 @@ protected:
     std::vector<Key> mKeys;
     std::vector<vec3> mCtrlPoints;
     std::vector<vec3> mCachedCurve;
+    std::vector<int> mSegmentStart; // index in mCachedCurve of the first sample of each segment, then of the final sample
+    std::vector<vec3> mSegmentSamples; // scratch for cacheCurve(keyID, keyOffset)
+    std::vector<int> mSegmentSampleStart;
     vec3 mStartPoint, mEndPoint; // for controlling end point behavior
+    const double* mMappedTimes; // keys and samples of setMappedKeys, used instead of mKeys and mCachedCurve while not NULL
+    const vec3* mMappedValues;
+    const vec3* mMappedSamples;
+    int mNumMappedKeys;
+    int mNumMappedSamples;
+
+    void computeEndPoints();  // start and end points on the tangents of the first and last keys
+    void copyMappedKeys();  // into mKeys and mCachedCurve, before they are edited
 };
 
 // class for implementing different interpolation algorithms
@@ -78,6 +94,14 @@ public:
         const std::vector<vec3>& ctrlPoints, 
         std::vector<vec3>& curve);
 
+    // Append the samples of segments firstSegment..lastSegment to the curve, and the index of the first
+    // sample of each segment to segmentStart if given. The final key is sampled after the last segment.
+    void interpolateSegments(
+        const std::vector<ASplineVec3::Key>& keys, 
+        const std::vector<vec3>& ctrlPoints, 
+        int firstSegment, int lastSegment,
+        std::vector<vec3>& curve, std::vector<int>* segmentStart = 0);
+
     // Given an ordered list of keys, compute corresponding control points
     // The start and end points are additionally set to specify the behavior at the endpoints
     virtual void computeControlPoints(
@@ -85,6 +109,15 @@ public:
         std::vector<vec3>& ctrlPoints, 
         vec3& startPt, vec3& endPt) {}
 
+    // Bring the control points up to date after keys[keyID] was edited (keyOffset = 0), inserted (1)
+    // or deleted (-1, keyID is where it was) and return the segments whose samples may have changed.
+    // By default everything is recomputed.
+    virtual void updateControlPoints(
+        const std::vector<ASplineVec3::Key>& keys, 
+        std::vector<vec3>& ctrlPoints, 
+        vec3& startPt, vec3& endPt,
+        int keyID, int keyOffset, int& firstSegment, int& lastSegment);
+
     // The framerate determines the number of samples between each key
     void setFramerate(double fps);
     double getFramerate() const;
@@ -116,6 +149,13 @@ public:
         const std::vector<ASplineVec3::Key>& keys, 
         const std::vector<vec3>& ctrlPoints, 
         int segment, double u);
+
+    // a key only affects the two segments next to it
+    virtual void updateControlPoints(
+        const std::vector<ASplineVec3::Key>& keys, 
+        std::vector<vec3>& ctrlPoints, 
+        vec3& startPt, vec3& endPt,
+        int keyID, int keyOffset, int& firstSegment, int& lastSegment);
 };
 
 class ACubicInterpolatorVec3 : public AInterpolatorVec3
@@ -127,8 +167,22 @@ public:
         std::vector<vec3>& ctrlPoints, 
         vec3& startPt, vec3& endPt);
 
+    // the 4 control points of a segment depend on its 2 keys and one more key on each side,
+    // so a key affects at most 4 segments
+    virtual void updateControlPoints(
+        const std::vector<ASplineVec3::Key>& keys, 
+        std::vector<vec3>& ctrlPoints, 
+        vec3& startPt, vec3& endPt,
+        int keyID, int keyOffset, int& firstSegment, int& lastSegment);
+
 protected:
     ACubicInterpolatorVec3(ASplineVec3::InterpolationType t) : AInterpolatorVec3(t) {}
+
+    // b0, b1, b2 and b3 of one segment
+    virtual void computeSegmentControlPoints(
+        const std::vector<ASplineVec3::Key>& keys, 
+        const vec3& startPt, const vec3& endPt,
+        int segment, vec3* b);
 };
 
 class ABernsteinInterpolatorVec3 : public ACubicInterpolatorVec3
@@ -176,8 +230,25 @@ public:
         std::vector<vec3>& ctrlPoints, 
         vec3& startPt, vec3& endPt);
 
+    // the slopes are coupled through the whole curve, but the effect of a key falls off by a factor
+    // of about 0.27 per key, so only the slopes within kUpdateWindow keys of it are solved again
+    virtual void updateControlPoints(
+        const std::vector<ASplineVec3::Key>& keys, 
+        std::vector<vec3>& ctrlPoints, 
+        vec3& startPt, vec3& endPt,
+        int keyID, int keyOffset, int& firstSegment, int& lastSegment);
+
+    static const int kUpdateWindow = 32;
+
 protected:
+    // Solves rows firstRow..lastRow of AC=D, taking the slopes just outside those rows from ctrlPoints
+    void solveSlopes(
+        const std::vector<ASplineVec3::Key>& keys, 
+        std::vector<vec3>& ctrlPoints, 
+        int firstRow, int lastRow);
+
     bool mClampedEndpoints;
+    std::vector<double> mUpper; // scratch for solveSlopes
 };
 
 class ABSplineInterpolatorVec3 : public ACubicInterpolatorVec3
@@ -195,6 +266,12 @@ public:
         std::vector<vec3>& ctrlPoints, 
         vec3& startPt, vec3& endPt);
 
+    virtual void updateControlPoints(
+        const std::vector<ASplineVec3::Key>& keys, 
+        std::vector<vec3>& ctrlPoints, 
+        vec3& startPt, vec3& endPt,
+        int keyID, int keyOffset, int& firstSegment, int& lastSegment);
+
 protected:
     std::vector<double> mKnots;
 };
@@ -207,6 +284,12 @@ public:
 		const std::vector<ASplineVec3::Key>& keys,
 		const std::vector<vec3>& ctrlPoints,
 		int segment, double u);
+
+	virtual void updateControlPoints(
+		const std::vector<ASplineVec3::Key>& keys,
+		std::vector<vec3>& ctrlPoints,
+		vec3& startPt, vec3& endPt,
+		int keyID, int keyOffset, int& firstSegment, int& lastSegment);
 };
 
 class AEulerCubicInterpolatorVec3 : public ACubicInterpolatorVec3
@@ -218,10 +301,11 @@ public:
 		const std::vector<vec3>& ctrlPoints,
 		int segment, double u);
 
-	virtual void computeControlPoints(
+protected:
+	virtual void computeSegmentControlPoints(
 		const std::vector<ASplineVec3::Key>& keys,
-		std::vector<vec3>& ctrlPoints,
-		vec3& startPt, vec3& endPt);
+		const vec3& startPt, const vec3& endPt,
+		int segment, vec3* b);
 };
 
 
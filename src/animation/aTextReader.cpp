@@ -0,0 +1,172 @@
+#include "aTextReader.h"
+#include <cstdint>
+#include <cstdlib>
+
+static const double kPow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');	// space, \t, \n, \v, \f, \r
+}
+
+static inline bool isDigit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+ATextReader::ATextReader(const char* begin, const char* end) : mBegin(begin), mPos(begin), mEnd(end)
+{
+}
+
+void ATextReader::skipSpace()
+{
+	while (mPos < mEnd && isSpace(*mPos)) mPos++;
+}
+
+bool ATextReader::readWord(std::string& word)
+{
+	skipSpace();
+	const char* start = mPos;
+	while (mPos < mEnd && !isSpace(*mPos)) mPos++;
+	word.assign(start, mPos);
+	return mPos > start;
+}
+
+bool ATextReader::readLine(std::string& line)
+{
+	if (mPos >= mEnd)
+	{
+		line.clear();
+		return false;
+	}
+	const char* start = mPos;
+	while (mPos < mEnd && *mPos != '\n') mPos++;
+	const char* end = mPos;
+	if (end > start && end[-1] == '\r') end--;	// as read by a text mode stream on Windows
+	line.assign(start, end);
+	if (mPos < mEnd) mPos++;
+	return true;
+}
+
+bool ATextReader::readUInt(unsigned int& value)
+{
+	skipSpace();
+	value = 0;
+	const char* start = mPos;
+	while (mPos < mEnd && isDigit(*mPos))
+	{
+		value = value * 10 + (*mPos - '0');
+		mPos++;
+	}
+	return mPos > start;
+}
+
+bool ATextReader::scanNumber(double& value, int& exponent, bool& exact)
+{
+	// [+-]digits[.digits][(e|E)[+-]digits], read as mantissa * 10^exponent.
+	// If the digits fit a double's 53 bit mantissa and the power of ten is at most 22,
+	// one multiply or divide gives the correctly rounded result.
+	const char* p = mPos;
+	bool negative = false;
+	if (p < mEnd && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+	uint64_t mantissa = 0;	// wraps around past 19 digits, such numbers are not exact
+	const char* intDigits = p;
+	while (p < mEnd && isDigit(*p)) mantissa = mantissa * 10 + (*p++ - '0');
+	int numDigits = (int)(p - intDigits);
+	exponent = 0;
+	if (p < mEnd && *p == '.')
+	{
+		const char* fracDigits = ++p;
+		while (p < mEnd && isDigit(*p)) mantissa = mantissa * 10 + (*p++ - '0');
+		exponent = -(int)(p - fracDigits);
+		numDigits -= exponent;
+	}
+	if (numDigits == 0) return false;
+
+	if (p < mEnd && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negativeExponent = false;
+		if (q < mEnd && (*q == '-' || *q == '+')) negativeExponent = *q++ == '-';
+		if (q < mEnd && isDigit(*q))
+		{
+			int e = 0;
+			for (; q < mEnd && isDigit(*q); q++) e = e < 100000 ? e * 10 + (*q - '0') : e;
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+	mPos = p;
+
+	exact = numDigits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22;
+	if (exact)
+	{
+		value = exponent < 0 ? (double)mantissa / kPow10[-exponent] : (double)mantissa * kPow10[exponent];
+		if (negative) value = -value;
+	}
+	return true;
+}
+
+bool ATextReader::readDouble(double& value)
+{
+	skipSpace();
+	const char* start = mPos;
+	int exponent;
+	bool exact;
+	if (!scanNumber(value, exponent, exact))
+	{
+		value = 0.0;
+		return false;
+	}
+	if (!exact)
+	{
+		// Rare long or huge numbers go through the C library
+		value = strtod(std::string(start, mPos).c_str(), 0);
+	}
+	return true;
+}
+
+bool ATextReader::readFloat(float& value)
+{
+	skipSpace();
+	const char* start = mPos;
+	double number;
+	int exponent;
+	bool exact;
+	if (!scanNumber(number, exponent, exact))
+	{
+		value = 0.0f;
+		return false;
+	}
+
+	// Rounding the correctly rounded double to float can only differ from rounding the decimal directly
+	// when the decimal lies within 2^-53 of a float midpoint. Decimals with at most 8 fraction digits and
+	// a magnitude below 2^24 are always further away than that.
+	if (exact && exponent >= -8 && number < 16777216.0 && number > -16777216.0)
+	{
+		value = (float)number;
+	}
+	else
+	{
+		value = strtof(std::string(start, mPos).c_str(), 0);
+	}
+	return true;
+}
+
+void ATextReader::skipChar()
+{
+	if (mPos < mEnd) mPos++;
+}
+
+bool ATextReader::isEnd() const
+{
+	return mPos >= mEnd;
+}
+
+size_t ATextReader::getOffset() const
+{
+	return mPos - mBegin;
+}
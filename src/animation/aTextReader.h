@@ -0,0 +1,34 @@
+#ifndef ATextReader_H_
+#define ATextReader_H_
+
+#include <string>
+
+// Cursor over text held in memory, e.g. an AMappedFile.
+// readWord, readLine and the number readers behave like >>, getline and get on a std::ifstream
+// opened in text mode, but numbers are scanned by hand instead of through the stream locale.
+class ATextReader
+{
+public:
+	ATextReader(const char* begin, const char* end);
+
+	bool readWord(std::string& word);	// next whitespace separated word
+	bool readLine(std::string& line);	// rest of the current line, without the line break
+	bool readUInt(unsigned int& value);
+	bool readFloat(float& value);
+	bool readDouble(double& value);
+	void skipChar();
+
+	bool isEnd() const;
+	size_t getOffset() const;	// bytes consumed so far
+
+protected:
+	void skipSpace();
+	bool scanNumber(double& value, int& exponent, bool& exact);	// value is only set if exact
+
+protected:
+	const char* mBegin;
+	const char* mPos;
+	const char* mEnd;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "aThreadPool.h"
+#include <algorithm>
+
+static thread_local bool tInsideJob = false;	// set while a thread runs parallelFor chunks
+
+// Sets tInsideJob for as long as it lives, so that a throwing body does not leave it set
+struct InsideJobScope
+{
+	InsideJobScope() { tInsideJob = true; }
+	~InsideJobScope() { tInsideJob = false; }
+};
+
+AThreadPool::AThreadPool(int numThreads) : mStop(false)
+{
+	setNumThreads(numThreads);
+}
+
+AThreadPool::~AThreadPool()
+{
+	std::lock_guard<std::shared_timed_mutex> workersLock(mWorkersMutex);
+	stopWorkers();
+}
+
+void AThreadPool::setNumThreads(int numThreads)
+{
+	if (numThreads <= 0) numThreads = GetHardwareThreads();
+	std::lock_guard<std::shared_timed_mutex> workersLock(mWorkersMutex);
+	if (numThreads == getNumThreads() && !mWorkers.empty()) return;
+	stopWorkers();
+	startWorkers(numThreads - 1);
+}
+
+int AThreadPool::getNumThreads() const
+{
+	return (int)mWorkers.size() + 1;
+}
+
+void AThreadPool::startWorkers(int numWorkers)
+{
+	mStop = false;
+	for (int i = 0; i < numWorkers; i++)
+	{
+		mWorkers.push_back(std::thread(&AThreadPool::workerLoop, this));
+	}
+}
+
+void AThreadPool::stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWakeWorkers.notify_all();
+	for (std::thread& worker : mWorkers)
+	{
+		worker.join();
+	}
+	mWorkers.clear();
+}
+
+void AThreadPool::parallelFor(int count, const std::function<void(int, int)>& body, int grainSize, int maxThreads)
+{
+	if (count <= 0) return;
+	grainSize = std::max(grainSize, 1);
+
+	// Nested calls run serially before taking the lock, which setNumThreads may be waiting for
+	std::shared_lock<std::shared_timed_mutex> workersLock(mWorkersMutex, std::defer_lock);
+	if (!tInsideJob) workersLock.lock();
+	int numThreads = maxThreads > 0 ? std::min(maxThreads, getNumThreads()) : getNumThreads();
+	if (numThreads <= 1 || count <= grainSize || tInsideJob)
+	{
+		for (int begin = 0; begin < count; begin += grainSize)
+		{
+			body(begin, std::min(begin + grainSize, count));
+		}
+		return;
+	}
+
+	Job job;
+	job.body = &body;
+	job.count = count;
+	job.grainSize = grainSize;
+	job.maxWorkers = numThreads - 1;
+	job.numWorkers = 0;
+	job.busyWorkers = 0;
+	job.next = 0;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(&job);
+	}
+	mWakeWorkers.notify_all();
+
+	{
+		InsideJobScope inside;
+		RunChunks(job);
+	}
+
+	// Every chunk has been taken, wait for the workers still running one. RunChunks does not throw, so the
+	// job is always taken off the list before it goes out of scope.
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mJobDone.wait(lock, [&job] { return job.busyWorkers == 0; });
+		mJobs.erase(std::find(mJobs.begin(), mJobs.end(), &job));
+	}
+	if (job.error) std::rethrow_exception(job.error);
+}
+
+AThreadPool::Job* AThreadPool::findJob()
+{
+	for (Job* job : mJobs)
+	{
+		if (job->numWorkers < job->maxWorkers && job->next.load() < job->count) return job;
+	}
+	return 0;
+}
+
+void AThreadPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true)
+	{
+		Job* job = 0;
+		mWakeWorkers.wait(lock, [this, &job] { return mStop || (job = findJob()) != 0; });
+		if (mStop) return;
+
+		job->numWorkers++;
+		job->busyWorkers++;
+		lock.unlock();
+
+		{
+			InsideJobScope inside;
+			RunChunks(*job);
+		}
+
+		lock.lock();
+		if (--job->busyWorkers == 0) mJobDone.notify_all();
+	}
+}
+
+void AThreadPool::RunChunks(Job& job)
+{
+	int begin;
+	while ((begin = job.next.fetch_add(job.grainSize)) < job.count)
+	{
+		try
+		{
+			(*job.body)(begin, std::min(begin + job.grainSize, job.count));
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(job.errorMutex);
+			if (!job.error) job.error = std::current_exception();
+			job.next = job.count;	// no more chunks
+		}
+	}
+}
+
+AThreadPool& AThreadPool::Get()
+{
+	static AThreadPool* pool = new AThreadPool();	// never deleted, see Shutdown
+	return *pool;
+}
+
+void AThreadPool::Shutdown()
+{
+	Get().setNumThreads(1);
+}
+
+int AThreadPool::GetHardwareThreads()
+{
+	return std::max(1, (int)std::thread::hardware_concurrency());
+}
@@ -0,0 +1,75 @@
+#ifndef AThreadPool_H_
+#define AThreadPool_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for data parallel loops.
+// parallelFor splits [0, count) into chunks that the workers and the calling thread take in turn until
+// none are left. The body is only ever called on disjoint ranges, so results that each index writes to
+// its own output do not depend on the number of threads or on scheduling.
+// Several threads can call parallelFor at the same time: their jobs run side by side, each worker helping
+// one job at a time, and every caller works on its own job until it is done.
+class AThreadPool
+{
+public:
+	AThreadPool(int numThreads = 0);	// 0 for one thread per hardware thread
+	virtual ~AThreadPool();
+
+	void setNumThreads(int numThreads);	// threads used by parallelFor, the caller included. Waits for running jobs.
+	int getNumThreads() const;
+
+	// Calls body(begin, end) on ranges of at most grainSize indices, on up to maxThreads threads
+	// (0 for getNumThreads()), and returns once all of [0, count) is done.
+	// Calls made from inside a body run serially on the calling thread.
+	// If body throws, the chunks not started yet are skipped and the first exception is rethrown to the caller
+	// once the chunks already running are done.
+	void parallelFor(int count, const std::function<void(int, int)>& body, int grainSize = 1, int maxThreads = 0);
+
+	static AThreadPool& Get();	// pool shared by the animation library
+	// Joins the threads of Get(), after which its parallelFor runs on the calling thread. Call before the
+	// library is unloaded: Get() is never destroyed, so its threads are not joined from a static destructor,
+	// which can deadlock while a DLL unloads.
+	static void Shutdown();
+	static int GetHardwareThreads();
+
+protected:
+	struct Job
+	{
+		const std::function<void(int, int)>* body;
+		int count;
+		int grainSize;
+		int maxWorkers;	// workers allowed to join, not counting the caller
+		int numWorkers;	// workers that joined, guarded by mMutex
+		int busyWorkers;	// workers inside the job, guarded by mMutex
+		std::atomic<int> next;	// first index of the next chunk
+		std::mutex errorMutex;
+		std::exception_ptr error;	// first exception thrown by body
+	};
+
+	void startWorkers(int numWorkers);
+	void stopWorkers();
+	void workerLoop();
+	Job* findJob();	// a job a worker can join, with mMutex held
+	static void RunChunks(Job& job);
+
+	AThreadPool(const AThreadPool&);
+	AThreadPool& operator=(const AThreadPool&);
+
+protected:
+	std::vector<std::thread> mWorkers;
+	std::shared_timed_mutex mWorkersMutex;	// shared by running jobs, exclusive while the workers change
+	std::mutex mMutex;
+	std::condition_variable mWakeWorkers;
+	std::condition_variable mJobDone;
+	std::vector<Job*> mJobs;	// jobs in progress, oldest first
+	bool mStop;
+};
+
+#endif
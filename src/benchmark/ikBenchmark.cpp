@@ -0,0 +1,374 @@
+// IK benchmark
+// Solves the foot IK of 1 to 5000 actors playing one clip, the way FKIKPlugin does: one actor after the other,
+// and with AActor::SolveFootIKBatch on all hardware threads. Checks that both leave the actors in the same pose,
+// on ground tilted by up to about 17 degrees, and how far the feet turn from the pose solved on flat ground.
+// Then compares the CCD, FABRIK and damped least squares (IKSolver_PseudoInv) solvers on the full chains from a few
+// end joints to the root, following a target that moves around the animated end joint, with the heap allocations
+// each solve makes once the solver has its workspace. Last, solves both hands and the head one after the other
+// with IKSolver_PseudoInv against solving them together with IKSolver_Multi, also measured past the closest
+// point each chain can reach.
+// Usage: ikBenchmark [clip.bvh]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "aActor.h"
+#include "aThreadPool.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Heap allocations, counted by the allocation functions below. Eigen allocates with malloc, so with glibc malloc
+// itself is counted, which operator new also goes through. Elsewhere only operator new is counted.
+static std::atomic<long long> gHeapAllocs(0);
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+	gHeapAllocs++;
+	return __libc_malloc(size);
+}
+#else
+static void* countedAlloc(size_t size)
+{
+	gHeapAllocs++;
+	return malloc(size ? size : 1);
+}
+
+void* operator new(size_t size)
+{
+	void* p = countedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	void* p = countedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+#endif
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// The limb joint IDs of IKController are those of the FBX rig, so look them up by name in the clip's
+// skeleton, as FBXModel::setLimbJoints does
+static void setupIK(AActor* actor)
+{
+	ASkeleton* skeleton = actor->getSkeleton();
+	IKController* ik = actor->getIKController();
+	const char* names[] = { "Beta:Hips", "Beta:LeftHand", "Beta:RightHand", "Beta:LeftFoot", "Beta:RightFoot" };
+	int* ids[] = { &ik->mRootID, &ik->mLhandID, &ik->mRhandID, &ik->mLfootID, &ik->mRfootID };
+	for (int i = 0; i < 5; i++)
+	{
+		AJoint* joint = skeleton->getJointByName(names[i]);
+		if (joint) *ids[i] = joint->getID();
+	}
+	ik->getIKSkeleton()->copyHierarchy(skeleton);
+	ik->createLimbIKchains();
+}
+
+struct Crowd
+{
+	std::vector<std::unique_ptr<AActor>> actors;
+	std::vector<AActor*> pointers;
+	std::vector<AActor::FootIKParams> params;
+};
+
+static bool createCrowd(Crowd& crowd, const std::string& filename, int numActors)
+{
+	crowd.actors.resize(numActors);
+	crowd.pointers.resize(numActors);
+	crowd.params.resize(numActors);
+	for (int i = 0; i < numActors; i++)
+	{
+		crowd.actors[i].reset(new AActor());
+		AActor* actor = crowd.actors[i].get();
+		if (!actor->getBVHController()->load(filename)) return false;
+		setupIK(actor);
+		crowd.pointers[i] = actor;
+
+		// Uneven ground, different for every actor
+		AActor::FootIKParams& params = crowd.params[i];
+		params.leftHeight = (float)(2.0 * sin(0.7 * i));
+		params.rightHeight = (float)(2.0 * cos(0.3 * i));
+		params.rotateLeft = true;
+		params.rotateRight = true;
+		params.leftNormal = vec3(0.3 * sin(1.3 * i), 1.0, 0.3 * cos(1.3 * i)).Normalize();
+		params.rightNormal = vec3(0.3 * cos(0.9 * i), 1.0, 0.3 * sin(0.9 * i)).Normalize();
+	}
+	return true;
+}
+
+// Every actor at its own point of the clip
+static void poseCrowd(Crowd& crowd, int frame)
+{
+	for (int i = 0; i < crowd.actors.size(); i++)
+	{
+		crowd.actors[i]->getBVHController()->update(0.013 * i + frame / 120.0);
+	}
+}
+
+static void solveSerial(Crowd& crowd)
+{
+	for (int i = 0; i < crowd.actors.size(); i++)
+	{
+		const AActor::FootIKParams& p = crowd.params[i];
+		crowd.actors[i]->solveFootIK(p.leftHeight, p.rightHeight, p.rotateLeft, p.rotateRight, p.leftNormal, p.rightNormal);
+	}
+}
+
+static void solveBatch(Crowd& crowd)
+{
+	AActor::SolveFootIKBatch(crowd.pointers.data(), crowd.params.data(), (int)crowd.pointers.size());
+}
+
+static void savePoses(Crowd& crowd, std::vector<ATransform>& poses)
+{
+	poses.clear();
+	std::vector<ATransform> globals;
+	for (int i = 0; i < crowd.actors.size(); i++)
+	{
+		crowd.actors[i]->getSkeleton()->getLocal2Global(globals);
+		poses.insert(poses.end(), globals.begin(), globals.end());
+	}
+}
+
+// Largest angle in degrees between the foot rotations of two poses of the crowd
+static double maxFootAngle(Crowd& crowd, const std::vector<ATransform>& a, const std::vector<ATransform>& b)
+{
+	double maxAngle = 0.0;
+	int offset = 0;
+	for (int i = 0; i < crowd.actors.size(); i++)
+	{
+		IKController* ik = crowd.actors[i]->getIKController();
+		for (int foot : { ik->mLfootID, ik->mRfootID })
+		{
+			mat3 difference = a[offset + foot].m_rotation * b[offset + foot].m_rotation.Transpose();
+			double cosAngle = 0.5 * (difference[0][0] + difference[1][1] + difference[2][2] - 1.0);
+			maxAngle = std::max(maxAngle, acos(std::min(1.0, std::max(-1.0, cosAngle))) * Rad2Deg);
+		}
+		offset += crowd.actors[i]->getSkeleton()->getNumJoints();
+	}
+	return maxAngle;
+}
+
+static double timeSolves(Crowd& crowd, bool batch, int numFrames)
+{
+	double ms = 0.0;
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		poseCrowd(crowd, frame);
+		Clock::time_point start = Clock::now();
+		if (batch) solveBatch(crowd);
+		else solveSerial(crowd);
+		ms += elapsedMs(start);
+	}
+	return ms / numFrames;
+}
+
+static void compareSolvers(const std::string& filename, const std::string& endJointName, int maxIterations)
+{
+	AActor actor;
+	actor.getBVHController()->load(filename);
+	ASkeleton* skeleton = actor.getSkeleton();
+	IKController* ik = actor.getIKController();
+	setupIK(&actor);
+	AJoint* endJoint = skeleton->getJointByName(endJointName);
+	if (!endJoint) return;
+	int endJointID = endJoint->getID();
+	int chainSize = ik->createIKchain(endJointID, -1, ik->getIKSkeleton()).getSize();
+
+	const int numFrames = 2000;
+	const char* names[] = { "CCD", "FABRIK", "DLS" };
+	IKController::gIKmaxIterations = maxIterations;
+	for (int solver = 0; solver < 3; solver++)
+	{
+		double ms = 0.0, sumResidual = 0.0, maxResidual = 0.0;
+		int iterations = 0, reached = 0;
+		long long allocs = 0;
+		for (int frame = 0; frame < numFrames; frame++)
+		{
+			double t = frame / 120.0;
+			actor.getBVHController()->update(t);
+			ATarget target;
+			target.setGlobalTranslation(endJoint->getGlobalTranslation() + vec3(8 * sin(2 * t), 6 + 4 * cos(3 * t), 5));
+
+			long long allocsBefore = gHeapAllocs;
+			Clock::time_point start = Clock::now();
+			bool ok = solver == 0 ? ik->IKSolver_CCD(endJointID, target) :
+				solver == 1 ? ik->IKSolver_Other(endJointID, target) : ik->IKSolver_PseudoInv(endJointID, target);
+			ms += elapsedMs(start);
+			if (frame > 0) allocs += gHeapAllocs - allocsBefore;	// the first solve sizes the workspace
+			reached += ok;
+			iterations += ik->getIKIterations();
+			sumResidual += ik->getIKResidual();
+			maxResidual = std::max(maxResidual, ik->getIKResidual());
+		}
+		printf("  %-20s %6d %8d %-7s %10.2f %10.2f %12.3f %12.3f %7.1f%% %12.2f\n", endJointName.c_str(), chainSize,
+			maxIterations, names[solver], ms * 1000.0 / numFrames, (double)iterations / numFrames, sumResidual / numFrames,
+			maxResidual, 100.0 * reached / numFrames, (double)allocs / (numFrames - 1));
+	}
+	IKController::gIKmaxIterations = 5;
+}
+
+static void compareMultiEffector(const std::string& filename)
+{
+	AActor actor;
+	actor.getBVHController()->load(filename);
+	ASkeleton* skeleton = actor.getSkeleton();
+	IKController* ik = actor.getIKController();
+	setupIK(&actor);
+	AJoint* head = skeleton->getJointByName("Beta:Head");
+	if (!head) return;
+	std::vector<int> endJointIDs = { ik->mLhandID, ik->mRhandID, head->getID() };
+	std::vector<ATarget> targets(endJointIDs.size());
+
+	// The targets go up to 7 above the animated joints, further than the spine lets the head reach, so the
+	// residual of every chain is also measured past the closest it can get: the distance of its target from
+	// the base of the chain, less the length of the chain
+	actor.getBVHController()->update(0.0);
+	std::vector<int> baseIDs(endJointIDs.size());
+	std::vector<double> lengths(endJointIDs.size());
+	for (int i = 0; i < endJointIDs.size(); i++)
+	{
+		AIKchain chain = ik->createIKchain(endJointIDs[i], -1, skeleton);
+		baseIDs[i] = chain.getJoint(chain.getSize() - 1)->getID();
+		lengths[i] = chain.getLength();
+	}
+
+	const int numFrames = 2000;
+	const char* names[] = { "one by one", "together" };
+	for (int solver = 0; solver < 2; solver++)
+	{
+		double ms = 0.0, sumResidual = 0.0, maxResidual = 0.0, sumExcess = 0.0, maxExcess = 0.0;
+		int reached = 0;
+		long long allocs = 0;
+		for (int frame = 0; frame < numFrames; frame++)
+		{
+			double t = frame / 120.0;
+			actor.getBVHController()->update(t);
+			for (int i = 0; i < endJointIDs.size(); i++)
+			{
+				vec3 p = skeleton->getJointByID(endJointIDs[i])->getGlobalTranslation();
+				targets[i].setGlobalTranslation(p + vec3(6 * sin(2 * t + i), 4 + 3 * cos(3 * t + i), 4));
+			}
+
+			long long allocsBefore = gHeapAllocs;
+			Clock::time_point start = Clock::now();
+			if (solver == 0)
+			{
+				for (int i = 0; i < endJointIDs.size(); i++) ik->IKSolver_PseudoInv(endJointIDs[i], targets[i]);
+			}
+			else ik->IKSolver_Multi(endJointIDs, targets);
+			ms += elapsedMs(start);
+			if (frame > 0) allocs += gHeapAllocs - allocsBefore;
+
+			// a later chain moves the spine under an earlier one, so look at all of them once done
+			double residual = 0.0, excess = 0.0;
+			for (int i = 0; i < endJointIDs.size(); i++)
+			{
+				vec3 goal = targets[i].getGlobalTranslation();
+				double chainResidual = (goal - skeleton->getJointByID(endJointIDs[i])->getGlobalTranslation()).Length();
+				double minResidual = std::max(0.0, (goal - skeleton->getJointByID(baseIDs[i])->getGlobalTranslation()).Length() - lengths[i]);
+				residual = std::max(residual, chainResidual);
+				excess = std::max(excess, chainResidual - minResidual);
+			}
+			sumResidual += residual;
+			maxResidual = std::max(maxResidual, residual);
+			sumExcess += excess;
+			maxExcess = std::max(maxExcess, excess);
+			reached += excess <= IKController::gIKEpsilon;
+		}
+		printf("  %-12s %10.2f %12.3f %12.3f %12.3f %12.3f %7.1f%% %12.2f\n", names[solver], ms * 1000.0 / numFrames,
+			sumResidual / numFrames, maxResidual, sumExcess / numFrames, maxExcess, 100.0 * reached / numFrames,
+			(double)allocs / (numFrames - 1));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string filename = argc > 1 ? argv[1] : "../motions/Beta/walking.bvh";
+	const int actorCounts[] = { 1, 10, 100, 1000, 5000 };
+	int numThreads = AThreadPool::Get().getNumThreads();
+	printf("Foot IK of actors playing %s, batch on %d threads\n", filename.c_str(), numThreads);
+	printf("  %6s %12s %12s %14s %8s %6s %10s\n", "actors", "serial ms", "batch ms", "batch us/actor", "speedup", "same",
+		"foot turn");
+
+	for (int numActors : actorCounts)
+	{
+		Crowd crowd;
+		if (!createCrowd(crowd, filename, numActors))
+		{
+			printf("Could not load %s\n", filename.c_str());
+			return 1;
+		}
+
+		// Same pose both ways, to the bit
+		std::vector<ATransform> serialPoses, batchPoses;
+		poseCrowd(crowd, 0);
+		solveSerial(crowd);
+		savePoses(crowd, serialPoses);
+		poseCrowd(crowd, 0);
+		solveBatch(crowd);
+		savePoses(crowd, batchPoses);
+		bool same = memcmp(serialPoses.data(), batchPoses.data(), serialPoses.size() * sizeof(ATransform)) == 0;
+
+		// The normals turn the feet: same solve on flat ground
+		std::vector<AActor::FootIKParams> tilted = crowd.params;
+		for (AActor::FootIKParams& params : crowd.params)
+		{
+			params.leftNormal = params.rightNormal = vec3(0, 1, 0);
+		}
+		std::vector<ATransform> flatPoses;
+		poseCrowd(crowd, 0);
+		solveBatch(crowd);
+		savePoses(crowd, flatPoses);
+		crowd.params = tilted;
+		double footTurn = maxFootAngle(crowd, serialPoses, flatPoses);
+
+		int numFrames = std::max(2, 20000 / numActors);
+		double serialMs = timeSolves(crowd, false, numFrames);
+		double batchMs = timeSolves(crowd, true, numFrames);
+		printf("  %6d %12.3f %12.3f %14.2f %7.2fx %6s %8.1f deg\n", numActors, serialMs, batchMs, batchMs * 1000.0 / numActors,
+			serialMs / batchMs, same ? "yes" : "NO", footTurn);
+	}
+
+	printf("CCD, FABRIK and damped least squares on full chains, epsilon %g\n", IKController::gIKEpsilon);
+	printf("  %-20s %6s %8s %-7s %10s %10s %12s %12s %8s %12s\n", "end joint", "joints", "max its", "solver", "us/solve",
+		"its/solve", "avg residual", "max residual", "reached", "allocs/solve");
+	const char* endJoints[] = { "Beta:LeftHand", "Beta:LeftHandMiddle3", "Beta:Head", "Beta:RightToeBase" };
+	for (const char* endJoint : endJoints)
+	{
+		compareSolvers(filename, endJoint, 5);
+		compareSolvers(filename, endJoint, 20);
+	}
+
+	printf("Both hands and the head, damped least squares\n");
+	printf("  %-12s %10s %12s %12s %12s %12s %8s %12s\n", "chains", "us/solve", "avg residual", "max residual", "avg past",
+		"max past", "reached", "allocs/solve");
+	compareMultiEffector(filename);
+	return 0;
+}
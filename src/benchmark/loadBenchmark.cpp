@@ -0,0 +1,206 @@
+// Clip load-time benchmark
+// Times BVHController::load on every clip in the motion folder, then on synthetic clips of
+// increasing length built from the same hierarchy, to check that loading scales linearly with frame count.
+// Then times the cold start of a 500 clip library, parsing the .bvh text and mapping the compiled .bvhc clips,
+// and the per joint curve caching of a clip load on 1 to all hardware threads.
+// Usage: loadBenchmark [motionFolder]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "aActor.h"
+#include "aSplineQuat.h"
+#include "aThreadPool.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double timeLoad(const std::string& filename, int& numFrames)
+{
+	AActor actor;
+	Clock::time_point start = Clock::now();
+	bool loaded = actor.getBVHController()->load(filename);
+	double ms = elapsedMs(start);
+	numFrames = loaded ? actor.getBVHController()->getKeySize() : 0;
+	return loaded ? ms : -1.0;
+}
+
+// Copy the HIERARCHY section of a clip and append numFrames frames of smooth synthetic motion
+static bool writeSyntheticClip(const std::string& source, const std::string& filename, int numFrames)
+{
+	std::ifstream inFile(source.c_str());
+	if (!inFile.is_open()) return false;
+
+	std::stringstream hierarchy;
+	std::string line;
+	int numChannels = 0;
+	while (std::getline(inFile, line) && line.find("MOTION") == std::string::npos)
+	{
+		hierarchy << line << "\n";
+		size_t pos = line.find("CHANNELS");
+		if (pos != std::string::npos) numChannels += atoi(line.c_str() + pos + 8);
+	}
+
+	std::ofstream outFile(filename.c_str());
+	if (!outFile.is_open()) return false;
+	outFile << hierarchy.str();
+	outFile << "MOTION\nFrames: " << numFrames << "\nFrame Time: 0.008333\n";
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		for (int c = 0; c < numChannels; c++)
+		{
+			outFile << 30.0 * sin(0.01 * frame + c) << (c + 1 < numChannels ? " " : "\n");
+		}
+	}
+	return true;
+}
+
+// Loads numClips actors, cycling through clips, the way a game opens its animation library at startup
+static void benchLibrary(const std::vector<std::string>& clips, int numClips, bool useClipCache)
+{
+	BVHController::gUseClipCache = useClipCache;
+	std::vector<AActor*> actors(numClips);
+	Clock::time_point start = Clock::now();
+	int numFailed = 0;
+	for (int i = 0; i < numClips; i++)
+	{
+		actors[i] = new AActor();
+		if (!actors[i]->getBVHController()->load(clips[i % clips.size()])) numFailed++;
+	}
+	double ms = elapsedMs(start);
+	printf("  %-8s %4d clips %10.2f ms %8.3f ms/clip%s\n", useClipCache ? "compiled" : "text",
+		numClips, ms, ms / numClips, numFailed ? "  (load failures)" : "");
+	for (AActor* actor : actors) delete actor;
+}
+
+static void benchSplineCache(int numKeys, ASplineQuat::InterpolationType type)
+{
+	ASplineQuat spline;
+	spline.setFramerate(120.0);
+	for (int i = 0; i < numKeys; i++)
+	{
+		quat q;
+		q.FromAxisAngle(vec3(0.3, 1.0, 0.2).Normalize(), 0.01 * i);
+		spline.appendKey(i / 120.0, q, false);
+	}
+
+	Clock::time_point start = Clock::now();
+	spline.setInterpolationType(type);	// caches the curve
+	double ms = elapsedMs(start);
+	printf("  %-6s %8d keys %10.2f ms %8.3f us/key\n", type == ASplineQuat::LINEAR ? "linear" : "cubic",
+		numKeys, ms, 1000.0 * ms / numKeys);
+}
+
+// What BVHController::loadMotion does after parsing: cache every joint curve, then pack the tracks
+static void benchParallelCache(int numJoints, int numKeys)
+{
+	std::vector<ASplineQuat> joints(numJoints);
+	for (int j = 0; j < numJoints; j++)
+	{
+		joints[j].setFramerate(120.0);
+		for (int i = 0; i < numKeys; i++)
+		{
+			quat q;
+			q.FromAxisAngle(vec3(0.3, 1.0, 0.2 * j).Normalize(), 0.01 * i + j);
+			joints[j].appendKey(i / 120.0, q, false);
+		}
+	}
+
+	std::vector<quat> serialRow;
+	double serialMs = 0.0;
+	for (int numThreads = 1; numThreads <= AThreadPool::GetHardwareThreads(); numThreads *= 2)
+	{
+		AMotionTracks tracks;
+		Clock::time_point start = Clock::now();
+		AThreadPool::Get().parallelFor(numJoints, [&joints](int begin, int end)
+		{
+			for (int j = begin; j < end; j++) joints[j].cacheCurve();
+		}, 1, numThreads);
+		tracks.build(joints, numThreads);
+		double ms = elapsedMs(start);
+
+		const quat* row = tracks.getFrame(tracks.getNumFrames() / 2);
+		if (numThreads == 1)
+		{
+			serialMs = ms;
+			serialRow.assign(row, row + numJoints);
+		}
+		bool same = memcmp(serialRow.data(), row, numJoints * sizeof(quat)) == 0;
+		printf("  %3d threads %10.2f ms  speedup %5.2fx%s\n", numThreads, ms, serialMs / ms, same ? "" : "  (differs from 1 thread)");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string folder = argc > 1 ? argv[1] : "../motions/Beta";
+
+	printf("BVH clips in %s\n", folder.c_str());
+	BVHController::gUseClipCache = false;
+	std::string hierarchySource;
+	std::vector<std::string> clips;
+	for (const auto& entry : std::experimental::filesystem::directory_iterator(folder))
+	{
+		if (entry.path().extension().generic_string().compare(".bvh") != 0) continue;
+		std::string filename = entry.path().generic_string();
+		if (entry.path().stem().generic_string().compare("Beta") == 0) hierarchySource = filename;
+		clips.push_back(filename);
+
+		int numFrames = 0;
+		double ms = timeLoad(filename, numFrames);
+		printf("  %-32s %7d frames %10.2f ms\n", entry.path().stem().generic_string().c_str(), numFrames, ms);
+	}
+	if (!clips.empty())
+	{
+		// Loading each clip once with the cache on writes its .bvhc, the timed loads then map them
+		BVHController::gUseClipCache = true;
+		for (const std::string& clip : clips)
+		{
+			AActor actor;
+			actor.getBVHController()->load(clip);
+		}
+		printf("Clip library cold start\n");
+		benchLibrary(clips, 500, false);
+		benchLibrary(clips, 500, true);
+		BVHController::gUseClipCache = false;
+	}
+
+	if (hierarchySource.empty())
+	{
+		printf("Beta.bvh not found, skipping synthetic clips\n");
+		return 0;
+	}
+
+	printf("Synthetic clips (Beta hierarchy)\n");
+	const int frameCounts[] = { 1000, 10000, 100000 };
+	for (int numFrames : frameCounts)
+	{
+		std::string filename = "loadBenchmark_synthetic.bvh";
+		if (!writeSyntheticClip(hierarchySource, filename, numFrames)) return 1;
+		int loadedFrames = 0;
+		double ms = timeLoad(filename, loadedFrames);
+		printf("  %8d frames %10.2f ms %8.3f us/frame\n", loadedFrames, ms, 1000.0 * ms / numFrames);
+		std::remove(filename.c_str());
+	}
+
+	printf("Parallel curve caching, 64 joints x 20000 keys\n");
+	benchParallelCache(64, 20000);
+
+	printf("ASplineQuat::cacheCurve\n");
+	for (int numKeys : frameCounts)
+	{
+		benchSplineCache(numKeys, ASplineQuat::LINEAR);
+		benchSplineCache(numKeys, ASplineQuat::CUBIC);
+	}
+	return 0;
+}
@@ -0,0 +1,104 @@
+// BVH parse-throughput benchmark
+// For every clip in the motion folder, reads the MOTION section values with std::ifstream >> float (how
+// BVHController::loadFrame used to read them) and with ATextReader, then times a full BVHController::load
+// without the compiled clip cache. Throughput is reported in MB/s of .bvh text.
+// Usage: parseBenchmark [motionFolder]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "aActor.h"
+#include "aMappedFile.h"
+#include "aTextReader.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const int kRepeats = 5;	// best of
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double parseStream(const std::string& filename, int& numValues)
+{
+	double best = 1e30;
+	for (int i = 0; i < kRepeats; i++)
+	{
+		Clock::time_point start = Clock::now();
+		std::ifstream inFile(filename.c_str());
+		std::string readString;
+		while (inFile >> readString && readString != "Time:");
+		inFile >> readString;
+
+		float value;
+		numValues = 0;
+		while (inFile >> value) numValues++;
+		best = std::min(best, elapsedMs(start));
+	}
+	return best;
+}
+
+static double parseReader(const std::string& filename, int& numValues)
+{
+	double best = 1e30;
+	for (int i = 0; i < kRepeats; i++)
+	{
+		Clock::time_point start = Clock::now();
+		AMappedFile file;
+		if (!file.open(filename)) return -1.0;
+		ATextReader reader(file.getData(), file.getData() + file.getSize());
+		std::string readString;
+		while (reader.readWord(readString) && readString != "Time:");
+		reader.readWord(readString);
+
+		float value;
+		numValues = 0;
+		while (reader.readFloat(value)) numValues++;
+		best = std::min(best, elapsedMs(start));
+	}
+	return best;
+}
+
+static double load(const std::string& filename)
+{
+	double best = 1e30;
+	for (int i = 0; i < kRepeats; i++)
+	{
+		AActor actor;
+		Clock::time_point start = Clock::now();
+		if (!actor.getBVHController()->load(filename)) return -1.0;
+		best = std::min(best, elapsedMs(start));
+	}
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	std::string folder = argc > 1 ? argv[1] : "../motions/Beta";
+	BVHController::gUseClipCache = false;
+
+	printf("%-28s %8s %8s | %-18s %-18s %7s | %-18s\n", "clip", "KB", "values",
+		"ifstream MB/s", "ATextReader MB/s", "speedup", "load MB/s (ms)");
+	for (const auto& entry : std::experimental::filesystem::directory_iterator(folder))
+	{
+		if (entry.path().extension().generic_string().compare(".bvh") != 0) continue;
+		std::string filename = entry.path().generic_string();
+		double mb = std::experimental::filesystem::file_size(entry.path()) / 1e6;
+
+		int streamValues = 0, readerValues = 0;
+		double streamMs = parseStream(filename, streamValues);
+		double readerMs = parseReader(filename, readerValues);
+		double loadMs = load(filename);
+		printf("%-28s %8.0f %8d | %18.1f %18.1f %6.1fx | %8.1f (%6.2f)%s\n",
+			entry.path().stem().generic_string().c_str(), mb * 1000.0, readerValues,
+			mb / streamMs * 1000.0, mb / readerMs * 1000.0, streamMs / readerMs,
+			mb / loadMs * 1000.0, loadMs, streamValues == readerValues ? "" : "  value count mismatch");
+	}
+	return 0;
+}
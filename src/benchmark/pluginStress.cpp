@@ -0,0 +1,271 @@
+// Plugin stress test
+// Calls into FKIKPlugin and CurvePlugin from many threads at once, the way a game updating its actors on
+// worker threads does. Every worker creates its own actors and curves, plays and solves them and checks that
+// it gets the same pose as an actor updated alone on the main thread. Meanwhile one thread keeps creating and
+// removing actors that a batch thread passes to UpdateAll and SolveFootIKBatch, and a prober calls on every
+// id handed out so far, removed or not.
+// Usage: pluginStress [clip.bvh] [threads] [seconds]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ActorUpdate
+{
+	int id;
+	float time;
+	float speedScale;
+	int wrapped;
+	int solveFootIK;
+	int rotateLeft;
+	int rotateRight;
+	float leftHeight;
+	float rightHeight;
+	float leftNormal[3];
+	float rightNormal[3];
+};
+
+struct CurveValue
+{
+	double vec[3];
+	double quat[4];
+	double euler[3];
+};
+
+extern "C"
+{
+	int CreateActor();
+	void RemoveActor(int id);
+	bool LoadBVH(int id, char* file);
+	int GetJointSize(int id);
+	void GetPoseBuffer(int id, int& floatNum, float*& posePtr);
+	void UpdateBVHSkeleton(int id, float t);
+	float GetDuration(int id);
+	void CreateLimbIKChains(int id);
+	void SolveFootIK(int id, float leftHeight, float rightHeight, bool rotateLeft, bool rotateRight,
+		float leftNormal[], float rightNormal[]);
+	void SolveFootIKBatch(int ids[], float heights[], float normals[], bool rotate[], int n);
+	void SetBatchThreads(int numThreads);
+	void UpdateAll(float dt, ActorUpdate updates[], int n);
+
+	int CreateCurve();
+	void RemoveCurve(int id);
+	void AppendVecKey(int id, double pos[]);
+	void AppendQuatKey(int id, double t, double q[]);
+	void GetValue(int id, double t, CurveValue& curveValue);
+	int GetVecKeyNum(int id);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kFrames = 16;
+static const float kHeights[2] = { 1.5f, -0.5f };
+static float gUp[3] = { 0.0f, 1.0f, 0.0f };
+
+static std::string gFilename;
+static std::vector<std::vector<float>> gReference;	// pose of each frame, updated and solved alone
+static std::atomic<bool> gStop(false);
+static std::atomic<long long> gCalls(0);
+static std::atomic<int> gFailures(0);
+
+static float frameTime(int frame)
+{
+	return frame / 30.0f;
+}
+
+static int spawnActor()
+{
+	int id = CreateActor();
+	if (id < 0 || !LoadBVH(id, (char*)gFilename.c_str())) return -1;
+	CreateLimbIKChains(id);
+	return id;
+}
+
+static void poseActor(int id, int frame)
+{
+	UpdateBVHSkeleton(id, frameTime(frame));
+	SolveFootIK(id, kHeights[0], kHeights[1], true, true, gUp, gUp);
+}
+
+static bool samePose(int id, int frame)
+{
+	int floatNum;
+	float* pose;
+	GetPoseBuffer(id, floatNum, pose);
+	const std::vector<float>& reference = gReference[frame];
+	return floatNum == reference.size() && memcmp(pose, reference.data(), floatNum * sizeof(float)) == 0;
+}
+
+static void fail(const char* what, int id)
+{
+	if (gFailures++ < 10) printf("  FAILED: %s, id %d\n", what, id);
+}
+
+// Owns a few actors and a curve at a time, and replaces them every round
+static void worker(int index)
+{
+	std::minstd_rand random(index * 7919 + 1);
+	while (!gStop)
+	{
+		int actors[3];
+		for (int& id : actors)
+		{
+			id = spawnActor();
+			if (id < 0) fail("spawn", id);
+		}
+
+		int curve = CreateCurve();
+		for (int k = 0; k < 8; k++)
+		{
+			double pos[3] = { (double)k, (double)index, 2.0 * k };
+			AppendVecKey(curve, pos);
+		}
+		if (GetVecKeyNum(curve) != 8) fail("curve keys", curve);
+
+		for (int i = 0; i < 24; i++)
+		{
+			int id = actors[random() % 3];
+			int frame = random() % kFrames;
+			poseActor(id, frame);
+			if (!samePose(id, frame)) fail("pose", id);
+
+			CurveValue value;
+			GetValue(curve, 0.5, value);
+			gCalls += 4;
+		}
+
+		for (int id : actors) RemoveActor(id);
+		RemoveCurve(curve);
+		if (GetJointSize(actors[0]) != 0) fail("removed actor", actors[0]);
+		if (GetVecKeyNum(curve) != 0) fail("removed curve", curve);
+	}
+}
+
+// Actors that UpdateAll and SolveFootIKBatch are given while being removed
+static std::mutex gVictimsMutex;
+static std::vector<int> gVictims;
+
+static void churn()
+{
+	std::minstd_rand random(12345);
+	while (!gStop)
+	{
+		int id = spawnActor();
+		std::lock_guard<std::mutex> lock(gVictimsMutex);
+		gVictims.push_back(id);
+		if (gVictims.size() > 8)
+		{
+			int victim = random() % gVictims.size();
+			RemoveActor(gVictims[victim]);	// possibly while a batch is using it, the batch keeps its id
+			gVictims.erase(gVictims.begin() + victim);
+		}
+		gCalls += 2;
+	}
+}
+
+static void batch()
+{
+	std::vector<ActorUpdate> updates;
+	std::vector<int> ids;
+	std::vector<float> heights, normals;
+	while (!gStop)
+	{
+		{
+			std::lock_guard<std::mutex> lock(gVictimsMutex);
+			ids = gVictims;
+		}
+		updates.resize(ids.size());
+		for (int i = 0; i < ids.size(); i++)
+		{
+			ActorUpdate& update = updates[i];
+			memset(&update, 0, sizeof(update));
+			update.id = ids[i];
+			update.time = frameTime(i % kFrames);
+			update.speedScale = 1.0f;
+			update.solveFootIK = 1;
+			update.rotateLeft = update.rotateRight = 1;
+			update.leftHeight = kHeights[0];
+			update.rightHeight = kHeights[1];
+			update.leftNormal[1] = update.rightNormal[1] = 1.0f;
+		}
+		UpdateAll(1.0f / 30.0f, updates.data(), (int)updates.size());
+
+		heights.assign(ids.size() * 2, 0.0f);
+		normals.assign(ids.size() * 6, 0.0f);
+		for (int i = 0; i < ids.size(); i++) normals[6 * i + 1] = normals[6 * i + 4] = 1.0f;
+		SolveFootIKBatch(ids.data(), heights.data(), normals.data(), NULL, (int)ids.size());
+		gCalls += 2;
+	}
+}
+
+// Calls on every id so far, live, removed or never handed out. Not GetPoseBuffer: the buffer of an actor is
+// read by the thread that updates it.
+static void prober()
+{
+	int maxID = 0;
+	while (!gStop)
+	{
+		for (int id = -1; id <= maxID + 2; id++)
+		{
+			int numJoints = GetJointSize(id);
+			if (numJoints != 0 && numJoints != gReference[0].size() / 7) fail("joint count", id);
+			if (GetDuration(id) < 0.0f) fail("duration", id);
+			if (GetVecKeyNum(id) < 0) fail("curve keys", id);
+			gCalls += 3;
+			if (numJoints) maxID = std::max(maxID, id);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	gFilename = argc > 1 ? argv[1] : "../motions/Beta/walking.bvh";
+	int numWorkers = argc > 2 ? atoi(argv[2]) : 8;
+	double seconds = argc > 3 ? atof(argv[3]) : 5.0;
+
+	int reference = spawnActor();
+	if (reference < 0)
+	{
+		printf("Could not load %s\n", gFilename.c_str());
+		return 1;
+	}
+	gReference.resize(kFrames);
+	for (int frame = 0; frame < kFrames; frame++)
+	{
+		poseActor(reference, frame);
+		int floatNum;
+		float* pose;
+		GetPoseBuffer(reference, floatNum, pose);
+		gReference[frame].assign(pose, pose + floatNum);
+	}
+	RemoveActor(reference);
+	SetBatchThreads(4);
+
+	printf("%d workers, churn, batch and prober threads on %s for %g s\n", numWorkers, gFilename.c_str(), seconds);
+	Clock::time_point start = Clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numWorkers; i++) threads.push_back(std::thread(worker, i));
+	threads.push_back(std::thread(churn));
+	threads.push_back(std::thread(batch));
+	threads.push_back(std::thread(prober));
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	gStop = true;
+	for (std::thread& thread : threads) thread.join();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	{
+		std::lock_guard<std::mutex> lock(gVictimsMutex);
+		for (int id : gVictims) RemoveActor(id);
+	}
+	printf("  %lld calls, %.0f calls/s, %d failures\n", (long long)gCalls, gCalls / elapsed, (int)gFailures);
+	return gFailures ? 1 : 0;
+}
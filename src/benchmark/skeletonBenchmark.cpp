@@ -0,0 +1,147 @@
+// Actor spawn benchmark
+// Spawns 1 to 1000 actors of one rig the way FKIKPlugin does (copy the loaded skeleton into the actor and
+// into its IK skeleton) and reports the time and the heap memory per actor. The skeletons share one
+// ASkeletonDef and hold only their pose and cached globals; "no globals" turns the cached globals off, and
+// "all joints" also asks every skeleton for every AJoint, which is what each actor allocated when skeletons
+// owned a copy of the hierarchy.
+// Then has 1 to 1000 actors load the same clip, with and without BVHController::gShareClips.
+// Usage: skeletonBenchmark [clip.bvh]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "aActor.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Live heap bytes, counted by the global allocation functions below. Every replaceable form goes through
+// countedAlloc and countedFree, so a form the library happens to use is not missed or freed by the wrong heap.
+static std::atomic<long long> gHeapBytes(0);
+
+static void* countedAlloc(size_t size)
+{
+	size_t* p = (size_t*)malloc(size + sizeof(size_t) * 2);
+	if (!p) return NULL;
+	p[0] = size;
+	gHeapBytes += size;
+	return p + 2;
+}
+
+static void countedFree(void* ptr)
+{
+	if (!ptr) return;
+	size_t* p = (size_t*)ptr - 2;
+	gHeapBytes -= p[0];
+	free(p);
+}
+
+void* operator new(size_t size)
+{
+	void* p = countedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	void* p = countedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void operator delete(void* ptr) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void spawn(const ASkeleton& rig, int numActors, bool allJoints, bool cachedGlobals = true)
+{
+	long long heapBefore = gHeapBytes;
+	Clock::time_point start = Clock::now();
+	std::vector<std::unique_ptr<AActor>> actors(numActors);
+	for (int i = 0; i < numActors; i++)
+	{
+		actors[i].reset(new AActor());
+		ASkeleton* skeleton = actors[i]->getSkeleton();
+		skeleton->setCachedGlobals(cachedGlobals);
+		skeleton->copyHierarchy(&rig);
+		actors[i]->getIKController()->getIKSkeleton()->copyHierarchy(skeleton);
+		if (allJoints)
+		{
+			for (int j = 0; j < skeleton->getNumJoints(); j++)
+			{
+				skeleton->getJointByID(j);
+				actors[i]->getIKController()->getIKSkeleton()->getJointByID(j);
+			}
+		}
+		actors[i]->update();
+	}
+	double ms = elapsedMs(start);
+	long long bytes = gHeapBytes - heapBefore;
+	printf("  %6d actors %-10s %10.2f ms  %8.1f us/actor  %8.1f KB/actor\n", numActors,
+		allJoints ? "all joints" : cachedGlobals ? "pose only" : "no globals", ms, ms * 1000.0 / numActors, bytes / 1024.0 / numActors);
+}
+
+static void loadClip(const std::string& filename, int numActors, bool shareClips)
+{
+	BVHController::gShareClips = shareClips;
+	long long heapBefore = gHeapBytes;
+	Clock::time_point start = Clock::now();
+	std::vector<std::unique_ptr<AActor>> actors(numActors);
+	for (int i = 0; i < numActors; i++)
+	{
+		actors[i].reset(new AActor());
+		actors[i]->getBVHController()->load(filename);
+		actors[i]->getBVHController()->update(0.5);
+	}
+	double ms = elapsedMs(start);
+	long long bytes = gHeapBytes - heapBefore;
+	printf("  %6d actors %-10s %10.2f ms  %8.1f us/actor  %8.1f KB/actor\n", numActors,
+		shareClips ? "shared" : "per actor", ms, ms * 1000.0 / numActors, bytes / 1024.0 / numActors);
+}
+
+int main(int argc, char** argv)
+{
+	std::string filename = argc > 1 ? argv[1] : "../motions/Beta/walking.bvh";
+	const int actorCounts[] = { 1, 10, 100, 1000 };
+	{
+		AActor rig;
+		if (!rig.getBVHController()->load(filename))
+		{
+			printf("Could not load %s\n", filename.c_str());
+			return 1;
+		}
+		printf("Spawning actors of %s, %d joints\n", filename.c_str(), (int)rig.getSkeleton()->getNumJoints());
+		for (int numActors : actorCounts)
+		{
+			spawn(*rig.getSkeleton(), numActors, false);
+			spawn(*rig.getSkeleton(), numActors, false, false);
+			spawn(*rig.getSkeleton(), numActors, true);
+		}
+	}
+
+	// Parse the text every time the clip is not shared
+	BVHController::gUseClipCache = false;
+	printf("Actors loading %s\n", filename.c_str());
+	for (int numActors : actorCounts)
+	{
+		loadClip(filename, numActors, true);
+		loadClip(filename, numActors, false);
+	}
+	return 0;
+}
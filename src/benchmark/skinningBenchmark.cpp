@@ -0,0 +1,243 @@
+// Skinning benchmark
+// Runs the vertex math of shader/betaCharacter.vert.glsl on the CPU for a mesh bound to an animated rig, the
+// old way (joint and bind matrices sent apart, both inverted for the normal of every influence of every
+// vertex) and the way FBXModel does it now (one skinning and one normal matrix per joint, made once a frame,
+// blended per vertex). Reports vertices per second and the largest difference between the two.
+// Then skins meshes of 10k to 1M vertices on the CPU with ASkinning, one thread and all threads, and checks the
+// result against ASkinning::skinReference.
+// The mesh is made up: every vertex has 1 to 6 influences around a joint of the rig, like the Beta mesh, packed
+// into the 4 largest as FBXModel::loadFBX does.
+// Usage: skinningBenchmark [clip.bvh] [vertices]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include "aActor.h"
+#include "aSkinning.h"
+#include "aThreadPool.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const int kMaxInfluences = ASkinning::kMaxInfluences;
+
+typedef ASkinning::Vertex Vertex;	// FBXVertex
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static glm::mat4 toMat4(const ATransform& transform)
+{
+	float m[16];
+	transform.m_rotation.WriteToGLMatrix(m);
+	m[12] = (float)transform.m_translation[0];
+	m[13] = (float)transform.m_translation[1];
+	m[14] = (float)transform.m_translation[2];
+	return glm::make_mat4(m);
+}
+
+static void globalMats(const ASkeleton* skeleton, std::vector<glm::mat4>& mats)
+{
+	std::vector<ATransform> globals;
+	skeleton->getLocal2Global(globals);
+	mats.resize(skeleton->getNumJoints());
+	for (int i = 0; i < mats.size(); i++) mats[i] = toMat4(globals[i]);
+}
+
+static void createMesh(const std::vector<glm::mat4>& bindGlobals, int numVertices, std::vector<Vertex>& vertices)
+{
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+	std::uniform_int_distribution<int> influences(1, 6);
+	int numJoints = bindGlobals.size();
+	vertices.resize(numVertices);
+	for (Vertex& v : vertices)
+	{
+		int joint = random() % numJoints;
+		glm::vec3 pos = glm::vec3(bindGlobals[joint][3]) + glm::vec3(offset(random), offset(random), offset(random));
+		glm::vec3 nor = glm::normalize(glm::vec3(offset(random), offset(random), offset(random)) + glm::vec3(0.01f));
+		std::copy(glm::value_ptr(pos), glm::value_ptr(pos) + 3, v.pos);
+		std::copy(glm::value_ptr(nor), glm::value_ptr(nor) + 3, v.nor);
+		int jointNum = influences(random);
+		int ids[6];
+		float weights[6];
+		for (int i = 0; i < jointNum; i++)
+		{
+			// neighbours by ID, mostly parent and children
+			ids[i] = std::min(numJoints - 1, std::max(0, joint + (int)(random() % 5) - 2));
+			weights[i] = 0.1f + (random() % 100) / 100.0f;
+		}
+		ASkinning::PackInfluences(ids, weights, jointNum, v);	// as FBXModel::loadFBX
+	}
+}
+
+// Before: uJointTransMats and uBindMats
+static void skinOld(const std::vector<Vertex>& vertices, const std::vector<glm::mat4>& jointMats,
+	const std::vector<glm::mat4>& bindMats, std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals)
+{
+	for (int v = 0; v < vertices.size(); v++)
+	{
+		const Vertex& vertex = vertices[v];
+		glm::vec4 deformPos(0.0f), deformNor(0.0f);
+		for (int i = 0; i < kMaxInfluences; i++)
+		{
+			float weight = vertex.weights[i] / 65535.0f;
+			if (weight == 0.0f) continue;
+			int id = vertex.joints[i];
+			deformPos += weight * jointMats[id] * bindMats[id] * glm::vec4(glm::make_vec3(vertex.pos), 1.0f);
+			deformNor += weight * glm::transpose(glm::inverse(jointMats[id])) * glm::transpose(glm::inverse(bindMats[id])) *
+				glm::vec4(glm::make_vec3(vertex.nor), 0.0f);
+		}
+		positions[v] = deformPos;
+		normals[v] = deformNor;
+	}
+}
+
+// Now: FBXModel::writeJointPalette, then the skinning and normal matrices of the palette
+static void skinNew(const std::vector<Vertex>& vertices, const std::vector<glm::mat4>& jointMats,
+	const std::vector<glm::mat4>& bindMats, std::vector<glm::mat4>& skinningMats, std::vector<glm::mat3>& normalMats,
+	std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals)
+{
+	skinningMats.resize(jointMats.size());
+	normalMats.resize(jointMats.size());
+	for (int i = 0; i < jointMats.size(); i++)
+	{
+		skinningMats[i] = jointMats[i] * bindMats[i];
+		normalMats[i] = glm::transpose(glm::inverse(glm::mat3(skinningMats[i])));
+	}
+
+	for (int v = 0; v < vertices.size(); v++)
+	{
+		const Vertex& vertex = vertices[v];
+		glm::vec4 deformPos(0.0f), deformNor(0.0f);
+		for (int i = 0; i < kMaxInfluences; i++)
+		{
+			float weight = vertex.weights[i] / 65535.0f;
+			if (weight == 0.0f) continue;
+			int id = vertex.joints[i];
+			deformPos += weight * (skinningMats[id] * glm::vec4(glm::make_vec3(vertex.pos), 1.0f));
+			deformNor += weight * glm::vec4(normalMats[id] * glm::make_vec3(vertex.nor), 0.0f);
+		}
+		positions[v] = deformPos;
+		normals[v] = deformNor;
+	}
+}
+
+static float maxDifference(const std::vector<float>& a, const std::vector<float>& b)
+{
+	float difference = 0.0f;
+	for (int i = 0; i < a.size(); i++) difference = std::max(difference, std::fabs(a[i] - b[i]));
+	return difference;
+}
+
+static void cpuSkinning(const std::vector<glm::mat4>& bindGlobals, const std::vector<glm::mat4>& skinningMats, int numVertices)
+{
+	std::vector<Vertex> vertices;
+	createMesh(bindGlobals, numVertices, vertices);
+	ASkinning skinning;
+	skinning.setMesh(vertices.data(), numVertices);
+	skinning.setJointMatrices(reinterpret_cast<const float*>(skinningMats.data()), skinningMats.size());
+
+	std::vector<float> refPositions(numVertices * 3), refNormals(numVertices * 3), positions(numVertices * 3), normals(numVertices * 3);
+	int numRuns = std::max(2, 2000000 / numVertices);
+	Clock::time_point start = Clock::now();
+	for (int run = 0; run < numRuns; run++) skinning.skinReference(refPositions.data(), refNormals.data());
+	double refMs = elapsedMs(start) / numRuns;
+
+	start = Clock::now();
+	for (int run = 0; run < numRuns; run++) skinning.skin(positions.data(), normals.data(), 1);
+	double oneMs = elapsedMs(start) / numRuns;
+	float posError = maxDifference(refPositions, positions), norError = maxDifference(refNormals, normals);
+
+	std::fill(positions.begin(), positions.end(), 0.0f);
+	start = Clock::now();
+	for (int run = 0; run < numRuns; run++) skinning.skin(positions.data(), normals.data());
+	double allMs = elapsedMs(start) / numRuns;
+	posError = std::max(posError, maxDifference(refPositions, positions));
+	norError = std::max(norError, maxDifference(refNormals, normals));
+
+	printf("  %8d %10.3f %10.3f %10.3f %10.2f %10.2f %12g %12g\n", numVertices, refMs, oneMs, allMs,
+		numVertices / oneMs / 1000.0, numVertices / allMs / 1000.0, posError, norError);
+}
+
+int main(int argc, char** argv)
+{
+	std::string filename = argc > 1 ? argv[1] : "../motions/Beta/walking.bvh";
+	int numVertices = argc > 2 ? atoi(argv[2]) : 100000;
+
+	AActor actor;
+	if (!actor.getBVHController()->load(filename))
+	{
+		printf("Could not load %s\n", filename.c_str());
+		return 1;
+	}
+	ASkeleton* skeleton = actor.getSkeleton();
+
+	// Bind pose at the first frame, as FBXModel does with Beta.bvh
+	std::vector<glm::mat4> jointMats, bindMats;
+	actor.getBVHController()->update(0.0);
+	globalMats(skeleton, jointMats);
+	std::vector<glm::mat4> bindGlobals = jointMats;
+	bindMats.resize(jointMats.size());
+	for (int i = 0; i < jointMats.size(); i++) bindMats[i] = glm::inverse(jointMats[i]);
+
+	std::vector<Vertex> vertices;
+	createMesh(bindGlobals, numVertices, vertices);
+	int numInfluences = 0;
+	for (const Vertex& v : vertices)
+	{
+		for (int i = 0; i < kMaxInfluences; i++) numInfluences += v.weights[i] != 0;
+	}
+
+	std::vector<glm::vec4> oldPositions(numVertices), oldNormals(numVertices), newPositions(numVertices), newNormals(numVertices);
+	std::vector<glm::mat4> skinningMats;
+	std::vector<glm::mat3> normalMats;
+	const int numFrames = 20;
+	double oldMs = 0.0, newMs = 0.0;
+	float maxPosError = 0.0f, maxNorError = 0.0f;
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		actor.getBVHController()->update(frame / 10.0);
+		globalMats(skeleton, jointMats);
+
+		Clock::time_point start = Clock::now();
+		skinOld(vertices, jointMats, bindMats, oldPositions, oldNormals);
+		oldMs += elapsedMs(start);
+
+		start = Clock::now();
+		skinNew(vertices, jointMats, bindMats, skinningMats, normalMats, newPositions, newNormals);
+		newMs += elapsedMs(start);
+
+		for (int v = 0; v < numVertices; v++)
+		{
+			maxPosError = std::max(maxPosError, glm::length(oldPositions[v] - newPositions[v]));
+			maxNorError = std::max(maxNorError, glm::length(glm::vec3(oldNormals[v] - newNormals[v])));	// the shader drops w
+		}
+	}
+
+	printf("Skinning %d vertices of %d bytes, %.2f influences each, to %d joints of %s\n", numVertices, (int)sizeof(Vertex),
+		(double)numInfluences / numVertices, (int)jointMats.size(), filename.c_str());
+	printf("  %-28s %10s %12s\n", "path", "ms/frame", "Mverts/s");
+	printf("  %-28s %10.2f %12.2f\n", "inverse per influence", oldMs / numFrames, numVertices * numFrames / oldMs / 1000.0);
+	printf("  %-28s %10.2f %12.2f\n", "premultiplied per joint", newMs / numFrames, numVertices * numFrames / newMs / 1000.0);
+	printf("  speedup %.2fx, max difference %g position, %g normal\n", oldMs / newMs, maxPosError, maxNorError);
+
+	printf("CPU skinning, %d threads\n", AThreadPool::Get().getNumThreads());
+	printf("  %8s %10s %10s %10s %10s %10s %12s %12s\n", "vertices", "ref ms", "1 thr ms", "all ms", "Mverts/s 1",
+		"Mverts/s", "max pos diff", "max nor diff");
+	for (int vertexCount : { 10000, 100000, 1000000 })
+	{
+		cpuSkinning(bindGlobals, skinningMats, vertexCount);
+	}
+	return 0;
+}
@@ -0,0 +1,160 @@
+// Hermite spline benchmark
+// Compares the dense A.inverse() * D solve that AHermiteInterpolatorVec3::computeControlPoints used to do
+// with the tridiagonal solve it does now, for 10 to 100k keys, and times a single key edit through ASplineVec3.
+// Fails if the two solves disagree.
+// Usage: splineBenchmark
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "aSplineVec3.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// The dense solve is O(n^3) time and O(n^2) memory, so it is only run up to this many keys
+static const int kMaxDenseKeys = 2000;
+static const double kMaxSlopeError = 1e-6;
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// The previous implementation, same system and right hand side as AHermiteInterpolatorVec3::computeControlPoints:
+// 2 c0 + c1 = 3 (p1 - p0) and c[n-2] + 2 c[n-1] = 3 (p[n-1] - p[n-2]) at the ends
+static void computeControlPointsDense(const std::vector<ASplineVec3::Key>& keys, std::vector<vec3>& ctrlPoints)
+{
+	int n = keys.size();
+	ctrlPoints.assign(n, vec3(0, 0, 0));
+
+	Eigen::MatrixXd A = Eigen::MatrixXd::Zero(n, n);
+	A(0, 0) = 2;
+	A(0, 1) = 1;
+	for (int row = 1; row < n - 1; row++)
+	{
+		A(row, row - 1) = 1;
+		A(row, row) = 4;
+		A(row, row + 1) = 1;
+	}
+	A(n - 1, n - 2) = 1;
+	A(n - 1, n - 1) = 2;
+
+	Eigen::MatrixXd D(n, 3);
+	for (int col = 0; col < 3; col++)
+	{
+		D(0, col) = 3 * (keys[1].second[col] - keys[0].second[col]);
+		D(n - 1, col) = 3 * (keys[n - 1].second[col] - keys[n - 2].second[col]);
+		for (int row = 1; row < n - 1; row++)
+		{
+			D(row, col) = 3 * (keys[row + 1].second[col] - keys[row - 1].second[col]);
+		}
+	}
+
+	Eigen::MatrixXd C = A.inverse() * D;
+	for (int row = 0; row < n - 1; row++)
+	{
+		ctrlPoints[row] = vec3(C(row, 0), C(row, 1), C(row, 2));
+	}
+}
+
+static void makeKeys(int numKeys, std::vector<ASplineVec3::Key>& keys)
+{
+	keys.resize(numKeys);
+	for (int i = 0; i < numKeys; i++)
+	{
+		keys[i] = ASplineVec3::Key(i / 30.0, vec3(100.0 * sin(0.05 * i), 50.0 * cos(0.03 * i), 0.1 * i));
+	}
+}
+
+static bool benchControlPoints(int numKeys)
+{
+	std::vector<ASplineVec3::Key> keys;
+	makeKeys(numKeys, keys);
+	AHermiteInterpolatorVec3 hermite;
+	std::vector<vec3> ctrlPoints;
+	vec3 startPoint, endPoint;
+
+	int repeats = std::max(1, 100000 / numKeys);
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < repeats; i++)
+	{
+		hermite.computeControlPoints(keys, ctrlPoints, startPoint, endPoint);
+	}
+	double tridiagonalMs = elapsedMs(start) / repeats;
+
+	if (numKeys > kMaxDenseKeys)
+	{
+		printf("  %8d keys  dense %12s  tridiagonal %10.4f ms\n", numKeys, "skipped", tridiagonalMs);
+		return true;
+	}
+
+	std::vector<vec3> denseCtrlPoints;
+	repeats = std::max(1, 1000 / numKeys);
+	start = Clock::now();
+	for (int i = 0; i < repeats; i++)
+	{
+		computeControlPointsDense(keys, denseCtrlPoints);
+	}
+	double denseMs = elapsedMs(start) / repeats;
+
+	double maxError = 0.0;
+	for (int i = 0; i < numKeys; i++)
+	{
+		maxError = std::max(maxError, (ctrlPoints[i] - denseCtrlPoints[i]).Length());
+	}
+	printf("  %8d keys  dense %10.4f ms  tridiagonal %10.4f ms  speedup %8.1fx  max diff %.2e\n",
+		numKeys, denseMs, tridiagonalMs, denseMs / tridiagonalMs, maxError);
+	if (maxError > kMaxSlopeError)
+	{
+		printf("  FAILED: the tridiagonal slopes differ from the dense solve\n");
+		return false;
+	}
+	return true;
+}
+
+// What CurvePlugin's editVecKey costs: one key edit recomputes the control points and re-caches the curve
+static void benchKeyEdit(int numKeys)
+{
+	std::vector<ASplineVec3::Key> keys;
+	makeKeys(numKeys, keys);
+	ASplineVec3 spline;
+	spline.setInterpolationType(ASplineVec3::CUBIC_HERMITE);
+	for (int i = 0; i < numKeys; i++)
+	{
+		spline.appendKey(keys[i].first, keys[i].second, false);
+	}
+	spline.computeControlPoints();
+	spline.cacheCurve();
+
+	int repeats = std::max(1, 10000 / numKeys);
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < repeats; i++)
+	{
+		spline.editKey(numKeys / 2, keys[numKeys / 2].second + vec3(0, 1, 0) * (i % 2));
+	}
+	printf("  %8d keys  editKey %10.4f ms\n", numKeys, elapsedMs(start) / repeats);
+}
+
+int main()
+{
+	const int keyCounts[] = { 10, 100, 1000, 10000, 100000 };
+
+	printf("AHermiteInterpolatorVec3::computeControlPoints\n");
+	bool same = true;
+	for (int numKeys : keyCounts)
+	{
+		same = benchControlPoints(numKeys) && same;
+	}
+
+	printf("ASplineVec3::editKey (cubic Hermite)\n");
+	for (int numKeys : keyCounts)
+	{
+		benchKeyEdit(numKeys);
+	}
+	return same ? 0 : 1;
+}
@@ -3,7 +3,7 @@
 #include "Plugin.h"
 #include "aSplineVec3.h"
 #include "aSplineQuat.h"
-#include <unordered_map>
+#include "aPluginPool.h"
 #include <memory>
 
 
@@ -34,120 +34,140 @@ struct CurveValue
 	double euler[3];	// Euler angles (x, y, z)
 };
 
+typedef APluginPool<ACurve>::Ref CurveRef;
+
 class CurvePluginManager 
 {
 public:
 	CurvePluginManager() {}
 
-	std::unordered_map<int, ACurve> mCurvePool;
-	int mCurrentIndex = 0;
+	// Calls on different curves may come from different threads at the same time
+	APluginPool<ACurve> mCurvePool;
 
 	// Initialize
 	int createCurve()
 	{
-		mCurvePool.insert({ mCurrentIndex, ACurve()});
-		mCurrentIndex++;
-		return mCurrentIndex - 1;
+		return mCurvePool.create(std::unique_ptr<ACurve>(new ACurve()));
 	}
 
 	void removeCurve(int id)
 	{
-		mCurvePool.erase(id);
+		mCurvePool.remove(id);
 	}
 
 	void resetCurve(int id)
 	{
-		ACurve& curve = mCurvePool[id];
-		curve.mSplineEuler->clear();
-		curve.mSplineQuat->clear();
-		curve.mSplineVec3->clear();
+		CurveRef curve = mCurvePool.get(id);
+		if (!curve) return;
+		curve->mSplineEuler->clear();
+		curve->mSplineQuat->clear();
+		curve->mSplineVec3->clear();
 	}
 
 	// Append key
 	void appendVecKey(int id, vec3 value)
 	{
-		mCurvePool[id].mSplineVec3->appendKey(value);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineVec3->appendKey(value);
 	}
 
 	void appendQuatKey(int id, double t, quat value)
 	{
-		mCurvePool[id].mSplineQuat->appendKey(t, value.Normalize());
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineQuat->appendKey(t, value.Normalize());
 	}
 
 	void appendEulerKey(int id, double t, vec3 value)
 	{
-		mCurvePool[id].mSplineEuler->appendKey(t, value);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineEuler->appendKey(t, value);
 	}
 
 	// Insert key
 	int insertQuatKey(int id, double t, quat value)
 	{
-		return mCurvePool[id].mSplineQuat->insertKey(t, value.Normalize());
+		CurveRef curve = mCurvePool.get(id);
+		return curve ? curve->mSplineQuat->insertKey(t, value.Normalize()) : -1;
 	}
 
 	int insertEulerKey(int id, double t, vec3 value)
 	{
-		return mCurvePool[id].mSplineEuler->insertKey(t, value);
+		CurveRef curve = mCurvePool.get(id);
+		return curve ? curve->mSplineEuler->insertKey(t, value) : -1;
 	}
 
 	// Edit key
 	void editVecKey(int id, int keyID, vec3 value)
 	{
-		mCurvePool[id].mSplineVec3->editKey(keyID, value);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineVec3->editKey(keyID, value);
 	}
 
 	void editQuatKey(int id, int keyID, quat value)
 	{
-		mCurvePool[id].mSplineQuat->editKey(keyID, value.Normalize());
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineQuat->editKey(keyID, value.Normalize());
 	}
 
 	void editEulerKey(int id, int keyID, vec3 value)
 	{
-		mCurvePool[id].mSplineEuler->editKey(keyID, value);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineEuler->editKey(keyID, value);
 	}
 
 	void editVecControlPoint(int id, int controlPointID, vec3 value)
 	{
-		mCurvePool[id].mSplineVec3->editControlPoint(controlPointID, value);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineVec3->editControlPoint(controlPointID, value);
 	}
 
 	// Delete Key
 	void deleteVecKey(int id, int keyID)
 	{
-		mCurvePool[id].mSplineVec3->deleteKey(keyID);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineVec3->deleteKey(keyID);
 	}
 
 	void deleteQuatKey(int id, int keyID)
 	{
-		mCurvePool[id].mSplineQuat->deleteKey(keyID);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineQuat->deleteKey(keyID);
 	}
 
 	void deleteEulerKey(int id, int keyID)
 	{
-		mCurvePool[id].mSplineEuler->deleteKey(keyID);
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineEuler->deleteKey(keyID);
 	}
 
 	// Set interpolation type
 	void setVecInterpolationType(int id, int type)
 	{
-		mCurvePool[id].mSplineVec3->setInterpolationType(static_cast<ASplineVec3::InterpolationType>(type));
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineVec3->setInterpolationType(static_cast<ASplineVec3::InterpolationType>(type));
 	}
 
 	void setQuatInterpolationType(int id, int type)
 	{
-		mCurvePool[id].mSplineQuat->setInterpolationType(static_cast<ASplineQuat::InterpolationType>(type));
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineQuat->setInterpolationType(static_cast<ASplineQuat::InterpolationType>(type));
 	}
 	
 	void setEulerInterpolationType(int id, int type)
 	{
 		// 0: Linear ; 1: Cubic
-		mCurvePool[id].mSplineEuler->setInterpolationType(static_cast<ASplineVec3::InterpolationType>(type + 6));
+		CurveRef curve = mCurvePool.get(id);
+		if (curve) curve->mSplineEuler->setInterpolationType(static_cast<ASplineVec3::InterpolationType>(type + 6));
 	}
 
 	// Get curve
 	void GetControlPoints(int id, double startPoint[], double endPoint[], int& controlPointNum, double*& controlPointPtr)
 	{
-		ASplineVec3& splineVec = *(mCurvePool[id].mSplineVec3);
+		controlPointNum = 0;
+		controlPointPtr = NULL;
+		CurveRef curve = mCurvePool.get(id);
+		if (!curve) return;
+		ASplineVec3& splineVec = *(curve->mSplineVec3);
 		vec3 startPointVec = splineVec.getControlPoint(0);
 		startPoint[0] = startPointVec[0];
 		startPoint[1] = startPointVec[1];
@@ -163,16 +183,22 @@ public:
 
 	void GetCachedCurve(int id, int &cachedPointNum, double*& cachedPointPtr)
 	{
-		ASplineVec3& splineVec = *(mCurvePool[id].mSplineVec3);
+		cachedPointNum = 0;
+		cachedPointPtr = NULL;
+		CurveRef curve = mCurvePool.get(id);
+		if (!curve) return;
+		ASplineVec3& splineVec = *(curve->mSplineVec3);
 		cachedPointNum = splineVec.getNumCurveSegments();
 		cachedPointPtr = reinterpret_cast<double*>(splineVec.getCachedCurveData());
 	}
 
 	void GetValue(int id, double t, CurveValue& curveValue)
 	{
-		vec3 vec = mCurvePool[id].mSplineVec3->getValue(t);
-		quat q = mCurvePool[id].mSplineQuat->getCachedValue(t);
-		vec3 euler = mCurvePool[id].mSplineEuler->getValue(t);
+		CurveRef curve = mCurvePool.get(id);
+		if (!curve) return;
+		vec3 vec = curve->mSplineVec3->getValue(t);
+		quat q = curve->mSplineQuat->getCachedValue(t);
+		vec3 euler = curve->mSplineEuler->getValue(t);
 		curveValue.vec[0] = vec[0];
 		curveValue.vec[1] = vec[1];
 		curveValue.vec[2] = vec[2];
@@ -189,12 +215,14 @@ public:
 
 	double getVecDuration(int id)
 	{
-		return mCurvePool[id].mSplineVec3->getDuration();
+		CurveRef curve = mCurvePool.get(id);
+		return curve ? curve->mSplineVec3->getDuration() : 0.0;
 	}
 
 	int getVecKeyNum(int id)
 	{
-		return mCurvePool[id].mSplineVec3->getNumKeys();
+		CurveRef curve = mCurvePool.get(id);
+		return curve ? curve->mSplineVec3->getNumKeys() : 0;
 	}
 
 };
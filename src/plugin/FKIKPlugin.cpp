@@ -1,5 +1,6 @@
 #include <stdlib.h> 
 #include <math.h> 
+#include <string.h>
 #include <string>
 #include <vector>
 #include "Plugin.h"
@@ -8,7 +9,10 @@
 #include "aBVHController.h"
 #include "aJoint.h"
 #include "aActor.h"
-#include <unordered_map>
+#include "aThreadPool.h"
+#include "aPluginPool.h"
+#include <algorithm>
+#include <mutex>
 
 struct JointData
 {
@@ -17,76 +21,129 @@ struct JointData
 	float localTranslation[3]; // Vector3
 };
 
+// Floats per joint in a pose buffer: JointData without the id
+static const int kPoseFloats = 7;
+
+// What UpdateAll does to one actor. Only ints and floats, so that the managed array is passed without copies.
+struct ActorUpdate
+{
+	int id;
+	float time;         // clip time, advanced by UpdateAll and wrapped into [0, duration)
+	float speedScale;   // time advances by dt * speedScale
+	int wrapped;        // set by UpdateAll to 1 if time went past either end of the clip, else 0
+	int solveFootIK;    // then solve the foot IK with the values below, as SolveFootIK does
+	int rotateLeft;
+	int rotateRight;
+	float leftHeight;
+	float rightHeight;
+	float leftNormal[3];
+	float rightNormal[3];
+};
+
+// An actor of the plugin and the packed pose GetPoseBuffer hands out for it
+class PluginActor : public AActor
+{
+public:
+	// Local pose, repacked by every call that changes the skeleton (the updates, the IK solves, the joint
+	// setters and LoadBVH) once GetPoseBuffer has been called. Only moves when the number of joints changes.
+	std::vector<float> mPose;
+	bool mHasPose = false;
+};
+
+typedef APluginPool<PluginActor>::Ref ActorRef;
+
 class FKIKPluginManager
 {
 public:
 	FKIKPluginManager() {}
 
-	std::unordered_map<int, std::unique_ptr<AActor>> mActorPool;
-	int mCurrentIndex = 0;
+	// Calls on different actors may come from different threads at the same time
+	APluginPool<PluginActor> mActorPool;
+
+	// SolveFootIKBatch and UpdateAll arguments, kept between calls. The actors of a batch stay locked until it
+	// is done, and one batch runs at a time.
+	std::mutex mBatchMutex;
+	std::vector<ActorRef> mBatchRefs;
+	std::vector<AActor*> mBatchActors;
+	std::vector<int> mSortedBatchIDs;
+	std::vector<AActor::FootIKParams> mBatchParams;
 
 	int CreateActor()
 	{
-		mActorPool.insert({ mCurrentIndex, std::make_unique<AActor>() });
-		mCurrentIndex++;
-		return mCurrentIndex - 1;
+		return mActorPool.create(std::unique_ptr<PluginActor>(new PluginActor()));
 	}
 
 	void RemoveActor(int id)
 	{
-		mActorPool.erase(id);
+		mActorPool.remove(id);
 	}
 
 	int CreateJoint(int id, char* name, bool isRoot)
 	{
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return -1;
 		AJoint* joint = new AJoint(name);
-		mActorPool[id]->getSkeleton()->addJoint(joint, isRoot);
+		actor->getSkeleton()->addJoint(joint, isRoot);
 		return joint->getID();
 	}
 
 	void SetJointData(int id, JointData jointData, int parentID)
 	{
-		AJoint* child = mActorPool[id]->getSkeleton()->getJointByID(jointData.id);
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		AJoint* child = actor->getSkeleton()->getJointByID(jointData.id);
 		vec3 v = vec3(jointData.localTranslation[0], jointData.localTranslation[1], jointData.localTranslation[2]);
 		child->setLocalTranslation(v);
 		quat q = quat(jointData.localRotation[0], jointData.localRotation[1], jointData.localRotation[2], jointData.localRotation[3]);
 		child->setLocalRotation(q.ToRotation());
 		if (parentID != -1)
 		{
-			AJoint* parent = mActorPool[id]->getSkeleton()->getJointByID(parentID);
+			AJoint* parent = actor->getSkeleton()->getJointByID(parentID);
 			AJoint::Attach(parent, child);
 		}
+		UpdatePoseBuffer(*actor);
 	}
 
 	void UpdateSkeleton(int id)
 	{
-		mActorPool[id]->getSkeleton()->update();
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->getSkeleton()->update();
+		UpdatePoseBuffer(*actor);
 	}
 
 	void UpdateIKSkeleton(int id)
 	{
-		mActorPool[id]->getIKController()->getIKSkeleton()->copyHierarchy(mActorPool[id]->getSkeleton());
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->getIKController()->getIKSkeleton()->copyHierarchy(actor->getSkeleton());
 	}
 
 	bool LoadBVH(int id, char* file)
 	{
-		return mActorPool[id]->getBVHController()->load(file);
+		ActorRef actor = mActorPool.get(id);
+		if (!actor || !actor->getBVHController()->load(file)) return false;
+		UpdatePoseBuffer(*actor);
+		return true;
 	}
 
 	int GetJointSize(int id)
 	{
-		return mActorPool[id]->getSkeleton()->getNumJoints();
+		ActorRef actor = mActorPool.get(id);
+		return actor ? actor->getSkeleton()->getNumJoints() : 0;
 	}
 
 	int GetJointIdByName(int id, char* name)
 	{
-		AJoint* joint = mActorPool[id]->getSkeleton()->getJointByName(name);
+		ActorRef actor = mActorPool.get(id);
+		AJoint* joint = actor ? actor->getSkeleton()->getJointByName(name) : NULL;
 		return joint ? joint->getID() : -1;
 	}
 
 	int GetJointIdByParentName(int id, char* pname)
 	{
-		AJoint* parent = mActorPool[id]->getSkeleton()->getJointByName(pname);
+		ActorRef actor = mActorPool.get(id);
+		AJoint* parent = actor ? actor->getSkeleton()->getJointByName(pname) : NULL;
 		if (parent == NULL || parent->getNumChildren() > 1)
 		{
 			return -1;
@@ -101,7 +158,9 @@ public:
 
 	void GetJointData(int id, JointData* jointDataArray, int size)
 	{
-		ASkeleton* skeleton = mActorPool[id]->getSkeleton();
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		ASkeleton* skeleton = actor->getSkeleton();
 		for (int i = 0; i < size; ++i)
 		{
 			JointData data = jointDataArray[i];
@@ -119,101 +178,273 @@ public:
 		}
 	}
 
+	void GetPoseBuffer(int id, int& floatNum, float*& posePtr)
+	{
+		floatNum = 0;
+		posePtr = NULL;
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->mHasPose = true;
+		UpdatePoseBuffer(*actor);
+		floatNum = actor->mPose.size();
+		posePtr = actor->mPose.data();
+	}
+
+	// The skeleton keeps its local pose in the layout of the buffer, so it is copied as is, no joint lookups
+	static void UpdatePoseBuffer(PluginActor& actor)
+	{
+		static_assert(sizeof(ALocalPose) == kPoseFloats * sizeof(float), "ALocalPose must be kPoseFloats floats");
+		if (!actor.mHasPose) return;
+		const ASkeleton* skeleton = actor.getSkeleton();
+		int numJoints = skeleton->getNumJoints();
+		actor.mPose.resize(numJoints * kPoseFloats);
+		if (numJoints > 0) memcpy(actor.mPose.data(), skeleton->getLocalPoseData(), numJoints * sizeof(ALocalPose));
+	}
+
 	void UpdateBVHSkeleton(int id, float t)
 	{
-		mActorPool[id]->getBVHController()->update(t);
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->getBVHController()->update(t);
+		UpdatePoseBuffer(*actor);
 	}
 
 	float GetDuration(int id)
 	{
-		return mActorPool[id]->getBVHController()->getDuration();
+		ActorRef actor = mActorPool.get(id);
+		return actor ? actor->getBVHController()->getDuration() : 0.0f;
 	}
 
 	int GetKeySize(int id)
 	{
-		return mActorPool[id]->getBVHController()->getKeySize();
+		ActorRef actor = mActorPool.get(id);
+		return actor ? actor->getBVHController()->getKeySize() : 0;
 	}
 
 	float GetKeyTime(int id, int keyID)
 	{
-		return mActorPool[id]->getBVHController()->getKeyTime(keyID);
+		ActorRef actor = mActorPool.get(id);
+		return actor ? actor->getBVHController()->getKeyTime(keyID) : 0.0f;
 	}
 
 	void SetJointRotation(int id, int jointID, quat value)
 	{
-		mActorPool[id]->getSkeleton()->getJointByID(jointID)->setLocalRotation(value.ToRotation());
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->getSkeleton()->getJointByID(jointID)->setLocalRotation(value.ToRotation());
+		UpdatePoseBuffer(*actor);
 	}
 
 	void SetRootJointTranslation(int id, vec3 value)
 	{
-		mActorPool[id]->getSkeleton()->getRootNode()->setLocalTranslation(value);
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->getSkeleton()->getRootNode()->setLocalTranslation(value);
+		UpdatePoseBuffer(*actor);
 	}
 
 	void SetRootJointRotation(int id, quat value)
 	{
-		mActorPool[id]->getSkeleton()->getRootNode()->setLocalRotation(value.ToRotation());
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->getSkeleton()->getRootNode()->setLocalRotation(value.ToRotation());
+		UpdatePoseBuffer(*actor);
 	}
 
 	void SolveLimbIK(int id, int jointID, vec3 pos)
 	{
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
 		ATarget target;
 		target.setGlobalTranslation(pos);
-		mActorPool[id]->getIKController()->IKSolver_Limb(jointID, target);
+		actor->getIKController()->IKSolver_Limb(jointID, target);
+		UpdatePoseBuffer(*actor);
 	}
 
 	void SetLeftHandID(int id, int jointID)
 	{
-		mActorPool[id]->getIKController()->mLhandID = jointID;
+		ActorRef actor = mActorPool.get(id);
+		if (actor) actor->getIKController()->mLhandID = jointID;
 	}
 
 	void SetRightHandID(int id, int jointID)
 	{
-		mActorPool[id]->getIKController()->mRhandID = jointID;
+		ActorRef actor = mActorPool.get(id);
+		if (actor) actor->getIKController()->mRhandID = jointID;
 	}
 
 	void SetLeftFootID(int id, int jointID)
 	{
-		mActorPool[id]->getIKController()->mLfootID = jointID;
+		ActorRef actor = mActorPool.get(id);
+		if (actor) actor->getIKController()->mLfootID = jointID;
 	}
 
 	void SetRightFootID(int id, int jointID)
 	{
-		mActorPool[id]->getIKController()->mRfootID = jointID;
+		ActorRef actor = mActorPool.get(id);
+		if (actor) actor->getIKController()->mRfootID = jointID;
 	}
 
 	void SetRootID(int id, int jointID)
 	{
-		mActorPool[id]->getIKController()->mRootID = jointID;
+		ActorRef actor = mActorPool.get(id);
+		if (actor) actor->getIKController()->mRootID = jointID;
 	}
 
 	void CreateLimbIKChains(int id)
 	{
-		UpdateIKSkeleton(id);
-		mActorPool[id]->getIKController()->createLimbIKchains();
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->getIKController()->getIKSkeleton()->copyHierarchy(actor->getSkeleton());
+		actor->getIKController()->createLimbIKchains();
 	}
 
 	void SolveFootIK(int id, float leftHeight, float rightHeight, bool rotateLeft, bool rotateRight, vec3 leftNormal, vec3 rightNormal)
 	{
-		mActorPool[id]->solveFootIK(leftHeight, rightHeight, rotateLeft, rotateRight, leftNormal, rightNormal);
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return;
+		actor->solveFootIK(leftHeight, rightHeight, rotateLeft, rotateRight, leftNormal, rightNormal);
+		UpdatePoseBuffer(*actor);
 	}
 
+	void SolveFootIKBatch(const int* ids, const float* heights, const float* normals, const bool* rotate, int n)
+	{
+		std::lock_guard<std::mutex> lock(mBatchMutex);
+		LockBatchActors(ids, n);
+		mBatchParams.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			AActor::FootIKParams& params = mBatchParams[i];
+			params.leftHeight = heights[2 * i];
+			params.rightHeight = heights[2 * i + 1];
+			params.rotateLeft = rotate ? rotate[2 * i] : true;
+			params.rotateRight = rotate ? rotate[2 * i + 1] : true;
+			params.leftNormal = vec3(normals[6 * i], normals[6 * i + 1], normals[6 * i + 2]);
+			params.rightNormal = vec3(normals[6 * i + 3], normals[6 * i + 4], normals[6 * i + 5]);
+		}
+
+		// An actor listed twice is solved twice, in order, so such a batch is not split over threads
+		if (HasDuplicateBatchActors(ids, n))
+		{
+			for (int i = 0; i < n; i++)
+			{
+				if (!mBatchActors[i]) continue;
+				const AActor::FootIKParams& p = mBatchParams[i];
+				mBatchActors[i]->solveFootIK(p.leftHeight, p.rightHeight, p.rotateLeft, p.rotateRight, p.leftNormal, p.rightNormal);
+			}
+		}
+		else
+		{
+			AActor::SolveFootIKBatch(mBatchActors.data(), mBatchParams.data(), n);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			if (mBatchRefs[i]) UpdatePoseBuffer(*mBatchRefs[i]);
+		}
+		mBatchRefs.clear();
+	}
 
-	void UpdateGuideJoint(int id, vec3 targetPos)
+	// Fills mBatchRefs and mBatchActors, NULL for the ids that are not actors
+	void LockBatchActors(const int* ids, int n)
 	{
-		mActorPool[id]->updateGuideJoint(targetPos);
+		mBatchRefs.clear();
+		mBatchActors.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			mBatchRefs.push_back(mActorPool.get(ids[i]));
+			mBatchActors[i] = mBatchRefs[i].get();
+		}
 	}
 
-	vec3 GetGuideTranslation(int id)
+	bool HasDuplicateBatchActors(const int* ids, int n)
 	{
-		return mActorPool[id]->getGuideJoint().getGlobalTranslation();
+		mSortedBatchIDs.clear();
+		for (int i = 0; i < n; i++)
+		{
+			if (mBatchActors[i]) mSortedBatchIDs.push_back(ids[i]);
+		}
+		std::sort(mSortedBatchIDs.begin(), mSortedBatchIDs.end());
+		return std::adjacent_find(mSortedBatchIDs.begin(), mSortedBatchIDs.end()) != mSortedBatchIDs.end();
 	}
-	
-	quat GetGuideRotation(int id)
+
+	void UpdateAll(float dt, ActorUpdate* updates, int n)
 	{
-		return mActorPool[id]->getGuideJoint().getGlobalRotation().ToQuaternion();
+		std::lock_guard<std::mutex> lock(mBatchMutex);
+		std::vector<int>& ids = mSortedBatchIDs;
+		ids.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			ids[i] = updates[i].id;
+		}
+		LockBatchActors(ids.data(), n);
+
+		if (HasDuplicateBatchActors(ids.data(), n))
+		{
+			for (int i = 0; i < n; i++)
+			{
+				UpdateActor(dt, updates[i], mBatchRefs[i].get());
+			}
+		}
+		else
+		{
+			AThreadPool::Get().parallelFor(n, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					UpdateActor(dt, updates[i], mBatchRefs[i].get());
+				}
+			}, 4, AActor::gIKThreads);
+		}
+		mBatchRefs.clear();
 	}
-};
 
+	// Same as UpdateBVHSkeleton (or UpdateSkeleton without a clip), then SolveFootIK
+	static void UpdateActor(float dt, ActorUpdate& update, PluginActor* actor)
+	{
+		update.wrapped = 0;
+		if (!actor) return;
+
+		BVHController* bvh = actor->getBVHController();
+		float duration = bvh->getDuration();
+		if (duration > 0.0f)
+		{
+			update.time += dt * update.speedScale;
+			if (update.time >= duration || update.time < 0.0f)
+			{
+				// fmodf keeps the sign, so a clip played backwards comes back in from the end
+				update.time = fmodf(update.time, duration);
+				if (update.time < 0.0f) update.time += duration;
+				if (update.time >= duration) update.time = 0.0f;	// a tiny negative time rounds up to duration
+				update.wrapped = 1;
+			}
+			bvh->update(update.time);
+		}
+		else
+		{
+			actor->getSkeleton()->update();
+		}
+
+		if (update.solveFootIK)
+		{
+			actor->solveFootIK(update.leftHeight, update.rightHeight, update.rotateLeft != 0, update.rotateRight != 0,
+				vec3(update.leftNormal[0], update.leftNormal[1], update.leftNormal[2]),
+				vec3(update.rightNormal[0], update.rightNormal[1], update.rightNormal[2]));
+		}
+		UpdatePoseBuffer(*actor);
+	}
+
+	// Moves the guide towards targetPos and returns its new global transform
+	bool UpdateGuideJoint(int id, vec3 targetPos, vec3& pos, quat& rotation)
+	{
+		ActorRef actor = mActorPool.get(id);
+		if (!actor) return false;
+		actor->updateGuideJoint(targetPos);
+		pos = actor->getGuideJoint().getGlobalTranslation();
+		rotation = actor->getGuideJoint().getGlobalRotation().ToQuaternion();
+		return true;
+	}
+};
 
 extern "C"
 {
@@ -281,6 +512,15 @@ extern "C"
 		return mFKIKPluginManager.GetJointData(id, jointDataArray, size);
 	}
 
+	// Return a pointer to the local pose of the actor and its number of floats: for each joint by ID its
+	// rotation w x y z and translation x y z, as in JointData. The buffer is updated in place by every call that
+	// updates the skeleton, so it can be fetched once and read each frame without GetJointData. The pointer
+	// changes only when the joints of the actor change, and is freed with the actor.
+	EXPORT_API void GetPoseBuffer(int id, int& floatNum, float*& posePtr)
+	{
+		mFKIKPluginManager.GetPoseBuffer(id, floatNum, posePtr);
+	}
+
 	EXPORT_API void UpdateBVHSkeleton(int id, float t)
 	{
 		mFKIKPluginManager.UpdateBVHSkeleton(id, t);
@@ -359,11 +599,42 @@ extern "C"
 			vec3(leftNormal[0], leftNormal[1], leftNormal[2]), vec3(rightNormal[0], rightNormal[1], rightNormal[2]));
 	}
 
+	// SolveFootIK for n actors at once, spread over worker threads. For actor ids[i]:
+	// heights[2i], heights[2i + 1] are leftHeight and rightHeight,
+	// normals[6i .. 6i + 2] and normals[6i + 3 .. 6i + 5] are leftNormal and rightNormal,
+	// rotate[2i], rotate[2i + 1] are rotateLeft and rotateRight, all true if rotate is null.
+	// Unknown ids are skipped. The results are the same as calling SolveFootIK for each id in turn.
+	EXPORT_API void SolveFootIKBatch(int ids[], float heights[], float normals[], bool rotate[], int n)
+	{
+		mFKIKPluginManager.SolveFootIKBatch(ids, heights, normals, rotate, n);
+	}
+
+	// Threads SolveFootIKBatch and UpdateAll use, 0 for one per hardware thread
+	EXPORT_API void SetBatchThreads(int numThreads)
+	{
+		AActor::gIKThreads = numThreads;
+	}
+
+	// Update the actors of the updates array in one call: for each, advance its clip time, play the clip (or
+	// update the skeleton if it has none), solve its foot IK if asked and refresh its pose buffer. Distinct
+	// actors run in parallel on the threads set by SetBatchThreads. Writes time and wrapped back to the array.
+	EXPORT_API void UpdateAll(float dt, ActorUpdate updates[], int n)
+	{
+		mFKIKPluginManager.UpdateAll(dt, updates, n);
+	}
+
+	// Called by Unity before it unloads the plugin. Joins the worker threads of the batch calls here rather than
+	// from a static destructor while the library unloads, where waiting for a thread can deadlock.
+	EXPORT_API void UnityPluginUnload()
+	{
+		AThreadPool::Shutdown();
+	}
+
 	EXPORT_API void UpdateGuideJointByTarget(int id, float targetPos[], float* newPos, float* newQuat)
 	{
-		mFKIKPluginManager.UpdateGuideJoint(id, vec3(targetPos[0], targetPos[1], targetPos[2]));
-		vec3 pos = mFKIKPluginManager.GetGuideTranslation(id);
-		quat q = mFKIKPluginManager.GetGuideRotation(id);
+		vec3 pos;
+		quat q;
+		if (!mFKIKPluginManager.UpdateGuideJoint(id, vec3(targetPos[0], targetPos[1], targetPos[2]), pos, q)) return;
 
 		newPos[0] = pos[0]; newPos[1] = pos[1]; newPos[2] = pos[2];
 		newQuat[0] = q.W(); newQuat[1] = q.X(); newQuat[2] = q.Y(); newQuat[3] = q.Z();
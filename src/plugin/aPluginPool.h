@@ -0,0 +1,113 @@
+#ifndef APluginPool_H_
+#define APluginPool_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+// Objects of a plugin by integer id, safe to call into from several threads.
+// Ids are handed out in order and never reused. Their slots live in blocks that never move, so a lookup takes
+// no pool-wide lock: it locks the mutex of its own slot, and calls on different ids run independently. The
+// slot stays locked for as long as the Ref that get returns, which serializes calls on the same id and keeps
+// remove from deleting an object that is in use. create and remove are serialized with each other.
+template <class T>
+class APluginPool
+{
+protected:
+	struct Slot
+	{
+		std::recursive_mutex mutex;	// recursive, so a call can look its own id up again
+		std::unique_ptr<T> object;
+	};
+
+public:
+	// The object of an id, locked until the Ref goes away. Empty if there is no such id.
+	class Ref
+	{
+	public:
+		Ref() : mObject(NULL) {}
+		Ref(std::unique_lock<std::recursive_mutex>&& lock, T* object) : mLock(std::move(lock)), mObject(object) {}
+		Ref(Ref&& other) : mLock(std::move(other.mLock)), mObject(other.mObject) { other.mObject = NULL; }
+
+		explicit operator bool() const { return mObject != NULL; }
+		T* get() const { return mObject; }
+		T* operator->() const { return mObject; }
+		T& operator*() const { return *mObject; }
+
+	protected:
+		std::unique_lock<std::recursive_mutex> mLock;
+		T* mObject;
+	};
+
+	APluginPool() : mNextID(0)
+	{
+		for (int i = 0; i < kMaxBlocks; i++) mBlocks[i].store(NULL, std::memory_order_relaxed);
+	}
+
+	virtual ~APluginPool()
+	{
+		for (int i = 0; i < kMaxBlocks; i++) delete[] mBlocks[i].load(std::memory_order_relaxed);
+	}
+
+	// Returns the id of object, or -1 once every id has been used
+	int create(std::unique_ptr<T> object)
+	{
+		std::lock_guard<std::mutex> lock(mCreateMutex);
+		int id = mNextID.load(std::memory_order_relaxed);
+		if (id >= kMaxBlocks * kBlockSize) return -1;
+
+		// Nobody looks at the slot before mNextID is published
+		Slot* block = mBlocks[id / kBlockSize].load(std::memory_order_relaxed);
+		if (!block)
+		{
+			block = new Slot[kBlockSize];
+			mBlocks[id / kBlockSize].store(block, std::memory_order_release);
+		}
+		block[id % kBlockSize].object = std::move(object);
+		mNextID.store(id + 1, std::memory_order_release);
+		return id;
+	}
+
+	// Waits for the calls on id in progress, then deletes its object
+	void remove(int id)
+	{
+		std::unique_ptr<T> object;
+		{
+			std::lock_guard<std::mutex> lock(mCreateMutex);
+			Slot* slot = getSlot(id);
+			if (!slot) return;
+			std::lock_guard<std::recursive_mutex> slotLock(slot->mutex);
+			object = std::move(slot->object);
+		}
+	}
+
+	Ref get(int id)
+	{
+		Slot* slot = getSlot(id);
+		if (!slot) return Ref();
+		std::unique_lock<std::recursive_mutex> lock(slot->mutex);
+		if (!slot->object) return Ref();
+		return Ref(std::move(lock), slot->object.get());
+	}
+
+	int getNumIDs() const { return mNextID.load(std::memory_order_acquire); }	// ids handed out so far
+
+protected:
+	enum { kBlockSize = 256, kMaxBlocks = 4096 };
+
+	Slot* getSlot(int id)
+	{
+		if (id < 0 || id >= mNextID.load(std::memory_order_acquire)) return NULL;
+		return mBlocks[id / kBlockSize].load(std::memory_order_acquire) + id % kBlockSize;
+	}
+
+	APluginPool(const APluginPool&);
+	APluginPool& operator=(const APluginPool&);
+
+protected:
+	std::atomic<Slot*> mBlocks[kMaxBlocks];
+	std::atomic<int> mNextID;
+	std::mutex mCreateMutex;
+};
+
+#endif
@@ -0,0 +1,56 @@
+// BVH clip compiler
+// Writes the compiled clip (.bvhc) of every .bvh given on the command line, or found in a given folder,
+// so that BVHController::load maps it instead of parsing the text. Clips whose .bvhc is up to date are skipped.
+// Usage: bvhCompile <file.bvh | folder> ...
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "aActor.h"
+#include "aMotionCache.h"
+
+static bool compileClip(const std::string& filename)
+{
+	std::string cacheFilename = AMotionCache::GetCacheFilename(filename);
+	AMotionCache cache;
+	if (cache.open(cacheFilename, filename))
+	{
+		printf("  %-48s up to date\n", filename.c_str());
+		return true;
+	}
+
+	// Loading the text writes the .bvhc
+	AActor actor;
+	bool status = actor.getBVHController()->load(filename) && cache.open(cacheFilename, filename);
+	printf("  %-48s %s\n", filename.c_str(), status ? "compiled" : "FAILED");
+	return status;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: bvhCompile <file.bvh | folder> ...\n");
+		return 1;
+	}
+
+	BVHController::gUseClipCache = true;
+	int numFailed = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		std::experimental::filesystem::path path(argv[i]);
+		if (!std::experimental::filesystem::is_directory(path))
+		{
+			numFailed += compileClip(path.generic_string()) ? 0 : 1;
+			continue;
+		}
+		for (const auto& entry : std::experimental::filesystem::directory_iterator(path))
+		{
+			if (entry.path().extension().generic_string().compare(".bvh") != 0) continue;
+			numFailed += compileClip(entry.path().generic_string()) ? 0 : 1;
+		}
+	}
+	return numFailed == 0 ? 0 : 1;
+}
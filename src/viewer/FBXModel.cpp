@@ -1,4 +1,5 @@
 #include "FBXModel.h"
+#include <cstddef>
 #include <fstream>
 #include <iostream>
 #include <gtc/matrix_transform.hpp>
@@ -64,8 +65,10 @@ bool FBXModel::loadFBX(const std::string & filename)
 		{
 			auto v = vertices[j];
 			auto n = normals[j];
-			vertexBuffer.emplace_back(FBXVertex{ glm::vec3{v.x, v.y, v.z}, glm::vec3{n.x, n.y, n.z}, 0 });
+			vertexBuffer.emplace_back(FBXVertex{ { (float)v.x, (float)v.y, (float)v.z }, { (float)n.x, (float)n.y, (float)n.z } });
 		}
+		// All influences of each vertex, packed into the vertex once known
+		std::vector<std::vector<std::pair<int, float>>> influences(vertexCount);
 		// Iterate all joints in this cluster that influence the vertices
 		for (int j = 0; j < clusterCount; ++j)
 		{
@@ -80,14 +83,23 @@ bool FBXModel::loadFBX(const std::string & filename)
 			// Iterate all vertices that are influenced by this joint
 			for (int k = 0; k < indicesCount; ++k)
 			{
-				int index = indices[k] + vertexOffset;
-				float weight = static_cast<float>(weights[k]);
-				int num = vertexBuffer[index].jointNum;
-				vertexBuffer[index].jointWeight[num][0] = mJointMap[joint] + 0.5f;	// To make sure when truncate the float to int, the int is not changed
-				vertexBuffer[index].jointWeight[num][1] = weight;
-				vertexBuffer[index].jointNum++;
+				influences[indices[k]].emplace_back(mJointMap[joint], static_cast<float>(weights[k]));
 			}
 		}
+		// Keep the MAXJOINTNUM largest weights of each vertex
+		std::vector<int> joints;
+		std::vector<float> jointWeights;
+		for (int j = 0; j < vertexCount; ++j)
+		{
+			joints.clear();
+			jointWeights.clear();
+			for (const auto& influence : influences[j])
+			{
+				joints.push_back(influence.first);
+				jointWeights.push_back(influence.second);
+			}
+			ASkinning::PackInfluences(joints.data(), jointWeights.data(), joints.size(), vertexBuffer[vertexOffset + j]);
+		}
 		
 		// Construct indices buffer
 		const auto* indices = geometry->getFaceIndices();
@@ -99,6 +111,8 @@ bool FBXModel::loadFBX(const std::string & filename)
 		}
 	}
 
+	mSkinning.setMesh(vertexBuffer.data(), vertexBuffer.size());
+
 	numTriangles = indicesBuffer.size() / 3;
 	// Gen VAO
 	glGenVertexArrays(1, &VAO);
@@ -111,16 +125,12 @@ bool FBXModel::loadFBX(const std::string & filename)
 	glBufferData(GL_ARRAY_BUFFER, vertexBuffer.size() * sizeof(FBXVertex), vertexBuffer.data(), GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(FBXVertex), (void*)0);
 	glEnableVertexAttribArray(0);	// pos
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(FBXVertex), (void*)(1 * sizeof(glm::vec3)));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(FBXVertex), (void*)offsetof(FBXVertex, nor));
 	glEnableVertexAttribArray(1);	// nor
-	glVertexAttribIPointer(2, 1, GL_INT, sizeof(FBXVertex), (void*)(2 * sizeof(glm::vec3)));
-	glEnableVertexAttribArray(2);	// joint num
-	
-	for (int i = 3; i < 3 + MAXJOINTNUM; ++i)
-	{
-		glVertexAttribPointer(i, 2, GL_FLOAT, GL_FALSE, sizeof(FBXVertex), (void*)(2 * sizeof(glm::vec3) + sizeof(int) + (i-3) * sizeof(glm::vec2)));
-		glEnableVertexAttribArray(i);	// joint weight (vec2)
-	}
+	glVertexAttribIPointer(2, MAXJOINTNUM, GL_UNSIGNED_SHORT, sizeof(FBXVertex), (void*)offsetof(FBXVertex, joints));
+	glEnableVertexAttribArray(2);	// joint indices (uvec4)
+	glVertexAttribPointer(3, MAXJOINTNUM, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(FBXVertex), (void*)offsetof(FBXVertex, weights));
+	glEnableVertexAttribArray(3);	// joint weights (vec4, normalized)
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesBuffer.size() * sizeof(int), indicesBuffer.data(), GL_STATIC_DRAW);
@@ -160,28 +170,45 @@ bool FBXModel::loadShaders()
 }
 
 void FBXModel::drawModel(const glm::mat4& projView, const glm::mat4& model,
-	const glm::vec3& lightPos, const glm::vec3& color)
+	const glm::vec3& lightPos, const glm::vec3& color, const JointPalette& palette)
 {
-	if (!mFBXShader)
-	{
-		throw std::runtime_error("Shader isn't created.");
-	}
 	vec3 t = mActor.getGuideJoint().getGlobalTranslation();
 	mat3 r = mActor.getGuideJoint().getGlobalRotation();
 	
 	glm::mat4 guideModel = model * toGLMmat4(r, t);
 
+	setShaderUniforms(projView, guideModel, lightPos, color, palette, mJointOffset);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glDrawElements(GL_TRIANGLES, 3 * numTriangles, GL_UNSIGNED_INT, 0);
+}
+
+void FBXModel::drawCrowd(const glm::mat4& projView, const glm::mat4& model, const glm::vec3& lightPos, const glm::vec3& color,
+	const JointPalette& palette, int firstJoint, int numInstances)
+{
+	setShaderUniforms(projView, model, lightPos, color, palette, firstJoint);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glDrawElementsInstanced(GL_TRIANGLES, 3 * numTriangles, GL_UNSIGNED_INT, 0, numInstances);
+}
+
+void FBXModel::setShaderUniforms(const glm::mat4& projView, const glm::mat4& model, const glm::vec3& lightPos,
+	const glm::vec3& color, const JointPalette& palette, int firstJoint)
+{
+	if (!mFBXShader)
+	{
+		throw std::runtime_error("Shader isn't created.");
+	}
 	mFBXShader->use();
-	setShaderJointTransMats();
+	palette.bind(0);
+	mFBXShader->setInt("uJointPalette", 0);
+	mFBXShader->setInt("uJointOffset", firstJoint);
+	mFBXShader->setInt("uJointsPerInstance", mShaderJointIDs.size());
 	mFBXShader->setMat4("uProjView", projView);
-	mFBXShader->setMat4("uModel", guideModel);
-	mFBXShader->setMat3("uModelInvTr", glm::mat3(glm::transpose(glm::inverse(guideModel))));
+	mFBXShader->setMat4("uModel", model);
+	mFBXShader->setMat3("uModelInvTr", glm::mat3(glm::transpose(glm::inverse(model))));
 	mFBXShader->setVec3("uLightPos", lightPos);
 	mFBXShader->setVec3("color", color);
-
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glDrawElements(GL_TRIANGLES, 3 * numTriangles, GL_UNSIGNED_INT, 0);
 }
 
 void FBXModel::drawTargets(const glm::mat4 & projView, const glm::mat4 & model, const glm::vec3 & color, float size)
@@ -276,7 +303,7 @@ void FBXModel::traverseJoints(const ofbx::Object * node)
 
 bool FBXModel::constructSkeleton()
 {
-	mSkeletonMap.clear();
+	mShaderJointIDs.assign(mJointMap.size(), -1);
 	mIKTargets.clear();
 	ASkeleton* skeleton = mBVHController->getSkeleton();
 
@@ -287,7 +314,7 @@ bool FBXModel::constructSkeleton()
 		if (!actorJoint) { return false; }
 		setLimbJoints(actorJoint);
 		//std::cout << actorJoint->getName() << " id:" << actorJoint->getID() << std::endl;
-		mSkeletonMap.emplace(actorJoint->getID(), joint);
+		mShaderJointIDs[pair.second] = actorJoint->getID();
 	}
 
 	// Set uo the IK Skeleton and create 4 limb IK chains
@@ -332,42 +359,57 @@ void FBXModel::createShader(const std::string & vert, const std::string & frag)
 	mFBXShader = std::make_unique<Shader>(vert.c_str(), frag.c_str());
 }
 
+// Global matrix of the skeleton joint behind a shader joint, identity for a shader joint the skeleton does not
+// have (-1 until constructSkeleton finds it)
+static glm::mat4 shaderJointMat(const std::vector<ATransform>& globals, int id)
+{
+	if (id < 0 || id >= globals.size()) { return glm::mat4(1.0f); }
+	return toGLMmat4(globals[id].m_rotation, globals[id].m_translation);
+}
+
 void FBXModel::setShaderBindMats()
 {
-	mFBXShader->use();
-	std::vector<glm::mat4> mats(mJointMap.size());
-	for (const auto& pair : mSkeletonMap)
+	// The shader only gets the skinning matrices, the bind matrices are kept to build them
+	mSkeleton->getLocal2Global(mGlobals);
+	mBindMats.resize(mShaderJointIDs.size());
+	for (int i = 0; i < mShaderJointIDs.size(); ++i)
 	{
-		AJoint* joint = mSkeleton->getJointByID(pair.first);
-		const auto* node = pair.second;
-		int index = mJointMap[node];
-
-		mat3 rot = joint->getGlobalRotation();
-		vec3 tran = joint->getGlobalTranslation();
-
-		ofbx::Matrix mat = node->getGlobalTransform();
-		glm::mat4 model = toGLMmat4(rot, tran);
-		mats[index] = glm::inverse(model);
+		mBindMats[i] = glm::inverse(shaderJointMat(mGlobals, mShaderJointIDs[i]));
 	}
-	mFBXShader->setMatN("uBindMats", mats, mats.size());
 }
 
-void FBXModel::setShaderJointTransMats()
+void FBXModel::updateSkinningMats(const ASkeleton& skeleton, const glm::mat4& transform)
 {
-	mFBXShader->use();
-	std::vector<glm::mat4> mats(mJointMap.size());
-	for (const auto& pair : mSkeletonMap)
+	// One matrix product and one 3x3 inverse per joint here, instead of per vertex and influence in the shader
+	skeleton.getLocal2Global(mGlobals);
+	mBindMats.resize(mShaderJointIDs.size(), glm::mat4(1.0f));	// no bind pose set yet
+	mSkinningMats.resize(mShaderJointIDs.size());
+	mNormalMats.resize(mShaderJointIDs.size());
+	for (int i = 0; i < mShaderJointIDs.size(); ++i)
 	{
-		AJoint* joint = mSkeleton->getJointByID(pair.first);
-		const auto* node = pair.second;
-		int index = mJointMap[node];
-
-		mat3 rot = joint->getGlobalRotation();
-		vec3 tran = joint->getGlobalTranslation();
-		glm::mat4 model = toGLMmat4(rot, tran);
-		mats[index] = model;
+		mSkinningMats[i] = transform * shaderJointMat(mGlobals, mShaderJointIDs[i]) * mBindMats[i];
+		mNormalMats[i] = glm::transpose(glm::inverse(glm::mat3(mSkinningMats[i])));
 	}
-	mFBXShader->setMatN("uJointTransMats", mats, mats.size());
+}
+
+void FBXModel::writeJointPalette(JointPalette& palette)
+{
+	mJointOffset = writeJointPalette(*mSkeleton, glm::mat4(1.0f), palette);
+}
+
+int FBXModel::writeJointPalette(const ASkeleton& skeleton, const glm::mat4& transform, JointPalette& palette)
+{
+	updateSkinningMats(skeleton, transform);
+	return palette.add(mSkinningMats, mNormalMats);
+}
+
+void FBXModel::skinVertices(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals)
+{
+	updateSkinningMats(*mSkeleton, glm::mat4(1.0f));
+	mSkinning.setJointMatrices(reinterpret_cast<const float*>(mSkinningMats.data()), mSkinningMats.size());
+	positions.resize(mSkinning.getNumVertices());
+	normals.resize(mSkinning.getNumVertices());
+	mSkinning.skin(reinterpret_cast<float*>(positions.data()), reinterpret_cast<float*>(normals.data()));
 }
 
 void FBXModel::updateDeltaT(float deltaT)
@@ -400,6 +442,9 @@ void FBXModel::computeIK(int type, IKTarget & target)
 	case IKController::PSEDUOINV:
 		mIKController->IKSolver_PseudoInv(target.jointID, target.target);
 		break;
+	case IKController::FABRIK:
+		mIKController->IKSolver_Other(target.jointID, target.target);
+		break;
 	case IKController::LIMB:
 	default:
 		mIKController->IKSolver_Limb(target.jointID, target.target);
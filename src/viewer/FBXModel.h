@@ -9,17 +9,13 @@
 #include "shader.h"
 #include "aActor.h"
 #include "aBVHController.h"
+#include "aSkinning.h"
 #include "drawable.h"
+#include "JointPalette.h"
 #include "utils.h"
 
-constexpr int MAXJOINTNUM = 6;
-struct FBXVertex
-{
-	glm::vec3 pos;
-	glm::vec3 nor;
-	int jointNum;
-	glm::vec2 jointWeight[MAXJOINTNUM];	// first: joint id, second: weight
-};
+constexpr int MAXJOINTNUM = ASkinning::kMaxInfluences;
+typedef ASkinning::Vertex FBXVertex;	// position, normal, then the joint indices in the shader and their weights
 
 struct IKTarget
 {
@@ -40,14 +36,24 @@ public:
 	bool loadBVHMotion(const std::string& filename, bool updateShaderBindMats = false);
 	bool loadShaders();
 
+	// Draws with the joints that the last writeJointPalette put in palette
 	void drawModel(const glm::mat4& projView, const glm::mat4& model,
-			const glm::vec3& lightPos, const glm::vec3& color);
+			const glm::vec3& lightPos, const glm::vec3& color, const JointPalette& palette);
+	// Draws numInstances copies of the mesh with one instanced draw call. Instance i is skinned with the joints
+	// written to palette at firstJoint + i * getNumShaderJoints().
+	void drawCrowd(const glm::mat4& projView, const glm::mat4& model, const glm::vec3& lightPos, const glm::vec3& color,
+			const JointPalette& palette, int firstJoint, int numInstances);
 	void drawTargets(const glm::mat4& projView, const glm::mat4& model, const glm::vec3& color, float size);
 	void drawSkeleton(const glm::mat4& projView, const glm::mat4& model, const glm::vec3& color);
 
 	void createShader(const std::string& vert, const std::string& frag);
 	void setShaderBindMats();
-	void setShaderJointTransMats();
+	void writeJointPalette(JointPalette& palette);	// Add the skinning matrices of the current pose to palette
+	// Add the skinning matrices of another skeleton of the same clip, moved by transform. Returns where they start.
+	int writeJointPalette(const ASkeleton& skeleton, const glm::mat4& transform, JointPalette& palette);
+	int getNumShaderJoints() const { return mShaderJointIDs.size(); }
+	// Skin the mesh on the CPU in the current pose, in model space before the guide transform (for picking, export...)
+	void skinVertices(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals);
 
 	void updateDeltaT(float deltaT);	// Update the model by a timestep
 	void updateT(float t);	// Update the model to time t;
@@ -72,7 +78,17 @@ private:
 	int numTriangles;	// Number of triangles
 
 	std::unordered_map<const ofbx::Object*, int> mJointMap;		// Map between joint node and the index of this joint in shader
-	std::unordered_map<int, const ofbx::Object*> mSkeletonMap;		// Map between joint id in actor's skeleton and the joint node
+	std::vector<int> mShaderJointIDs;	// Joint id in actor's skeleton of each shader joint index, set by constructSkeleton
+	std::vector<glm::mat4> mBindMats;	// Inverse bind matrix of each shader joint
+	std::vector<ATransform> mGlobals;	// Global transforms of the skeleton being skinned, computed in one pass; scratch shared by the crowd
+	std::vector<glm::mat4> mSkinningMats;	// Joint transform * bind matrix of each shader joint, for the current pose
+	std::vector<glm::mat3> mNormalMats;	// Inverse transpose of the skinning matrices
+	int mJointOffset = 0;	// Index of the first joint of this model in the palette it was written to
+	ASkinning mSkinning;	// The mesh for skinVertices
+
+	void updateSkinningMats(const ASkeleton& skeleton, const glm::mat4& transform);
+	void setShaderUniforms(const glm::mat4& projView, const glm::mat4& model, const glm::vec3& lightPos,
+			const glm::vec3& color, const JointPalette& palette, int firstJoint);
 	std::unordered_map<int, std::string> mIKJointMap;	// Map between IK joint id and the joint name;
 
 	
@@ -1,5 +1,9 @@
 #include "FKViewer.h"
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
+#include <gtc/matrix_transform.hpp>
+#include "aThreadPool.h"
 
 FKViewer::FKViewer(const std::string & name) :
 	Viewer(name)
@@ -39,6 +43,21 @@ void FKViewer::createGUIWindow()
 	if (mFKIKMode == 0)	// FK
 	{
 		ImGui::SliderFloat("Time Scale", &mTimeScale, 0, 2);
+		ImGui::Checkbox("Crowd", &mCrowdMode);
+		if (mCrowdMode)
+		{
+			ImGui::SliderInt("Crowd Size", &mCrowdSize, 1, 1000);
+			ImGui::Text("%d instances, 1 draw call", (int)mCrowd.size());
+			ImGui::Text("%.2f ms to pose, %.2f ms to fill and upload the palette", mCrowdPoseMs, mCrowdPaletteMs);
+			if (!mCrowdFailedClip.empty()) { ImGui::Text("Could not load %s", mCrowdFailedClip.c_str()); }
+			// Frame time of every crowd size tried so far
+			ImGui::Text("Instances   ms/frame");
+			for (const auto& frameMs : mCrowdFrameMs)
+			{
+				ImGui::Text("%9d   %8.2f", frameMs.first, frameMs.second);
+			}
+			if (ImGui::Button("Clear Timings")) { mCrowdFrameMs.clear(); }
+		}
 		ImGui::Separator();
 		// List box
 		ImGui::Text("Motions");
@@ -59,7 +78,7 @@ void FKViewer::createGUIWindow()
 	}
 	else if (mFKIKMode == 1)	// IK
 	{
-		const char* IKSolvers[] = { "Limb-based", "CCD", "Pseudo Inverse" };
+		const char* IKSolvers[] = { "Limb-based", "CCD", "Pseudo Inverse", "FABRIK" };
 		ImGui::Combo("IK Solver", &mIKType, IKSolvers, IM_ARRAYSIZE(IKSolvers));
 
 		for (auto& target : mFBXModel.mIKTargets)
@@ -82,15 +101,53 @@ void FKViewer::drawScene()
 	glm::mat4 model = glm::mat4(1.0f);
 	glm::mat4 projView = mCamera.getProjView();
 	// Draw Model
+	bool drawCrowd = mFKIKMode == 0 && mCrowdMode && mLoaded;
 	if (mFKIKMode == 0)
 	{
 		float currentTime = glfwGetTime();
 		mFBXModel.updateDeltaT((currentTime - mLastTime) * mTimeScale);
+		if (drawCrowd) { updateCrowd((currentTime - mLastTime) * mTimeScale); }
 		mLastTime = currentTime;	
 	}
-	mShowSkeleton?
-		mFBXModel.drawSkeleton(projView, model, glm::vec3(1, 1, 1)) :
-		mFBXModel.drawModel(projView, model, mLightPos, glm::vec3(0.2, 0.9, 1.0));
+	if (mShowSkeleton)
+	{
+		mFBXModel.drawSkeleton(projView, model, glm::vec3(1, 1, 1));
+	}
+	else
+	{
+		// Upload the joints of all models at once, then draw each
+		double paletteStart = glfwGetTime();
+		if (!mJointPalette) { mJointPalette = std::make_unique<JointPalette>(); }
+		mJointPalette->clear();
+		mFBXModel.writeJointPalette(*mJointPalette);
+		int crowdJoint = mJointPalette->getNumJoints();
+		if (drawCrowd)
+		{
+			for (int i = 0; i < mCrowd.size(); ++i)
+			{
+				mFBXModel.writeJointPalette(*mCrowd[i]->getSkeleton(), getCrowdTransform(i), *mJointPalette);
+			}
+		}
+		mJointPalette->upload();
+		if (drawCrowd) { mCrowdPaletteMs = (glfwGetTime() - paletteStart) * 1000.0; }
+
+		mFBXModel.drawModel(projView, model, mLightPos, glm::vec3(0.2, 0.9, 1.0), *mJointPalette);
+		if (drawCrowd && !mCrowd.empty())
+		{
+			mFBXModel.drawCrowd(projView, model, mLightPos, glm::vec3(0.9, 0.6, 0.3), *mJointPalette, crowdJoint, mCrowd.size());
+		}
+	}
+
+	// Frame to frame time, smoothed, for the crowd size drawn
+	double frameTime = glfwGetTime();
+	if (drawCrowd && mLastFrameTime > 0)
+	{
+		float ms = (frameTime - mLastFrameTime) * 1000.0;
+		auto frameMs = mCrowdFrameMs.find(mCrowd.size());
+		if (frameMs == mCrowdFrameMs.end()) { mCrowdFrameMs[mCrowd.size()] = ms; }
+		else { frameMs->second = 0.95f * frameMs->second + 0.05f * ms; }
+	}
+	mLastFrameTime = frameTime;
 	if (mFKIKMode == 1)	// IK
 	{
 		mFBXModel.drawTargets(projView, model, glm::vec3(0.5, 1.0, 0.4), 20);
@@ -166,11 +223,65 @@ void FKViewer::cursorPosCallback(GLFWwindow * window, double xpos, double ypos)
 void FKViewer::loadBVHFile(int index)
 {
 	mLoaded = mFBXModel.loadBVHMotion(mBVHFilePaths[index], false);
+	mCrowdClip = mBVHFilePaths[index];
+	mCrowd.clear();	// Respawned with the new clip
 }
 
 void FKViewer::reset()
 {
 	mFBXModel.mActor.resetGuide();
 	mFBXModel.loadBVHMotion("../motions/Beta/Beta.bvh");
+	mCrowdClip = "../motions/Beta/Beta.bvh";
+	mCrowd.clear();
+}
+
+void FKViewer::spawnCrowd()
+{
+	// The palette holds the joints of the model and of every instance
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	int jointsPerInstance = std::max(1, mFBXModel.getNumShaderJoints());
+	mCrowdSize = std::min(mCrowdSize, maxTexels / JointPalette::kTexelsPerJoint / jointsPerInstance - 1);
+
+	mCrowd.resize(std::min<int>(mCrowd.size(), mCrowdSize));
+	if (mCrowdClip == mCrowdFailedClip) { return; }
+	while (mCrowd.size() < mCrowdSize)
+	{
+		// The actors share the clip of the model, and so its joint ids
+		std::unique_ptr<AActor> actor = std::make_unique<AActor>();
+		if (!actor->getBVHController()->load(mCrowdClip))
+		{
+			mCrowdFailedClip = mCrowdClip;
+			return;
+		}
+		mCrowd.push_back(std::move(actor));
+	}
+}
+
+void FKViewer::updateCrowd(float deltaT)
+{
+	spawnCrowd();
+	double start = glfwGetTime();
+	mCrowdTime += deltaT;
+	float time = mCrowdTime;
+	AThreadPool::Get().parallelFor(mCrowd.size(), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			// Every actor at its own point of the clip
+			BVHController* controller = mCrowd[i]->getBVHController();
+			float duration = controller->getDuration();
+			controller->update(duration > 0 ? fmodf(time + 0.37f * i, duration) : 0);
+		}
+	}, 8);
+	mCrowdPoseMs = (glfwGetTime() - start) * 1000.0;
+}
+
+glm::mat4 FKViewer::getCrowdTransform(int index) const
+{
+	int columns = std::max(1, (int)std::ceil(std::sqrt((float)mCrowdSize)));
+	float spacing = 150;
+	glm::vec3 pos((index % columns - 0.5f * (columns - 1)) * spacing, 0, -(index / columns + 1) * spacing);
+	return glm::translate(glm::mat4(1.0f), pos);
 }
 
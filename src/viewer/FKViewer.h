@@ -2,6 +2,7 @@
 #include "viewer.h"
 #include "FBXModel.h"
 #include "objmodel.h"
+#include <map>
 
 class FKViewer : public Viewer
 {
@@ -16,6 +17,7 @@ public:
 
 private:
 	FBXModel mFBXModel;
+	std::unique_ptr<JointPalette> mJointPalette;	// Joints of every model drawn this frame
 
 	int mCurrentBVHFileIndex = 2;	// Default "Beta.bvh"
 	float mTimeScale = 1.0f;
@@ -26,12 +28,27 @@ private:
 	std::vector<std::string> mBVHFileStems;		// Filenames that show in the list box
 	
 	int mFKIKMode = 0;	// 0 for FK, 1 for IK
-	int mIKType = 0;	// 0 for Limb, 1 for CCD, 2 for Pseudo Inverse
+	int mIKType = 0;	// 0 for Limb, 1 for CCD, 2 for Pseudo Inverse, 3 for FABRIK
 	bool mLoaded = true;
 	bool mShowSkeleton = false;
 
+	// Crowd mode: copies of the model playing the same clip, drawn with one instanced draw call
+	bool mCrowdMode = false;
+	int mCrowdSize = 100;
+	std::vector<std::unique_ptr<AActor>> mCrowd;
+	std::string mCrowdClip = "../motions/Beta/Beta.bvh";	// The clip of the model, that the crowd plays
+	float mCrowdTime = 0;
+	std::string mCrowdFailedClip;	// The last clip the crowd could not load, not tried again until the clip changes
+	float mCrowdPoseMs = 0;	// CPU time to pose the crowd
+	float mCrowdPaletteMs = 0;	// CPU time to fill the joint palette and upload it
+	double mLastFrameTime = 0;
+	std::map<int, float> mCrowdFrameMs;	// Smoothed frame time of each crowd size drawn
+
 	void loadBVHFile(int index);
 	void reset();
+	void spawnCrowd();	// Add or remove actors until there are mCrowdSize
+	void updateCrowd(float deltaT);
+	glm::mat4 getCrowdTransform(int index) const;	// Place of an instance, on a grid behind the model
 
 	IKTarget* mPickedTarget;
 	float mPickedRayT;	// Store the t of the casted ray when the target is picked
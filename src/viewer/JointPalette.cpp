@@ -0,0 +1,48 @@
+#include "JointPalette.h"
+
+JointPalette::JointPalette()
+{
+	glGenBuffers(1, &TBO);
+	glGenTextures(1, &texture);
+}
+
+JointPalette::~JointPalette()
+{
+	glDeleteTextures(1, &texture);
+	glDeleteBuffers(1, &TBO);
+}
+
+int JointPalette::add(const std::vector<glm::mat4>& skinningMats, const std::vector<glm::mat3>& normalMats)
+{
+	int offset = mTexels.size() / kTexelsPerJoint;
+	for (int i = 0; i < skinningMats.size(); ++i)
+	{
+		for (int c = 0; c < 4; ++c) { mTexels.push_back(skinningMats[i][c]); }
+		for (int c = 0; c < 3; ++c) { mTexels.push_back(glm::vec4(normalMats[i][c], 0)); }
+	}
+	return offset;
+}
+
+void JointPalette::upload()
+{
+	glBindBuffer(GL_TEXTURE_BUFFER, TBO);
+	size_t size = mTexels.size() * sizeof(glm::vec4);
+	if (size > mCapacity)
+	{
+		mCapacity = size;
+		glBufferData(GL_TEXTURE_BUFFER, mCapacity, nullptr, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, TBO);
+	}
+	else
+	{
+		glBufferData(GL_TEXTURE_BUFFER, mCapacity, nullptr, GL_STREAM_DRAW);	// orphan the one last frame's draws read
+	}
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, size, mTexels.data());
+}
+
+void JointPalette::bind(int unit) const
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+}
@@ -0,0 +1,38 @@
+#ifndef JointPalette_H_
+#define JointPalette_H_
+
+#include <glad/glad.h>
+#include <glm.hpp>
+#include <vector>
+
+// Skinning and normal matrices of every model drawn in a frame, in one texture buffer.
+// Each model appends its joints with add, which returns where they start. The buffer is uploaded once with
+// upload, then every draw reads its own slice from that offset. There is no limit on the number of joints
+// other than GL_MAX_TEXTURE_BUFFER_SIZE.
+class JointPalette
+{
+public:
+	static const int kTexelsPerJoint = 7;	// 4 columns of the skinning matrix, then 3 of the normal matrix
+
+	JointPalette();
+	~JointPalette();
+
+	void clear() { mTexels.clear(); }
+
+	// Returns the index of the first joint added
+	int add(const std::vector<glm::mat4>& skinningMats, const std::vector<glm::mat3>& normalMats);
+
+	void upload();
+	void bind(int unit) const;
+
+	int getNumJoints() const { return mTexels.size() / kTexelsPerJoint; }
+
+	GLuint TBO;
+	GLuint texture;
+
+private:
+	std::vector<glm::vec4> mTexels;
+	size_t mCapacity = 0;
+};
+
+#endif